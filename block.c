@@ -50,6 +50,7 @@
 #include "qemu/timer.h"
 #include "qemu/cutils.h"
 #include "qemu/id.h"
+#include "qemu/interval-tree.h"
 #include "qemu/range.h"
 #include "qemu/rcu.h"
 #include "block/coroutines.h"
@@ -106,6 +107,9 @@ static void bdrv_reopen_abort(BDRVReopenState *reopen_state);
 
 static bool bdrv_backing_overridden(BlockDriverState *bs);
 
+static BdrvBlockStatusCache *bdrv_bsc_new(void);
+static void bdrv_bsc_free(BdrvBlockStatusCache *bsc);
+
 static bool GRAPH_RDLOCK
 bdrv_change_aio_context(BlockDriverState *bs, AioContext *ctx,
                         GHashTable *visited, Transaction *tran, Error **errp);
@@ -427,8 +431,7 @@ BlockDriverState *bdrv_new(void)
 
     qemu_co_queue_init(&bs->flush_queue);
 
-    qemu_co_mutex_init(&bs->bsc_modify_lock);
-    bs->block_status_cache = g_new0(BdrvBlockStatusCache, 1);
+    bs->block_status_cache = bdrv_bsc_new();
 
     for (i = 0; i < bdrv_drain_all_count; i++) {
         bdrv_do_drained_begin_quiesce(bs, NULL);
@@ -5200,7 +5203,7 @@ static void GRAPH_UNLOCKED bdrv_close(BlockDriverState *bs)
     bs->explicit_options = NULL;
     qobject_unref(bs->full_open_options);
     bs->full_open_options = NULL;
-    g_free(bs->block_status_cache);
+    bdrv_bsc_free(bs->block_status_cache);
     bs->block_status_cache = NULL;
 
     bdrv_release_named_dirty_bitmaps(bs);
@@ -8448,31 +8451,82 @@ BlockDriverState *bdrv_backing_chain_next(BlockDriverState *bs)
     return bdrv_skip_filters(bdrv_cow_bs(bdrv_skip_filters(bs)));
 }
 
-/**
- * Check whether [offset, offset + bytes) overlaps with the cached
- * block-status data region.
- *
- * If so, and @pnum is not NULL, set *pnum to `bsc.data_end - offset`,
- * which is what bdrv_bsc_is_data()'s interface needs.
- * Otherwise, *pnum is not touched.
- */
-static bool bdrv_bsc_range_overlaps_locked(BlockDriverState *bs,
-                                           int64_t offset, int64_t bytes,
-                                           int64_t *pnum)
+/* Data region of a protocol node, as cached in its BdrvBlockStatusCache */
+typedef struct BdrvBlockStatusExtent {
+    IntervalTreeNode node;
+    /* Set by lookups, cleared when the CLOCK hand passes */
+    bool referenced;
+    QTAILQ_ENTRY(BdrvBlockStatusExtent) clock;
+    struct rcu_head rcu;
+} BdrvBlockStatusExtent;
+
+/* Upper bound for the number of data regions cached per node */
+#define BDRV_BSC_MAX_EXTENTS 1024
+
+static BdrvBlockStatusCache *bdrv_bsc_new(void)
 {
-    BdrvBlockStatusCache *bsc = qatomic_rcu_read(&bs->block_status_cache);
-    bool overlaps;
+    BdrvBlockStatusCache *bsc = g_new0(BdrvBlockStatusCache, 1);
 
-    overlaps =
-        qatomic_read(&bsc->valid) &&
-        ranges_overlap(offset, bytes, bsc->data_start,
-                       bsc->data_end - bsc->data_start);
+    qemu_mutex_init(&bsc->lock);
+    QTAILQ_INIT(&bsc->clock);
+    return bsc;
+}
 
-    if (overlaps && pnum) {
-        *pnum = bsc->data_end - offset;
+static void bdrv_bsc_free(BdrvBlockStatusCache *bsc)
+{
+    BdrvBlockStatusExtent *ext, *next;
+
+    if (!bsc) {
+        return;
     }
 
-    return overlaps;
+    /* No lookups can be running on a node that is being closed */
+    QTAILQ_FOREACH_SAFE(ext, &bsc->clock, clock, next) {
+        g_free(ext);
+    }
+    qemu_mutex_destroy(&bsc->lock);
+    g_free(bsc);
+}
+
+static void bdrv_bsc_insert_locked(BdrvBlockStatusCache *bsc,
+                                   uint64_t start, uint64_t last)
+{
+    BdrvBlockStatusExtent *ext = g_new0(BdrvBlockStatusExtent, 1);
+
+    ext->node.start = start;
+    ext->node.last = last;
+    interval_tree_insert(&ext->node, &bsc->extents);
+    QTAILQ_INSERT_TAIL(&bsc->clock, ext, clock);
+    bsc->nb_extents++;
+}
+
+static void bdrv_bsc_remove_locked(BdrvBlockStatusCache *bsc,
+                                   BdrvBlockStatusExtent *ext)
+{
+    if (bsc->clock_hand == ext) {
+        bsc->clock_hand = QTAILQ_NEXT(ext, clock);
+    }
+    interval_tree_remove(&ext->node, &bsc->extents);
+    QTAILQ_REMOVE(&bsc->clock, ext, clock);
+    bsc->nb_extents--;
+    g_free_rcu(ext, rcu);
+}
+
+/*
+ * Pick a region to evict: advance the CLOCK hand, giving regions that were
+ * used since it last passed them a second chance.
+ */
+static BdrvBlockStatusExtent *bdrv_bsc_victim_locked(BdrvBlockStatusCache *bsc)
+{
+    BdrvBlockStatusExtent *ext;
+
+    for (;;) {
+        ext = bsc->clock_hand ?: QTAILQ_FIRST(&bsc->clock);
+        bsc->clock_hand = QTAILQ_NEXT(ext, clock);
+        if (!qatomic_xchg(&ext->referenced, false)) {
+            return ext;
+        }
+    }
 }
 
 /**
@@ -8480,9 +8534,32 @@ static bool bdrv_bsc_range_overlaps_locked(BlockDriverState *bs,
  */
 bool bdrv_bsc_is_data(BlockDriverState *bs, int64_t offset, int64_t *pnum)
 {
+    BdrvBlockStatusCache *bsc = bs->block_status_cache;
+    IntervalTreeNode *node;
+    BdrvBlockStatusExtent *ext;
     IO_CODE();
+
+    /*
+     * A lookup that races with a writer may miss a region, which only
+     * costs a query to the driver.  A region that it finds is one that
+     * was cached; regions are never modified in place.
+     */
     RCU_READ_LOCK_GUARD();
-    return bdrv_bsc_range_overlaps_locked(bs, offset, 1, pnum);
+
+    node = interval_tree_iter_first(&bsc->extents, offset, offset);
+    if (!node) {
+        return false;
+    }
+
+    ext = container_of(node, BdrvBlockStatusExtent, node);
+    if (!qatomic_read(&ext->referenced)) {
+        qatomic_set(&ext->referenced, true);
+    }
+
+    if (pnum) {
+        *pnum = node->last + 1 - offset;
+    }
+    return true;
 }
 
 /**
@@ -8491,11 +8568,30 @@ bool bdrv_bsc_is_data(BlockDriverState *bs, int64_t offset, int64_t *pnum)
 void bdrv_bsc_invalidate_range(BlockDriverState *bs,
                                int64_t offset, int64_t bytes)
 {
+    BdrvBlockStatusCache *bsc = bs->block_status_cache;
+    uint64_t last = offset + bytes - 1;
+    IntervalTreeNode *node;
     IO_CODE();
-    RCU_READ_LOCK_GUARD();
 
-    if (bdrv_bsc_range_overlaps_locked(bs, offset, bytes, NULL)) {
-        qatomic_set(&bs->block_status_cache->valid, false);
+    if (!bytes) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&bsc->lock);
+
+    while ((node = interval_tree_iter_first(&bsc->extents, offset, last))) {
+        uint64_t node_start = node->start, node_last = node->last;
+
+        bdrv_bsc_remove_locked(bsc,
+                               container_of(node, BdrvBlockStatusExtent, node));
+
+        /* Keep what is left of the region on either side of the range */
+        if (node_start < offset) {
+            bdrv_bsc_insert_locked(bsc, node_start, offset - 1);
+        }
+        if (node_last > last) {
+            bdrv_bsc_insert_locked(bsc, last + 1, node_last);
+        }
     }
 }
 
@@ -8504,21 +8600,25 @@ void bdrv_bsc_invalidate_range(BlockDriverState *bs,
  */
 void bdrv_bsc_fill(BlockDriverState *bs, int64_t offset, int64_t bytes)
 {
-    BdrvBlockStatusCache *new_bsc = g_new(BdrvBlockStatusCache, 1);
-    BdrvBlockStatusCache *old_bsc;
+    BdrvBlockStatusCache *bsc = bs->block_status_cache;
+    uint64_t start = offset, last = offset + bytes - 1;
+    IntervalTreeNode *node;
     IO_CODE();
 
-    *new_bsc = (BdrvBlockStatusCache) {
-        .valid = true,
-        .data_start = offset,
-        .data_end = offset + bytes,
-    };
+    QEMU_LOCK_GUARD(&bsc->lock);
 
-    QEMU_LOCK_GUARD(&bs->bsc_modify_lock);
+    /* Merge with the regions that overlap or adjoin the new one */
+    while ((node = interval_tree_iter_first(&bsc->extents,
+                                            start ? start - 1 : 0,
+                                            last + 1))) {
+        start = MIN(start, node->start);
+        last = MAX(last, node->last);
+        bdrv_bsc_remove_locked(bsc,
+                               container_of(node, BdrvBlockStatusExtent, node));
+    }
 
-    old_bsc = qatomic_rcu_read(&bs->block_status_cache);
-    qatomic_rcu_set(&bs->block_status_cache, new_bsc);
-    if (old_bsc) {
-        g_free_rcu(old_bsc, rcu);
+    if (bsc->nb_extents == BDRV_BSC_MAX_EXTENTS) {
+        bdrv_bsc_remove_locked(bsc, bdrv_bsc_victim_locked(bsc));
     }
+    bdrv_bsc_insert_locked(bsc, start, last);
 }
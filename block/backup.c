@@ -336,6 +336,18 @@ static bool backup_cancel(Job *job, bool force)
     return true;
 }
 
+static void backup_query(BlockJob *job, BlockJobInfo *info)
+{
+    BackupBlockJob *s = container_of(job, BackupBlockJob, common);
+
+    info->u.backup = (BlockJobInfoBackup) {
+        .chunk_size = MIN_NON_ZERO(block_copy_chunk(s->bcs),
+                                   s->perf.max_chunk),
+        .workers = MIN_NON_ZERO(s->perf.max_workers,
+                                block_copy_adaptive_workers(s->bcs)),
+    };
+}
+
 static const BlockJobDriver backup_job_driver = {
     .job_driver = {
         .instance_size          = sizeof(BackupBlockJob),
@@ -350,6 +362,7 @@ static const BlockJobDriver backup_job_driver = {
         .cancel                 = backup_cancel,
     },
     .set_speed = backup_set_speed,
+    .query = backup_query,
 };
 
 BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
@@ -494,6 +507,9 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
     job->perf = *perf;
 
     block_copy_set_copy_opts(bcs, perf->use_copy_range, compress);
+    if (perf->adaptive) {
+        block_copy_set_adaptive(bcs, perf->max_workers, perf->max_chunk);
+    }
     block_copy_set_progress_meter(bcs, &job->common.job.progress);
     block_copy_set_speed(bcs, speed);
 
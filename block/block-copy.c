@@ -35,6 +35,9 @@
 #define BLOCK_COPY_MAX_WORKERS 64
 #define BLOCK_COPY_SLICE_TIME 100000000ULL /* ns */
 #define BLOCK_COPY_CLUSTER_SIZE_DEFAULT (1 << 16)
+#define BLOCK_COPY_ADAPT_WINDOW_NS 100000000LL
+#define BLOCK_COPY_ADAPT_MIN_TASKS 4
+#define BLOCK_COPY_ADAPT_INIT_WORKERS 4
 
 typedef enum {
     COPY_READ_WRITE_CLUSTER,
@@ -155,6 +158,30 @@ typedef struct BlockCopyState {
      * block_copy_reset_unallocated() every time it does.
      */
     bool skip_unallocated; /* atomic */
+    /*
+     * Chunk size computed by block_copy_chunk_size() for the last created
+     * task, for reporting.  Read with qatomic_read_i64().
+     */
+    int64_t chunk;
+
+    /*
+     * Adaptive tuning of the chunk size and of the number of parallel
+     * tasks, see block_copy_adapt_locked().  @adapt_workers is also read
+     * atomically for reporting.
+     */
+    bool adaptive;
+    int adapt_max_workers;
+    int adapt_workers;
+    int64_t adapt_max_chunk;
+    int64_t adapt_chunk;
+    bool adapt_slow_start;
+    int64_t adapt_window_start;
+    uint64_t adapt_window_bytes;
+    uint64_t adapt_window_latency; /* sum over tasks, ns */
+    int adapt_window_tasks;
+    uint64_t adapt_best_throughput; /* bytes per second */
+    uint64_t adapt_base_latency; /* ns */
+
     /* State fields that use a thread-safe API */
     BdrvDirtyBitmap *copy_bitmap;
     ProgressMeter *progress;
@@ -165,6 +192,10 @@ typedef struct BlockCopyState {
 /* Called with lock held */
 static int64_t block_copy_chunk_size(BlockCopyState *s)
 {
+    if (s->adaptive) {
+        return s->adapt_chunk;
+    }
+
     switch (s->method) {
     case COPY_READ_WRITE_CLUSTER:
         return s->cluster_size;
@@ -193,7 +224,9 @@ block_copy_task_create(BlockCopyState *s, BlockCopyCallState *call_state,
     int64_t max_chunk;
 
     QEMU_LOCK_GUARD(&s->lock);
-    max_chunk = MIN_NON_ZERO(block_copy_chunk_size(s), call_state->max_chunk);
+    max_chunk = block_copy_chunk_size(s);
+    qatomic_set_i64(&s->chunk, max_chunk);
+    max_chunk = MIN_NON_ZERO(max_chunk, call_state->max_chunk);
     if (!bdrv_dirty_bitmap_next_dirty_area(s->copy_bitmap,
                                            offset, offset + bytes,
                                            max_chunk, &offset, &bytes))
@@ -307,6 +340,117 @@ void block_copy_set_copy_opts(BlockCopyState *s, bool use_copy_range,
          */
         s->method = use_copy_range ? COPY_RANGE_SMALL : COPY_READ_WRITE;
     }
+    qatomic_set_i64(&s->chunk, block_copy_chunk_size(s));
+}
+
+/* Only set before running the job, no need for locking. */
+void block_copy_set_adaptive(BlockCopyState *s, int max_workers,
+                             int64_t max_chunk)
+{
+    assert(max_workers > 0);
+
+    s->adaptive = true;
+    s->adapt_max_workers = max_workers;
+    s->adapt_workers = MIN(BLOCK_COPY_ADAPT_INIT_WORKERS, max_workers);
+    if (s->method == COPY_READ_WRITE_CLUSTER) {
+        /* Compressed writes take one cluster, only the workers can adapt */
+        s->adapt_max_chunk = s->cluster_size;
+    } else {
+        s->adapt_max_chunk = MIN_NON_ZERO(MIN(MAX(s->cluster_size,
+                                                  BLOCK_COPY_MAX_COPY_RANGE),
+                                              s->max_transfer),
+                                          max_chunk);
+        s->adapt_max_chunk = MAX(QEMU_ALIGN_DOWN(s->adapt_max_chunk,
+                                                 s->cluster_size),
+                                 s->cluster_size);
+    }
+    s->adapt_chunk = MIN(MAX(s->cluster_size, BLOCK_COPY_MAX_BUFFER),
+                         s->adapt_max_chunk);
+    s->adapt_slow_start = true;
+    s->adapt_window_start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    qatomic_set_i64(&s->chunk, block_copy_chunk_size(s));
+}
+
+/*
+ * Called with lock held for each successfully finished copy task that took
+ * @latency_ns to copy @bytes.
+ *
+ * Once per window the achieved throughput is compared to the best one seen
+ * recently and the average task latency to the lowest one, much like
+ * delay-based TCP congestion control: while throughput improves, the number
+ * of workers grows (exponentially during slow start, then linearly) and,
+ * once all workers are in use, so does the chunk size.  When latency rises
+ * without a matching gain, the target is saturated and both shrink again.
+ * Slowly decaying the references makes the controller probe for more
+ * bandwidth from time to time.
+ */
+static void block_copy_adapt_locked(BlockCopyState *s, int64_t bytes,
+                                    int64_t latency_ns)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t elapsed = now - s->adapt_window_start;
+    uint64_t throughput, latency;
+    int workers = s->adapt_workers;
+    bool gaining;
+
+    s->adapt_window_bytes += bytes;
+    s->adapt_window_latency += latency_ns;
+    s->adapt_window_tasks++;
+
+    if (elapsed < BLOCK_COPY_ADAPT_WINDOW_NS ||
+        s->adapt_window_tasks < BLOCK_COPY_ADAPT_MIN_TASKS) {
+        return;
+    }
+
+    /* Don't judge windows spanning a pause or throttling of the job */
+    if (elapsed > 10 * BLOCK_COPY_ADAPT_WINDOW_NS) {
+        goto new_window;
+    }
+
+    throughput = muldiv64(s->adapt_window_bytes, NANOSECONDS_PER_SECOND,
+                          elapsed);
+    latency = s->adapt_window_latency / s->adapt_window_tasks;
+    if (!s->adapt_base_latency || latency < s->adapt_base_latency) {
+        s->adapt_base_latency = latency;
+    }
+
+    gaining = throughput > s->adapt_best_throughput +
+                           s->adapt_best_throughput / 8;
+    if (gaining) {
+        if (workers < s->adapt_max_workers) {
+            workers = s->adapt_slow_start ? workers * 2 : workers + 1;
+            workers = MIN(workers, s->adapt_max_workers);
+        } else if (s->adapt_chunk < s->adapt_max_chunk) {
+            s->adapt_chunk = MIN(s->adapt_chunk * 2, s->adapt_max_chunk);
+            /* Larger requests take longer, start over with the latency */
+            s->adapt_base_latency = 0;
+        }
+    } else if (latency > 2 * s->adapt_base_latency) {
+        s->adapt_slow_start = false;
+        if (workers > 1) {
+            workers = MAX(workers * 3 / 4, 1);
+        } else if (s->adapt_chunk > s->cluster_size) {
+            s->adapt_chunk = MAX(QEMU_ALIGN_DOWN(s->adapt_chunk / 2,
+                                                 s->cluster_size),
+                                 s->cluster_size);
+            s->adapt_base_latency = 0;
+        }
+    } else {
+        /* Throughput levelled off, continue with linear growth */
+        s->adapt_slow_start = false;
+    }
+
+    s->adapt_best_throughput = MAX(throughput, s->adapt_best_throughput -
+                                               s->adapt_best_throughput / 8);
+    s->adapt_base_latency += s->adapt_base_latency / 16;
+    qatomic_set(&s->adapt_workers, workers);
+    trace_block_copy_adapt(s, throughput, latency, workers, s->adapt_chunk);
+
+new_window:
+    s->adapt_window_start = now;
+    s->adapt_window_bytes = 0;
+    s->adapt_window_latency = 0;
+    s->adapt_window_tasks = 0;
 }
 
 static int64_t block_copy_calculate_cluster_size(BlockDriverState *target,
@@ -584,8 +728,13 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
     BlockCopyState *s = t->s;
     bool error_is_read = false;
     BlockCopyMethod method = t->method;
+    int64_t start_ns = 0;
     int ret = -1;
 
+    if (s->adaptive) {
+        start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    }
+
     WITH_GRAPH_RDLOCK_GUARD() {
         ret = block_copy_do_copy(s, t->req.offset, t->req.bytes, &method,
                                  &error_is_read);
@@ -601,8 +750,15 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
                 t->call_state->ret = ret;
                 t->call_state->error_is_read = error_is_read;
             }
-        } else if (s->progress) {
-            progress_work_done(s->progress, t->req.bytes);
+        } else {
+            if (s->progress) {
+                progress_work_done(s->progress, t->req.bytes);
+            }
+            /* Zero writes say nothing about the bandwidth of the target */
+            if (s->adaptive && method != COPY_WRITE_ZEROES) {
+                block_copy_adapt_locked(s, t->req.bytes,
+                    qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_ns);
+            }
         }
     }
     co_put_to_shres(s->mem, t->req.bytes);
@@ -736,6 +892,17 @@ int64_t coroutine_fn block_copy_reset_unallocated(BlockCopyState *s,
     return ret;
 }
 
+/* Number of tasks @call_state may currently run in parallel */
+static int block_copy_max_workers(BlockCopyCallState *call_state)
+{
+    BlockCopyState *s = call_state->s;
+
+    if (!s->adaptive) {
+        return call_state->max_workers;
+    }
+    return MIN(call_state->max_workers, qatomic_read(&s->adapt_workers));
+}
+
 /*
  * block_copy_dirty_clusters
  *
@@ -822,7 +989,11 @@ block_copy_dirty_clusters(BlockCopyCallState *call_state)
         bytes = end - offset;
 
         if (!aio && bytes) {
-            aio = aio_task_pool_new(call_state->max_workers);
+            aio = aio_task_pool_new(block_copy_max_workers(call_state));
+        } else if (aio && s->adaptive) {
+            int max_workers = block_copy_max_workers(call_state);
+
+            aio_task_pool_set_max_busy_tasks(aio, max_workers);
         }
 
         ret = block_copy_task_run(aio, task);
@@ -1057,6 +1228,16 @@ int64_t block_copy_cluster_size(BlockCopyState *s)
     return s->cluster_size;
 }
 
+int64_t block_copy_chunk(BlockCopyState *s)
+{
+    return qatomic_read_i64(&s->chunk);
+}
+
+int block_copy_adaptive_workers(BlockCopyState *s)
+{
+    return s->adaptive ? qatomic_read(&s->adapt_workers) : 0;
+}
+
 void block_copy_set_skip_unallocated(BlockCopyState *s, bool skip)
 {
     qatomic_set(&s->skip_unallocated, skip);
@@ -0,0 +1,643 @@
+/*
+ * Deduplicating filter block driver
+ *
+ * The filter hashes every block written through it and keeps an in-memory
+ * index from content digests to the blocks of the child node that hold this
+ * content.  A write of data that is already known is turned into an offloaded
+ * copy from the known block, which lets storage with extent sharing (e.g.
+ * reflinks on XFS or btrfs, or copy offload in the storage array) keep only a
+ * single copy of the data.  Rewriting a block with the content it already
+ * has is skipped altogether, and all-zero blocks are written as zeroes.
+ *
+ * The index is not persistent: it starts out empty on open and is filled by
+ * the writes going through the filter.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "block/block-io.h"
+#include "block/block_int.h"
+#include "crypto/hash.h"
+#include "qapi/error.h"
+#include "qapi/qapi-types-block-core.h"
+#include "qemu/iov.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/range.h"
+#include "qemu/units.h"
+
+#define DEDUP_HASH_ALG      QCRYPTO_HASH_ALGO_SHA256
+#define DEDUP_DIGEST_LEN    32
+#define DEDUP_MAX_BLOCK_SIZE (2 * MiB)
+
+typedef enum DedupBlockKind {
+    DEDUP_BLOCK_DATA,       /* content must be stored */
+    DEDUP_BLOCK_ZERO,       /* content is all zeroes */
+    DEDUP_BLOCK_UNCHANGED,  /* the block already holds this content */
+} DedupBlockKind;
+
+typedef struct DedupBlock {
+    DedupBlockKind kind;
+    bool has_digest;
+    uint8_t digest[DEDUP_DIGEST_LEN];
+} DedupBlock;
+
+/*
+ * A block of the child node whose content is known.  The entry is in both
+ * BDRVDedupState.by_digest and BDRVDedupState.by_block, keyed by its own
+ * @digest and @block fields.
+ */
+typedef struct DedupEntry {
+    uint8_t digest[DEDUP_DIGEST_LEN];
+    uint64_t block;
+} DedupEntry;
+
+/* A write-like request that is in flight on the child node */
+typedef struct DedupWrite {
+    int64_t offset;
+    int64_t bytes;
+
+    /*
+     * Set if another request overlapping this one was started while it was
+     * in flight.  The resulting content is undefined then, so the request
+     * must not add its blocks to the index.
+     */
+    bool superseded;
+
+    QLIST_ENTRY(DedupWrite) next;
+} DedupWrite;
+
+typedef struct BDRVDedupState {
+    uint64_t block_size;
+    uint64_t max_entries;
+
+    /*
+     * Taken for reading while copying from a block found in the index, and
+     * for writing when removing blocks from the index, so that a block that
+     * is about to be overwritten is no longer used as a copy source.
+     */
+    CoRwlock source_lock;
+
+    /* Set once the child turned out not to support copy offloading */
+    bool copy_unsupported;
+
+    /* Protects the fields below */
+    QemuMutex lock;
+
+    GHashTable *by_digest;
+    GHashTable *by_block;
+    QLIST_HEAD(, DedupWrite) inflight;
+
+    uint64_t written_bytes;
+    uint64_t zero_bytes;
+    uint64_t unchanged_bytes;
+    uint64_t copy_offloaded_bytes;
+} BDRVDedupState;
+
+#define DEDUP_OPT_BLOCK_SIZE    "block-size"
+#define DEDUP_OPT_MAX_ENTRIES   "max-entries"
+
+static QemuOptsList runtime_opts = {
+    .name = "dedup",
+    .head = QTAILQ_HEAD_INITIALIZER(runtime_opts.head),
+    .desc = {
+        {
+            .name = DEDUP_OPT_BLOCK_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "granularity of deduplication, default 64K",
+        },
+        {
+            .name = DEDUP_OPT_MAX_ENTRIES,
+            .type = QEMU_OPT_NUMBER,
+            .help = "maximum number of blocks in the content index, "
+                "default 1048576",
+        },
+        { /* end of list */ }
+    },
+};
+
+static guint dedup_digest_hash(gconstpointer key)
+{
+    guint hash;
+
+    /* The digest is uniformly distributed already */
+    memcpy(&hash, key, sizeof(hash));
+    return hash;
+}
+
+static gboolean dedup_digest_equal(gconstpointer a, gconstpointer b)
+{
+    return !memcmp(a, b, DEDUP_DIGEST_LEN);
+}
+
+static int dedup_open(BlockDriverState *bs, QDict *options, int flags,
+                      Error **errp)
+{
+    BDRVDedupState *s = bs->opaque;
+    QemuOpts *opts;
+    int ret;
+
+    ret = bdrv_open_file_child(NULL, options, "file", bs, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
+    if (!qemu_opts_absorb_qdict(opts, options, errp)) {
+        qemu_opts_del(opts);
+        return -EINVAL;
+    }
+    s->block_size = qemu_opt_get_size(opts, DEDUP_OPT_BLOCK_SIZE, 64 * KiB);
+    s->max_entries = qemu_opt_get_number(opts, DEDUP_OPT_MAX_ENTRIES,
+                                         1024 * 1024);
+    qemu_opts_del(opts);
+
+    GRAPH_RDLOCK_GUARD_MAINLOOP();
+
+    if (!is_power_of_2(s->block_size) || s->block_size < BDRV_SECTOR_SIZE ||
+        s->block_size > DEDUP_MAX_BLOCK_SIZE) {
+        error_setg(errp, "block-size must be a power of two between 512 "
+                   "and 2M");
+        return -EINVAL;
+    }
+    if (!QEMU_IS_ALIGNED(s->block_size, bs->file->bs->bl.request_alignment)) {
+        error_setg(errp, "block-size must be a multiple of the request "
+                   "alignment of the underlying node (%" PRIu32 ")",
+                   bs->file->bs->bl.request_alignment);
+        return -EINVAL;
+    }
+
+    bs->supported_write_flags = BDRV_REQ_WRITE_UNCHANGED |
+        (BDRV_REQ_FUA & bs->file->bs->supported_write_flags);
+
+    bs->supported_zero_flags = BDRV_REQ_WRITE_UNCHANGED |
+        ((BDRV_REQ_FUA | BDRV_REQ_MAY_UNMAP | BDRV_REQ_NO_FALLBACK) &
+            bs->file->bs->supported_zero_flags);
+
+    qemu_co_rwlock_init(&s->source_lock);
+    qemu_mutex_init(&s->lock);
+    s->by_digest = g_hash_table_new_full(dedup_digest_hash, dedup_digest_equal,
+                                         NULL, g_free);
+    s->by_block = g_hash_table_new(g_int64_hash, g_int64_equal);
+    QLIST_INIT(&s->inflight);
+
+    return 0;
+}
+
+static void dedup_close(BlockDriverState *bs)
+{
+    BDRVDedupState *s = bs->opaque;
+
+    assert(QLIST_EMPTY(&s->inflight));
+    g_hash_table_destroy(s->by_block);
+    g_hash_table_destroy(s->by_digest);
+    qemu_mutex_destroy(&s->lock);
+}
+
+static void dedup_child_perm(BlockDriverState *bs, BdrvChild *c,
+                             BdrvChildRole role,
+                             BlockReopenQueue *reopen_queue,
+                             uint64_t perm, uint64_t shared,
+                             uint64_t *nperm, uint64_t *nshared)
+{
+    bdrv_default_perms(bs, c, role, reopen_queue, perm, shared, nperm, nshared);
+
+    /*
+     * The index describes the content of the child, so nobody else may change
+     * it while we can write to it.
+     */
+    if (perm & BLK_PERM_WRITE) {
+        *nshared &= ~(BLK_PERM_WRITE | BLK_PERM_RESIZE);
+    }
+}
+
+static void dedup_refresh_limits(BlockDriverState *bs, Error **errp)
+{
+    BDRVDedupState *s = bs->opaque;
+
+    bs->bl.request_alignment = s->block_size;
+}
+
+/* Called with s->lock held */
+static void dedup_index_remove(BDRVDedupState *s, DedupEntry *e)
+{
+    g_hash_table_remove(s->by_block, &e->block);
+    g_hash_table_remove(s->by_digest, e->digest);
+}
+
+/* Called with s->lock held */
+static void dedup_index_add(BDRVDedupState *s, const uint8_t *digest,
+                            uint64_t block)
+{
+    DedupEntry *e;
+
+    if (g_hash_table_size(s->by_digest) >= s->max_entries ||
+        g_hash_table_contains(s->by_digest, digest) ||
+        g_hash_table_contains(s->by_block, &block)) {
+        return;
+    }
+
+    e = g_new(DedupEntry, 1);
+    memcpy(e->digest, digest, DEDUP_DIGEST_LEN);
+    e->block = block;
+    g_hash_table_insert(s->by_digest, e->digest, e);
+    g_hash_table_insert(s->by_block, &e->block, e);
+}
+
+/*
+ * Registers @w as in flight and drops all blocks overlapping it from the
+ * index.  If @blocks is given, it describes the new content of each block of
+ * the request; blocks whose indexed content matches the new data are kept
+ * and marked DEDUP_BLOCK_UNCHANGED.
+ */
+static void coroutine_fn
+dedup_begin_write(BDRVDedupState *s, DedupWrite *w, int64_t offset,
+                  int64_t bytes, DedupBlock *blocks)
+{
+    uint64_t first = offset / s->block_size;
+    uint64_t end = DIV_ROUND_UP(offset + bytes, s->block_size);
+    bool invalidate = false;
+    DedupWrite *other;
+    uint64_t b;
+
+    *w = (DedupWrite) {
+        .offset = offset,
+        .bytes = bytes,
+    };
+
+    qemu_mutex_lock(&s->lock);
+    QLIST_FOREACH(other, &s->inflight, next) {
+        if (ranges_overlap(other->offset, other->bytes, offset, bytes)) {
+            other->superseded = true;
+            w->superseded = true;
+        }
+    }
+    QLIST_INSERT_HEAD(&s->inflight, w, next);
+
+    if (end - first > g_hash_table_size(s->by_block)) {
+        /* Cheaper to look at every entry than at every block */
+        invalidate = g_hash_table_size(s->by_block) > 0;
+    } else {
+        for (b = first; b < end; b++) {
+            DedupEntry *e = g_hash_table_lookup(s->by_block, &b);
+
+            if (!e) {
+                continue;
+            }
+            if (blocks && blocks[b - first].has_digest &&
+                !memcmp(e->digest, blocks[b - first].digest,
+                        DEDUP_DIGEST_LEN)) {
+                blocks[b - first].kind = DEDUP_BLOCK_UNCHANGED;
+            } else {
+                invalidate = true;
+            }
+        }
+    }
+    qemu_mutex_unlock(&s->lock);
+
+    if (!invalidate) {
+        return;
+    }
+
+    /* Wait for all copies that may be reading from the old content */
+    qemu_co_rwlock_wrlock(&s->source_lock);
+    qemu_mutex_lock(&s->lock);
+    if (end - first > g_hash_table_size(s->by_block)) {
+        GHashTableIter iter;
+        DedupEntry *e;
+
+        /* Unchanged blocks are only detected in the per-block path above */
+        g_hash_table_iter_init(&iter, s->by_block);
+        while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&e)) {
+            if (e->block >= first && e->block < end) {
+                g_hash_table_iter_remove(&iter);
+                g_hash_table_remove(s->by_digest, e->digest);
+            }
+        }
+    } else {
+        for (b = first; b < end; b++) {
+            DedupEntry *e;
+
+            if (blocks && blocks[b - first].kind == DEDUP_BLOCK_UNCHANGED) {
+                continue;
+            }
+            e = g_hash_table_lookup(s->by_block, &b);
+            if (e) {
+                dedup_index_remove(s, e);
+            }
+        }
+    }
+    qemu_mutex_unlock(&s->lock);
+    qemu_co_rwlock_unlock(&s->source_lock);
+}
+
+/*
+ * Removes @w from the in-flight list.  On success, the content of the data
+ * blocks in @blocks is added to the index unless @w was superseded.
+ */
+static void dedup_end_write(BDRVDedupState *s, DedupWrite *w,
+                            DedupBlock *blocks, int ret)
+{
+    uint64_t first = w->offset / s->block_size;
+    int64_t i;
+
+    qemu_mutex_lock(&s->lock);
+    QLIST_REMOVE(w, next);
+    if (blocks && ret >= 0 && !w->superseded) {
+        for (i = 0; i < w->bytes / s->block_size; i++) {
+            if (blocks[i].kind == DEDUP_BLOCK_DATA && blocks[i].has_digest) {
+                dedup_index_add(s, blocks[i].digest, first + i);
+            }
+        }
+    }
+    qemu_mutex_unlock(&s->lock);
+}
+
+/*
+ * Returns the offset of a block in the child node that holds the same content
+ * as @block, or -1 if there is none that could be copied from.
+ */
+static int64_t dedup_find_source(BDRVDedupState *s, DedupBlock *block)
+{
+    DedupEntry *e;
+    int64_t src = -1;
+
+    if (block->kind != DEDUP_BLOCK_DATA || !block->has_digest ||
+        qatomic_read(&s->copy_unsupported)) {
+        return -1;
+    }
+
+    qemu_mutex_lock(&s->lock);
+    e = g_hash_table_lookup(s->by_digest, block->digest);
+    if (e) {
+        src = e->block * s->block_size;
+    }
+    qemu_mutex_unlock(&s->lock);
+
+    return src;
+}
+
+/*
+ * Tries to store the content of the block at @offset by copying it from
+ * another block in the child node that holds the same data.  Returns true on
+ * success, false if the block must be written normally.
+ */
+static bool coroutine_fn GRAPH_RDLOCK
+dedup_try_share(BlockDriverState *bs, int64_t offset, DedupBlock *block)
+{
+    BDRVDedupState *s = bs->opaque;
+    int64_t src;
+    int ret;
+
+    qemu_co_rwlock_rdlock(&s->source_lock);
+
+    src = dedup_find_source(s, block);
+    if (src < 0) {
+        qemu_co_rwlock_unlock(&s->source_lock);
+        return false;
+    }
+
+    ret = bdrv_co_copy_range(bs->file, src, bs->file, offset, s->block_size,
+                             0, 0);
+    qemu_co_rwlock_unlock(&s->source_lock);
+
+    if (ret == -ENOTSUP) {
+        qatomic_set(&s->copy_unsupported, true);
+    }
+    return ret >= 0;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+dedup_co_pwritev_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                      QEMUIOVector *qiov, size_t qiov_offset,
+                      BdrvRequestFlags flags)
+{
+    BDRVDedupState *s = bs->opaque;
+    int64_t nb_blocks = bytes / s->block_size;
+    g_autofree DedupBlock *blocks = g_new(DedupBlock, nb_blocks);
+    uint64_t zero_bytes = 0, unchanged_bytes = 0, copy_offloaded_bytes = 0;
+    BdrvRequestFlags zero_flags;
+    bool need_flush = false;
+    DedupWrite w;
+    int64_t i, j;
+    int ret = 0;
+
+    assert(QEMU_IS_ALIGNED(offset | bytes, s->block_size));
+
+    for (i = 0; i < nb_blocks; i++) {
+        size_t block_offset = qiov_offset + i * s->block_size;
+        DedupBlock *block = &blocks[i];
+
+        block->has_digest = false;
+        if (qemu_iovec_is_zero(qiov, block_offset, s->block_size)) {
+            block->kind = DEDUP_BLOCK_ZERO;
+        } else {
+            QEMUIOVector slice;
+            uint8_t *digest = block->digest;
+            size_t digest_len = DEDUP_DIGEST_LEN;
+
+            qemu_iovec_init_slice(&slice, qiov, block_offset, s->block_size);
+            block->kind = DEDUP_BLOCK_DATA;
+            block->has_digest =
+                qcrypto_hash_bytesv(DEDUP_HASH_ALG, slice.iov, slice.niov,
+                                    &digest, &digest_len, NULL) == 0;
+            qemu_iovec_destroy(&slice);
+        }
+    }
+
+    dedup_begin_write(s, &w, offset, bytes, blocks);
+
+    zero_flags = flags & BDRV_REQ_FUA;
+    if (bs->open_flags & BDRV_O_UNMAP) {
+        zero_flags |= BDRV_REQ_MAY_UNMAP;
+    }
+
+    for (i = 0; i < nb_blocks && ret >= 0; i = j) {
+        int64_t run_offset = offset + i * s->block_size;
+        DedupBlockKind kind = blocks[i].kind;
+        int64_t run_bytes;
+
+        if (kind == DEDUP_BLOCK_DATA &&
+            dedup_try_share(bs, run_offset, &blocks[i])) {
+            copy_offloaded_bytes += s->block_size;
+            need_flush = true;
+            j = i + 1;
+            continue;
+        }
+
+        /*
+         * Merge all following blocks of the same kind into one request, but
+         * stop at data blocks that can be shared with an existing block.
+         */
+        for (j = i + 1; j < nb_blocks && blocks[j].kind == kind; j++) {
+            if (dedup_find_source(s, &blocks[j]) >= 0) {
+                break;
+            }
+        }
+        run_bytes = (j - i) * s->block_size;
+
+        switch (kind) {
+        case DEDUP_BLOCK_DATA:
+            ret = bdrv_co_pwritev_part(bs->file, run_offset, run_bytes, qiov,
+                                       qiov_offset + i * s->block_size, flags);
+            break;
+        case DEDUP_BLOCK_ZERO:
+            ret = bdrv_co_pwrite_zeroes(bs->file, run_offset, run_bytes,
+                                        zero_flags);
+            zero_bytes += run_bytes;
+            break;
+        case DEDUP_BLOCK_UNCHANGED:
+            unchanged_bytes += run_bytes;
+            need_flush = true;
+            break;
+        default:
+            g_assert_not_reached();
+        }
+    }
+
+    if (ret >= 0 && need_flush && (flags & BDRV_REQ_FUA)) {
+        ret = bdrv_co_flush(bs->file->bs);
+    }
+
+    dedup_end_write(s, &w, blocks, ret);
+
+    if (ret >= 0) {
+        qemu_mutex_lock(&s->lock);
+        s->written_bytes += bytes;
+        s->zero_bytes += zero_bytes;
+        s->unchanged_bytes += unchanged_bytes;
+        s->copy_offloaded_bytes += copy_offloaded_bytes;
+        qemu_mutex_unlock(&s->lock);
+    }
+
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+dedup_co_preadv_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                     QEMUIOVector *qiov, size_t qiov_offset,
+                     BdrvRequestFlags flags)
+{
+    return bdrv_co_preadv_part(bs->file, offset, bytes, qiov, qiov_offset,
+                               flags);
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+dedup_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                       BdrvRequestFlags flags)
+{
+    BDRVDedupState *s = bs->opaque;
+    DedupWrite w;
+    int ret;
+
+    dedup_begin_write(s, &w, offset, bytes, NULL);
+    ret = bdrv_co_pwrite_zeroes(bs->file, offset, bytes, flags);
+    dedup_end_write(s, &w, NULL, ret);
+
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+dedup_co_pdiscard(BlockDriverState *bs, int64_t offset, int64_t bytes)
+{
+    BDRVDedupState *s = bs->opaque;
+    DedupWrite w;
+    int ret;
+
+    dedup_begin_write(s, &w, offset, bytes, NULL);
+    ret = bdrv_co_pdiscard(bs->file, offset, bytes);
+    dedup_end_write(s, &w, NULL, ret);
+
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+dedup_co_truncate(BlockDriverState *bs, int64_t offset, bool exact,
+                  PreallocMode prealloc, BdrvRequestFlags flags, Error **errp)
+{
+    BDRVDedupState *s = bs->opaque;
+    int64_t old_len = bs->total_sectors * BDRV_SECTOR_SIZE;
+    DedupWrite w;
+    int ret;
+
+    if (offset >= old_len) {
+        return bdrv_co_truncate(bs->file, offset, exact, prealloc, flags,
+                                errp);
+    }
+
+    /* Blocks behind the new end are dropped */
+    dedup_begin_write(s, &w, offset, old_len - offset, NULL);
+    ret = bdrv_co_truncate(bs->file, offset, exact, prealloc, flags, errp);
+    dedup_end_write(s, &w, NULL, ret);
+
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK dedup_co_flush(BlockDriverState *bs)
+{
+    return bdrv_co_flush(bs->file->bs);
+}
+
+static int64_t coroutine_fn GRAPH_RDLOCK
+dedup_co_getlength(BlockDriverState *bs)
+{
+    return bdrv_co_getlength(bs->file->bs);
+}
+
+static BlockStatsSpecific *dedup_get_specific_stats(BlockDriverState *bs)
+{
+    BlockStatsSpecific *stats = g_new(BlockStatsSpecific, 1);
+    BDRVDedupState *s = bs->opaque;
+
+    stats->driver = BLOCKDEV_DRIVER_DEDUP;
+
+    qemu_mutex_lock(&s->lock);
+    stats->u.dedup = (BlockStatsSpecificDedup) {
+        .written_bytes = s->written_bytes,
+        .zero_bytes = s->zero_bytes,
+        .unchanged_bytes = s->unchanged_bytes,
+        .copy_offloaded_bytes = s->copy_offloaded_bytes,
+        .index_entries = g_hash_table_size(s->by_digest),
+    };
+    qemu_mutex_unlock(&s->lock);
+
+    return stats;
+}
+
+static const char *const dedup_strong_runtime_opts[] = {
+    DEDUP_OPT_BLOCK_SIZE,
+
+    NULL
+};
+
+static BlockDriver bdrv_dedup = {
+    .format_name                        = "dedup",
+    .instance_size                      = sizeof(BDRVDedupState),
+
+    .bdrv_open                          = dedup_open,
+    .bdrv_close                         = dedup_close,
+    .bdrv_child_perm                    = dedup_child_perm,
+    .bdrv_refresh_limits                = dedup_refresh_limits,
+
+    .bdrv_co_getlength                  = dedup_co_getlength,
+
+    .bdrv_co_preadv_part                = dedup_co_preadv_part,
+    .bdrv_co_pwritev_part               = dedup_co_pwritev_part,
+    .bdrv_co_pwrite_zeroes              = dedup_co_pwrite_zeroes,
+    .bdrv_co_pdiscard                   = dedup_co_pdiscard,
+    .bdrv_co_truncate                   = dedup_co_truncate,
+    .bdrv_co_flush                      = dedup_co_flush,
+
+    .bdrv_get_specific_stats            = dedup_get_specific_stats,
+
+    .strong_runtime_opts                = dedup_strong_runtime_opts,
+    .is_filter                          = true,
+};
+
+static void bdrv_dedup_init(void)
+{
+    bdrv_register(&bdrv_dedup);
+}
+
+block_init(bdrv_dedup_init);
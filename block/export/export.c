@@ -364,6 +364,9 @@ BlockExportInfoList *qmp_query_block_exports(Error **errp)
             .node_name      = g_strdup(bdrv_get_node_name(blk_bs(exp->blk))),
             .shutting_down  = !exp->user_owned,
         };
+        if (exp->drv->query) {
+            exp->drv->query(exp, info);
+        }
 
         QAPI_LIST_APPEND(tail, info);
     }
@@ -2452,8 +2452,8 @@ bdrv_co_do_block_status(BlockDriverState *bs, unsigned int mode,
          * long time, and we can do nothing in qemu to fix it.
          * This is especially problematic for images with large data areas,
          * because finding the few holes in them and giving them special
-         * treatment does not gain much performance.  Therefore, we try to
-         * cache the last-identified data region.
+         * treatment does not gain much performance.  Therefore, we cache
+         * the data regions identified so far.
          *
          * Second, limiting ourselves to protocol nodes allows us to assume
          * the block status for data regions to be DATA | OFFSET_VALID, and
@@ -2480,8 +2480,8 @@ bdrv_co_do_block_status(BlockDriverState *bs, unsigned int mode,
              * the cache is queried above.  Technically, we do not need to check
              * it here; the worst that can happen is that we fill the cache for
              * non-protocol nodes, and then it is never used.  However, filling
-             * the cache requires an RCU update, so double check here to avoid
-             * such an update if possible.
+             * the cache takes its lock, so double check here to avoid that if
+             * possible.
              *
              * Check mode, because we only want to update the cache when we
              * have accurate information about what is zero and what is data.
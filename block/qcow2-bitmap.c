@@ -47,6 +47,9 @@
 /* Size of bitmap table entries */
 #define BME_TABLE_ENTRY_SIZE (sizeof(uint64_t))
 
+/* Maximum size of a single read of contiguous bitmap data clusters */
+#define BME_MAX_LOAD_SIZE (1 * MiB)
+
 QEMU_BUILD_BUG_ON(BME_MAX_NAME_SIZE != BDRV_BITMAP_MAX_NAME_SIZE);
 
 #if BME_MAX_TABLE_SIZE * 8ULL > INT_MAX
@@ -294,7 +297,7 @@ load_bitmap_data(BlockDriverState *bs, const uint64_t *bitmap_table,
     uint64_t offset, limit;
     uint64_t bm_size = bdrv_dirty_bitmap_size(bitmap);
     uint8_t *buf = NULL;
-    uint64_t i, tab_size =
+    uint64_t i, j, n, max_clusters, tab_size =
             size_to_clusters(s,
                 bdrv_dirty_bitmap_serialization_size(bitmap, 0, bm_size));
 
@@ -302,29 +305,51 @@ load_bitmap_data(BlockDriverState *bs, const uint64_t *bitmap_table,
         return -EINVAL;
     }
 
-    buf = g_malloc(s->cluster_size);
+    max_clusters = MAX(BME_MAX_LOAD_SIZE / s->cluster_size, 1);
+    buf = g_malloc(max_clusters * s->cluster_size);
     limit = bdrv_dirty_bitmap_serialization_coverage(s->cluster_size, bitmap);
-    for (i = 0, offset = 0; i < tab_size; ++i, offset += limit) {
-        uint64_t count = MIN(bm_size - offset, limit);
+    for (i = 0; i < tab_size; i += n) {
         uint64_t entry = bitmap_table[i];
         uint64_t data_offset = entry & BME_TABLE_ENTRY_OFFSET_MASK;
 
         assert(check_table_entry(entry, s->cluster_size) == 0);
 
+        offset = i * limit;
+        n = 1;
         if (data_offset == 0) {
             if (entry & BME_TABLE_ENTRY_FLAG_ALL_ONES) {
-                bdrv_dirty_bitmap_deserialize_ones(bitmap, offset, count,
+                bdrv_dirty_bitmap_deserialize_ones(bitmap, offset,
+                                                   MIN(bm_size - offset, limit),
                                                    false);
             } else {
                 /* No need to deserialize zeros because the dirty bitmap is
                  * already cleared */
             }
-        } else {
-            ret = bdrv_co_pread(bs->file, data_offset, s->cluster_size, buf, 0);
-            if (ret < 0) {
-                goto finish;
-            }
-            bdrv_dirty_bitmap_deserialize_part(bitmap, buf, offset, count,
+            continue;
+        }
+
+        /*
+         * Data clusters are usually allocated one after the other, so read
+         * runs of them at once instead of issuing a request per cluster.
+         */
+        while (n < max_clusters && i + n < tab_size &&
+               (bitmap_table[i + n] & BME_TABLE_ENTRY_OFFSET_MASK) ==
+               data_offset + n * s->cluster_size)
+        {
+            assert(check_table_entry(bitmap_table[i + n],
+                                     s->cluster_size) == 0);
+            n++;
+        }
+
+        ret = bdrv_co_pread(bs->file, data_offset, n * s->cluster_size, buf, 0);
+        if (ret < 0) {
+            goto finish;
+        }
+        for (j = 0; j < n; j++, offset += limit) {
+            uint8_t *data = buf + j * s->cluster_size;
+
+            bdrv_dirty_bitmap_deserialize_part(bitmap, data, offset,
+                                               MIN(bm_size - offset, limit),
                                                false);
         }
     }
@@ -1324,6 +1349,14 @@ store_bitmap_data(BlockDriverState *bs, BdrvDirtyBitmap *bitmap,
          */
         offset = QEMU_ALIGN_DOWN(offset, limit);
         end = MIN(bm_size, offset + limit);
+
+        /* Fully dirty clusters need no data, load_bitmap_data() sets them */
+        if (bdrv_dirty_bitmap_next_zero(bitmap, offset, end - offset) < 0) {
+            tb[cluster] = BME_TABLE_ENTRY_FLAG_ALL_ONES;
+            offset = end;
+            continue;
+        }
+
         write_size = bdrv_dirty_bitmap_serialization_size(bitmap, offset,
                                                           end - offset);
         assert(write_size <= s->cluster_size);
@@ -964,12 +964,72 @@ int qcow2_update_cluster_refcount(BlockDriverState *bs,
 
 
 
+/*
+ * Counts the clusters with a refcount of 0 starting at @cluster_index, up to
+ * @max clusters, without crossing the boundary of the refcount block covering
+ * @cluster_index. The refcount block is only looked up once, so that scanning
+ * for free space does not need a cache lookup per cluster.
+ *
+ * *nb_free is set to the number of free clusters found. Returns 1 if the scan
+ * stopped because the cluster at @cluster_index + *nb_free is in use, 0 if
+ * all scanned clusters are free, and -errno on error.
+ */
+static int GRAPH_RDLOCK
+count_free_clusters(BlockDriverState *bs, uint64_t cluster_index,
+                    uint64_t max, uint64_t *nb_free)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t refcount_table_index, block_index, i, n;
+    int64_t refcount_block_offset;
+    void *refcount_block;
+    int ret;
+
+    refcount_table_index = cluster_index >> s->refcount_block_bits;
+    block_index = cluster_index & (s->refcount_block_size - 1);
+    n = MIN(max, s->refcount_block_size - block_index);
+
+    if (refcount_table_index >= s->refcount_table_size) {
+        *nb_free = n;
+        return 0;
+    }
+    refcount_block_offset =
+        s->refcount_table[refcount_table_index] & REFT_OFFSET_MASK;
+    if (!refcount_block_offset) {
+        *nb_free = n;
+        return 0;
+    }
+
+    if (offset_into_cluster(s, refcount_block_offset)) {
+        qcow2_signal_corruption(bs, true, -1, -1, "Refblock offset %#" PRIx64
+                                " unaligned (reftable index: %#" PRIx64 ")",
+                                refcount_block_offset, refcount_table_index);
+        return -EIO;
+    }
+
+    ret = qcow2_cache_get(bs, s->refcount_block_cache, refcount_block_offset,
+                          &refcount_block);
+    if (ret < 0) {
+        return ret;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (s->get_refcount(refcount_block, block_index + i) != 0) {
+            break;
+        }
+    }
+
+    qcow2_cache_put(s->refcount_block_cache, &refcount_block);
+
+    *nb_free = i;
+    return i < n;
+}
+
 /* return < 0 if error */
 static int64_t GRAPH_RDLOCK
 alloc_clusters_noref(BlockDriverState *bs, uint64_t size, uint64_t max)
 {
     BDRVQcow2State *s = bs->opaque;
-    uint64_t i, nb_clusters, refcount;
+    uint64_t i, nb_clusters, nb_free;
     int ret;
 
     /* We can't allocate clusters if they may still be queued for discard. */
@@ -979,13 +1039,17 @@ alloc_clusters_noref(BlockDriverState *bs, uint64_t size, uint64_t max)
 
     nb_clusters = size_to_clusters(s, size);
 retry:
-    for(i = 0; i < nb_clusters; i++) {
-        uint64_t next_cluster_index = s->free_cluster_index++;
-        ret = qcow2_get_refcount(bs, next_cluster_index, &refcount);
-
+    for (i = 0; i < nb_clusters; i += nb_free) {
+        ret = count_free_clusters(bs, s->free_cluster_index, nb_clusters - i,
+                                  &nb_free);
         if (ret < 0) {
             return ret;
-        } else if (refcount != 0) {
+        }
+
+        s->free_cluster_index += nb_free;
+        if (ret > 0) {
+            /* Skip the cluster in use and start over behind it */
+            s->free_cluster_index++;
             goto retry;
         }
     }
@@ -1888,6 +1888,7 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
 #endif
 
     qemu_co_queue_init(&s->thread_task_queue);
+    s->max_threads = MAX(QCOW2_MAX_THREADS, g_get_num_processors());
 
     return ret;
 
@@ -410,6 +410,8 @@ typedef struct BDRVQcow2State {
 
     CoQueue thread_task_queue;
     int nb_threads;
+    /* Limit for nb_threads, at least QCOW2_MAX_THREADS or one per host CPU */
+    int max_threads;
 
     BdrvChild *data_file;
 
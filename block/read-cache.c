@@ -0,0 +1,824 @@
+/*
+ * Read cache filter block driver
+ *
+ * The filter keeps data read from its file child in a second, usually local
+ * and sparse, image (the cache child), so that repeated reads of the same
+ * data do not have to go to slow or remote storage again.  Writes go to both
+ * children.
+ *
+ * Which clusters of the cache hold valid data is tracked in a dirty bitmap on
+ * the cache node.  With the persistent option, and if the cache node supports
+ * persistent bitmaps, it survives restarts.  Nothing checks that the cached
+ * image was not changed in between, so this is opt-in.  With a size limit,
+ * clusters are evicted with the CLOCK algorithm, an approximation of LRU
+ * that only needs one reference bit per cluster.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "block/block-io.h"
+#include "block/block_int.h"
+#include "block/dirty-bitmap.h"
+#include "qapi/error.h"
+#include "qapi/qapi-types-block-core.h"
+#include "qemu/cutils.h"
+#include "qemu/hbitmap.h"
+#include "qemu/iov.h"
+#include "qemu/memalign.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/range.h"
+#include "qemu/units.h"
+#include "qobject/qdict.h"
+
+/* Maximum number of bytes fetched from the file child in one go */
+#define READ_CACHE_MAX_FILL (1 * MiB)
+
+/* A request that changes the content of the cache child */
+typedef struct ReadCacheReq {
+    int64_t offset;
+    int64_t bytes;
+
+    /*
+     * Set if an overlapping request was started while this one was in
+     * flight.  The cache content of the range is undefined then.
+     */
+    bool superseded;
+
+    QLIST_ENTRY(ReadCacheReq) next;
+} ReadCacheReq;
+
+typedef struct BDRVReadCacheState {
+    BdrvChild *cache;
+    int64_t cluster_size;
+    int64_t max_bytes;
+    char *bitmap_name;
+    bool persistent;
+
+    /*
+     * Taken for reading around all I/O on the cache child and for writing
+     * while evicting clusters, so that evicted clusters are not in use.
+     */
+    CoRwlock cache_lock;
+
+    /* Protects the fields below */
+    QemuMutex lock;
+
+    /*
+     * Clusters of the cache child that hold the same data as the file child.
+     * NULL while the node is inactive.
+     */
+    BdrvDirtyBitmap *valid;
+
+    /* Reference bits for eviction, set when a cluster is read from cache */
+    HBitmap *referenced;
+    int64_t clock_hand;
+    bool evicting;
+
+    QLIST_HEAD(, ReadCacheReq) inflight;
+
+    uint64_t hit_bytes;
+    uint64_t miss_bytes;
+    uint64_t evicted_bytes;
+} BDRVReadCacheState;
+
+#define READ_CACHE_OPT_CLUSTER_SIZE "cluster-size"
+#define READ_CACHE_OPT_CACHE_SIZE   "cache-size"
+#define READ_CACHE_OPT_BITMAP       "bitmap"
+#define READ_CACHE_OPT_PERSISTENT   "persistent"
+
+static QemuOptsList runtime_opts = {
+    .name = "read-cache",
+    .head = QTAILQ_HEAD_INITIALIZER(runtime_opts.head),
+    .desc = {
+        {
+            .name = READ_CACHE_OPT_CLUSTER_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "granularity of caching, default 64K",
+        },
+        {
+            .name = READ_CACHE_OPT_CACHE_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "maximum amount of cached data, default 0 (no limit)",
+        },
+        {
+            .name = READ_CACHE_OPT_BITMAP,
+            .type = QEMU_OPT_STRING,
+            .help = "name of the persistent bitmap in the cache node, "
+                "default \"read-cache\"",
+        },
+        {
+            .name = READ_CACHE_OPT_PERSISTENT,
+            .type = QEMU_OPT_BOOL,
+            .help = "keep the cache across restarts, default off",
+        },
+        { /* end of list */ }
+    },
+};
+
+/*
+ * Looks up the bitmap of valid clusters on the cache node, or creates it if
+ * it does not exist yet or is unusable (e.g. after a crash).  Without the
+ * persistent option, a stored bitmap is never trusted.
+ */
+static int coroutine_mixed_fn GRAPH_RDLOCK
+read_cache_setup_bitmap(BlockDriverState *bs, Error **errp)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    BlockDriverState *cache_bs = s->cache->bs;
+    BdrvDirtyBitmap *bitmap;
+    int ret;
+
+    bitmap = bdrv_find_dirty_bitmap(cache_bs, s->bitmap_name);
+    if (bitmap && (!s->persistent || bdrv_dirty_bitmap_inconsistent(bitmap) ||
+                   bdrv_dirty_bitmap_granularity(bitmap) != s->cluster_size)) {
+        /* Start over with an empty cache */
+        if (bdrv_dirty_bitmap_get_persistence(bitmap)) {
+            if (qemu_in_coroutine()) {
+                ret = bdrv_co_remove_persistent_dirty_bitmap(cache_bs,
+                                                             s->bitmap_name,
+                                                             errp);
+            } else {
+                ret = bdrv_remove_persistent_dirty_bitmap(cache_bs,
+                                                          s->bitmap_name,
+                                                          errp);
+            }
+            if (ret < 0) {
+                return ret;
+            }
+        } else {
+            bdrv_release_dirty_bitmap(bitmap);
+        }
+        bitmap = NULL;
+    }
+
+    if (bitmap) {
+        if (bdrv_dirty_bitmap_check(bitmap, BDRV_BITMAP_DEFAULT, errp)) {
+            return -EINVAL;
+        }
+    } else {
+        bool persistent = s->persistent &&
+                          bdrv_supports_persistent_dirty_bitmap(cache_bs);
+
+        if (persistent && qemu_in_coroutine()) {
+            persistent = bdrv_co_can_store_new_dirty_bitmap(cache_bs,
+                                                            s->bitmap_name,
+                                                            s->cluster_size,
+                                                            NULL);
+        } else if (persistent) {
+            persistent = bdrv_can_store_new_dirty_bitmap(cache_bs,
+                                                         s->bitmap_name,
+                                                         s->cluster_size,
+                                                         NULL);
+        }
+
+        bitmap = bdrv_create_dirty_bitmap(cache_bs, s->cluster_size,
+                                          persistent ? s->bitmap_name : NULL,
+                                          errp);
+        if (!bitmap) {
+            return -EINVAL;
+        }
+        bdrv_dirty_bitmap_set_persistence(bitmap, persistent);
+    }
+
+    /* The bitmap is maintained by us, not by writes to the cache node */
+    bdrv_disable_dirty_bitmap(bitmap);
+    bdrv_dirty_bitmap_set_busy(bitmap, true);
+
+    qemu_mutex_lock(&s->lock);
+    s->valid = bitmap;
+    s->referenced = hbitmap_alloc(bdrv_dirty_bitmap_size(bitmap),
+                                  ctz64(s->cluster_size));
+    s->clock_hand = 0;
+    qemu_mutex_unlock(&s->lock);
+
+    return 0;
+}
+
+/* Gives up the bitmap, leaving it to the cache node to store it if needed */
+static void read_cache_release_bitmap(BlockDriverState *bs)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    BdrvDirtyBitmap *bitmap;
+
+    qemu_mutex_lock(&s->lock);
+    bitmap = s->valid;
+    s->valid = NULL;
+    g_clear_pointer(&s->referenced, hbitmap_free);
+    qemu_mutex_unlock(&s->lock);
+
+    if (!bitmap) {
+        return;
+    }
+
+    bdrv_dirty_bitmap_set_busy(bitmap, false);
+    if (!bdrv_dirty_bitmap_get_persistence(bitmap)) {
+        bdrv_release_dirty_bitmap(bitmap);
+    }
+}
+
+static int read_cache_open(BlockDriverState *bs, QDict *options, int flags,
+                           Error **errp)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    int64_t file_len, cache_len;
+    QemuOpts *opts;
+    int ret;
+
+    ret = bdrv_open_file_child(NULL, options, "file", bs, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    /*
+     * The cache must be writable even if the cached image is read-only.
+     * Existing nodes referenced by name are used as they are.
+     */
+    if (!qdict_haskey(options, "cache")) {
+        qdict_set_default_str(options, "cache." BDRV_OPT_READ_ONLY, "off");
+    }
+    s->cache = bdrv_open_child(NULL, options, "cache", bs, &child_of_bds,
+                               BDRV_CHILD_DATA, false, errp);
+    if (!s->cache) {
+        return -EINVAL;
+    }
+
+    opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
+    if (!qemu_opts_absorb_qdict(opts, options, errp)) {
+        qemu_opts_del(opts);
+        return -EINVAL;
+    }
+    s->cluster_size = qemu_opt_get_size(opts, READ_CACHE_OPT_CLUSTER_SIZE,
+                                        64 * KiB);
+    s->max_bytes = qemu_opt_get_size(opts, READ_CACHE_OPT_CACHE_SIZE, 0);
+    s->bitmap_name = g_strdup(qemu_opt_get(opts, READ_CACHE_OPT_BITMAP) ?:
+                              "read-cache");
+    s->persistent = qemu_opt_get_bool(opts, READ_CACHE_OPT_PERSISTENT, false);
+    qemu_opts_del(opts);
+
+    qemu_co_rwlock_init(&s->cache_lock);
+    qemu_mutex_init(&s->lock);
+    QLIST_INIT(&s->inflight);
+
+    GRAPH_RDLOCK_GUARD_MAINLOOP();
+
+    if (!is_power_of_2(s->cluster_size) ||
+        s->cluster_size < BDRV_SECTOR_SIZE ||
+        s->cluster_size > READ_CACHE_MAX_FILL) {
+        error_setg(errp, "cluster-size must be a power of two between 512 "
+                   "and 1M");
+        return -EINVAL;
+    }
+    if (s->max_bytes && s->max_bytes < s->cluster_size) {
+        error_setg(errp, "cache-size must be at least the cluster size");
+        return -EINVAL;
+    }
+
+    file_len = bdrv_getlength(bs->file->bs);
+    cache_len = bdrv_getlength(s->cache->bs);
+    if (file_len < 0 || cache_len < 0) {
+        error_setg_errno(errp, -(file_len < 0 ? file_len : cache_len),
+                         "Failed to get image length");
+        return file_len < 0 ? file_len : cache_len;
+    }
+    if (cache_len < file_len) {
+        error_setg(errp, "The cache node is smaller than the cached image");
+        return -EINVAL;
+    }
+
+    bs->supported_write_flags = BDRV_REQ_WRITE_UNCHANGED |
+        (BDRV_REQ_FUA & bs->file->bs->supported_write_flags);
+
+    bs->supported_zero_flags = BDRV_REQ_WRITE_UNCHANGED |
+        ((BDRV_REQ_FUA | BDRV_REQ_MAY_UNMAP | BDRV_REQ_NO_FALLBACK) &
+            bs->file->bs->supported_zero_flags);
+
+    if (!(flags & BDRV_O_INACTIVE)) {
+        ret = read_cache_setup_bitmap(bs, errp);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+static void read_cache_close(BlockDriverState *bs)
+{
+    BDRVReadCacheState *s = bs->opaque;
+
+    assert(QLIST_EMPTY(&s->inflight));
+    read_cache_release_bitmap(bs);
+    qemu_mutex_destroy(&s->lock);
+    g_free(s->bitmap_name);
+}
+
+static int GRAPH_RDLOCK read_cache_inactivate(BlockDriverState *bs)
+{
+    /* The cache node will store and release the bitmap */
+    read_cache_release_bitmap(bs);
+    return 0;
+}
+
+static void coroutine_fn GRAPH_RDLOCK
+read_cache_co_invalidate_cache(BlockDriverState *bs, Error **errp)
+{
+    read_cache_setup_bitmap(bs, errp);
+}
+
+static void read_cache_child_perm(BlockDriverState *bs, BdrvChild *c,
+                                  BdrvChildRole role,
+                                  BlockReopenQueue *reopen_queue,
+                                  uint64_t perm, uint64_t shared,
+                                  uint64_t *nperm, uint64_t *nshared)
+{
+    if (role & BDRV_CHILD_FILTERED) {
+        bdrv_default_perms(bs, c, role, reopen_queue, perm, shared,
+                           nperm, nshared);
+        return;
+    }
+
+    /* Cache child, exclusively ours */
+    *nperm = BLK_PERM_CONSISTENT_READ;
+    if (!(bs->open_flags & BDRV_O_INACTIVE)) {
+        *nperm |= BLK_PERM_WRITE;
+    }
+    *nshared = BLK_PERM_ALL & ~(BLK_PERM_WRITE | BLK_PERM_RESIZE);
+}
+
+/* Registers @req as in flight.  Called with s->lock held. */
+static void read_cache_begin_req(BDRVReadCacheState *s, ReadCacheReq *req,
+                                 int64_t offset, int64_t bytes)
+{
+    ReadCacheReq *other;
+
+    *req = (ReadCacheReq) {
+        .offset = offset,
+        .bytes = bytes,
+    };
+
+    QLIST_FOREACH(other, &s->inflight, next) {
+        if (ranges_overlap(other->offset, other->bytes, offset, bytes)) {
+            other->superseded = true;
+            req->superseded = true;
+        }
+    }
+    QLIST_INSERT_HEAD(&s->inflight, req, next);
+}
+
+/*
+ * Marks the clusters in [offset, offset + bytes) as invalid.  The range is
+ * extended to cluster boundaries.  Called with s->lock held.
+ */
+static void read_cache_invalidate(BDRVReadCacheState *s, int64_t offset,
+                                  int64_t bytes)
+{
+    int64_t size, start, end;
+
+    if (!s->valid) {
+        return;
+    }
+
+    size = bdrv_dirty_bitmap_size(s->valid);
+    start = QEMU_ALIGN_DOWN(offset, s->cluster_size);
+    end = MIN(offset + bytes, size);
+    end = MIN(QEMU_ALIGN_UP(end, s->cluster_size), size);
+    if (start < end) {
+        bdrv_reset_dirty_bitmap(s->valid, start, end - start);
+    }
+}
+
+/*
+ * Marks the clusters fully covered by [offset, offset + bytes) as valid.  A
+ * partial cluster at the end of the bitmap counts as covered.  Called with
+ * s->lock held.
+ */
+static void read_cache_validate(BDRVReadCacheState *s, int64_t offset,
+                                int64_t bytes)
+{
+    int64_t size, start, end;
+
+    if (!s->valid) {
+        return;
+    }
+
+    size = bdrv_dirty_bitmap_size(s->valid);
+    start = QEMU_ALIGN_UP(offset, s->cluster_size);
+    end = MIN(offset + bytes, size);
+    if (end < size) {
+        end = QEMU_ALIGN_DOWN(end, s->cluster_size);
+    }
+    if (start < end) {
+        bdrv_set_dirty_bitmap(s->valid, start, end - start);
+    }
+}
+
+/*
+ * Evicts clusters until the cache is below its size limit again, leaving
+ * some headroom so that eviction does not run for every cache fill.
+ */
+static void coroutine_fn GRAPH_RDLOCK read_cache_evict(BlockDriverState *bs)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    int64_t target = s->max_bytes - s->max_bytes / 16;
+
+    if (!s->max_bytes) {
+        return;
+    }
+
+    qemu_mutex_lock(&s->lock);
+    if (s->evicting || !s->valid || bdrv_get_dirty_count(s->valid) <=
+                                    s->max_bytes) {
+        qemu_mutex_unlock(&s->lock);
+        return;
+    }
+    s->evicting = true;
+    qemu_mutex_unlock(&s->lock);
+
+    qemu_co_rwlock_wrlock(&s->cache_lock);
+    qemu_mutex_lock(&s->lock);
+    while (s->valid && bdrv_get_dirty_count(s->valid) > target) {
+        int64_t offset = bdrv_dirty_bitmap_next_dirty(s->valid, s->clock_hand,
+                                                      INT64_MAX);
+        int64_t bytes;
+
+        if (offset < 0) {
+            s->clock_hand = 0;
+            continue;
+        }
+
+        bytes = MIN(s->cluster_size,
+                    bdrv_dirty_bitmap_size(s->valid) - offset);
+        s->clock_hand = offset + bytes;
+
+        if (hbitmap_get(s->referenced, offset)) {
+            /* Second chance */
+            hbitmap_reset(s->referenced, offset, bytes);
+            continue;
+        }
+
+        bdrv_reset_dirty_bitmap(s->valid, offset, bytes);
+        s->evicted_bytes += bytes;
+
+        qemu_mutex_unlock(&s->lock);
+        bdrv_co_pdiscard(s->cache, offset, bytes);
+        qemu_mutex_lock(&s->lock);
+    }
+    s->evicting = false;
+    qemu_mutex_unlock(&s->lock);
+    qemu_co_rwlock_unlock(&s->cache_lock);
+}
+
+/*
+ * Reads [offset, offset + bytes) from the cache child.  Returns 0 on success,
+ * -EAGAIN if the range is not valid in the cache (any more), and -errno if
+ * reading from the cache failed.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+read_cache_read_cached(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                       QEMUIOVector *qiov, size_t qiov_offset)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    int ret;
+
+    qemu_co_rwlock_rdlock(&s->cache_lock);
+
+    /* Eviction may have happened before we took the lock */
+    qemu_mutex_lock(&s->lock);
+    if (!s->valid ||
+        bdrv_dirty_bitmap_next_zero(s->valid, offset, bytes) >= 0) {
+        qemu_mutex_unlock(&s->lock);
+        qemu_co_rwlock_unlock(&s->cache_lock);
+        return -EAGAIN;
+    }
+    hbitmap_set(s->referenced, offset, bytes);
+    qemu_mutex_unlock(&s->lock);
+
+    ret = bdrv_co_preadv_part(s->cache, offset, bytes, qiov, qiov_offset, 0);
+
+    qemu_mutex_lock(&s->lock);
+    if (ret < 0) {
+        read_cache_invalidate(s, offset, bytes);
+    } else {
+        s->hit_bytes += bytes;
+    }
+    qemu_mutex_unlock(&s->lock);
+
+    qemu_co_rwlock_unlock(&s->cache_lock);
+    return ret;
+}
+
+/*
+ * Reads [offset, offset + bytes) from the file child and stores the clusters
+ * covering it in the cache.  Failing to update the cache is not an error.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+read_cache_fill(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                QEMUIOVector *qiov, size_t qiov_offset, BdrvRequestFlags flags)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    int64_t start, end, cache_end;
+    ReadCacheReq req;
+    uint8_t *buf;
+    int ret;
+
+    qemu_mutex_lock(&s->lock);
+    if (!s->valid) {
+        qemu_mutex_unlock(&s->lock);
+        return bdrv_co_preadv_part(bs->file, offset, bytes, qiov, qiov_offset,
+                                   flags);
+    }
+    cache_end = bdrv_dirty_bitmap_size(s->valid);
+    start = QEMU_ALIGN_DOWN(offset, s->cluster_size);
+    end = MIN(QEMU_ALIGN_UP(offset + bytes, s->cluster_size),
+              MAX(offset + bytes, bs->total_sectors * BDRV_SECTOR_SIZE));
+    read_cache_begin_req(s, &req, start, end - start);
+    qemu_mutex_unlock(&s->lock);
+
+    buf = qemu_try_blockalign(bs->file->bs, end - start);
+    if (!buf) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    ret = bdrv_co_pread(bs->file, start, end - start, buf, flags);
+    if (ret < 0) {
+        goto out;
+    }
+    qemu_iovec_from_buf(qiov, qiov_offset, buf + (offset - start), bytes);
+
+    if (end <= cache_end) {
+        int cache_ret;
+
+        qemu_co_rwlock_rdlock(&s->cache_lock);
+        cache_ret = bdrv_co_pwrite(s->cache, start, end - start, buf, 0);
+
+        qemu_mutex_lock(&s->lock);
+        if (cache_ret >= 0 && !req.superseded) {
+            read_cache_validate(s, start, end - start);
+        }
+        qemu_mutex_unlock(&s->lock);
+        qemu_co_rwlock_unlock(&s->cache_lock);
+    }
+
+out:
+    qemu_vfree(buf);
+
+    qemu_mutex_lock(&s->lock);
+    QLIST_REMOVE(&req, next);
+    if (ret >= 0) {
+        s->miss_bytes += bytes;
+    }
+    qemu_mutex_unlock(&s->lock);
+
+    if (ret >= 0) {
+        read_cache_evict(bs);
+    }
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+read_cache_co_preadv_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                          QEMUIOVector *qiov, size_t qiov_offset,
+                          BdrvRequestFlags flags)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    int ret;
+
+    while (bytes > 0) {
+        int64_t n;
+        bool cached;
+
+        qemu_mutex_lock(&s->lock);
+        if (s->valid && offset < bdrv_dirty_bitmap_size(s->valid)) {
+            cached = bdrv_dirty_bitmap_status(
+                s->valid, offset,
+                MIN(bytes, bdrv_dirty_bitmap_size(s->valid) - offset), &n);
+        } else {
+            cached = false;
+            n = bytes;
+        }
+        qemu_mutex_unlock(&s->lock);
+
+        if (cached) {
+            ret = read_cache_read_cached(bs, offset, n, qiov, qiov_offset);
+            if (ret < 0) {
+                /* Changed in the meantime or broken, try again */
+                continue;
+            }
+        } else {
+            n = MIN(n, READ_CACHE_MAX_FILL);
+            ret = read_cache_fill(bs, offset, n, qiov, qiov_offset, flags);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+
+        offset += n;
+        bytes -= n;
+        qiov_offset += n;
+    }
+
+    return 0;
+}
+
+/*
+ * Writes data or zeroes to the file child, and then to the cache child to
+ * keep valid clusters up to date.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+read_cache_do_write(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                    QEMUIOVector *qiov, size_t qiov_offset,
+                    BdrvRequestFlags flags)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    ReadCacheReq req;
+    int64_t cache_bytes;
+    int ret, cache_ret;
+
+    qemu_mutex_lock(&s->lock);
+    read_cache_begin_req(s, &req, offset, bytes);
+    cache_bytes = s->valid ? bdrv_dirty_bitmap_size(s->valid) - offset : 0;
+    qemu_mutex_unlock(&s->lock);
+
+    if (qiov) {
+        ret = bdrv_co_pwritev_part(bs->file, offset, bytes, qiov, qiov_offset,
+                                   flags);
+    } else {
+        ret = bdrv_co_pwrite_zeroes(bs->file, offset, bytes, flags);
+    }
+
+    cache_bytes = MIN(cache_bytes, bytes);
+    cache_ret = -EIO;
+    if (ret >= 0 && cache_bytes > 0) {
+        qemu_co_rwlock_rdlock(&s->cache_lock);
+        if (qiov) {
+            cache_ret = bdrv_co_pwritev_part(s->cache, offset, cache_bytes,
+                                             qiov, qiov_offset, 0);
+        } else {
+            cache_ret = bdrv_co_pwrite_zeroes(s->cache, offset, cache_bytes,
+                                              flags & BDRV_REQ_MAY_UNMAP);
+        }
+        qemu_co_rwlock_unlock(&s->cache_lock);
+    }
+
+    qemu_mutex_lock(&s->lock);
+    QLIST_REMOVE(&req, next);
+    if (cache_ret < 0 || req.superseded) {
+        read_cache_invalidate(s, offset, bytes);
+    } else {
+        read_cache_validate(s, offset, cache_bytes);
+    }
+    qemu_mutex_unlock(&s->lock);
+
+    if (cache_ret >= 0) {
+        read_cache_evict(bs);
+    }
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+read_cache_co_pwritev_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                           QEMUIOVector *qiov, size_t qiov_offset,
+                           BdrvRequestFlags flags)
+{
+    return read_cache_do_write(bs, offset, bytes, qiov, qiov_offset, flags);
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+read_cache_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset,
+                            int64_t bytes, BdrvRequestFlags flags)
+{
+    return read_cache_do_write(bs, offset, bytes, NULL, 0, flags);
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+read_cache_co_pdiscard(BlockDriverState *bs, int64_t offset, int64_t bytes)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    ReadCacheReq req;
+    int ret;
+
+    /* Discarded data is undefined, so just drop it from the cache */
+    qemu_mutex_lock(&s->lock);
+    read_cache_begin_req(s, &req, offset, bytes);
+    read_cache_invalidate(s, offset, bytes);
+    qemu_mutex_unlock(&s->lock);
+
+    ret = bdrv_co_pdiscard(bs->file, offset, bytes);
+
+    qemu_mutex_lock(&s->lock);
+    QLIST_REMOVE(&req, next);
+    qemu_mutex_unlock(&s->lock);
+
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+read_cache_co_truncate(BlockDriverState *bs, int64_t offset, bool exact,
+                       PreallocMode prealloc, BdrvRequestFlags flags,
+                       Error **errp)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    int64_t old_len = bs->total_sectors * BDRV_SECTOR_SIZE;
+    ReadCacheReq req;
+    int ret;
+
+    if (offset >= old_len) {
+        return bdrv_co_truncate(bs->file, offset, exact, prealloc, flags,
+                                errp);
+    }
+
+    /* Data behind the new end is dropped */
+    qemu_mutex_lock(&s->lock);
+    read_cache_begin_req(s, &req, offset, old_len - offset);
+    read_cache_invalidate(s, offset, old_len - offset);
+    qemu_mutex_unlock(&s->lock);
+
+    ret = bdrv_co_truncate(bs->file, offset, exact, prealloc, flags, errp);
+
+    qemu_mutex_lock(&s->lock);
+    QLIST_REMOVE(&req, next);
+    qemu_mutex_unlock(&s->lock);
+
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK read_cache_co_flush(BlockDriverState *bs)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    int ret;
+
+    ret = bdrv_co_flush(bs->file->bs);
+    /* The cache can always be refetched, so flushing it may fail */
+    bdrv_co_flush(s->cache->bs);
+
+    return ret;
+}
+
+static int64_t coroutine_fn GRAPH_RDLOCK
+read_cache_co_getlength(BlockDriverState *bs)
+{
+    return bdrv_co_getlength(bs->file->bs);
+}
+
+static BlockStatsSpecific *read_cache_get_specific_stats(BlockDriverState *bs)
+{
+    BlockStatsSpecific *stats = g_new(BlockStatsSpecific, 1);
+    BDRVReadCacheState *s = bs->opaque;
+
+    stats->driver = BLOCKDEV_DRIVER_READ_CACHE;
+
+    qemu_mutex_lock(&s->lock);
+    stats->u.read_cache = (BlockStatsSpecificReadCache) {
+        .hit_bytes = s->hit_bytes,
+        .miss_bytes = s->miss_bytes,
+        .evicted_bytes = s->evicted_bytes,
+        .cached_bytes = s->valid ? bdrv_get_dirty_count(s->valid) : 0,
+    };
+    qemu_mutex_unlock(&s->lock);
+
+    return stats;
+}
+
+static const char *const read_cache_strong_runtime_opts[] = {
+    READ_CACHE_OPT_CLUSTER_SIZE,
+    READ_CACHE_OPT_BITMAP,
+    READ_CACHE_OPT_PERSISTENT,
+
+    NULL
+};
+
+static BlockDriver bdrv_read_cache = {
+    .format_name                        = "read-cache",
+    .instance_size                      = sizeof(BDRVReadCacheState),
+
+    .bdrv_open                          = read_cache_open,
+    .bdrv_close                         = read_cache_close,
+    .bdrv_child_perm                    = read_cache_child_perm,
+
+    .bdrv_inactivate                    = read_cache_inactivate,
+    .bdrv_co_invalidate_cache           = read_cache_co_invalidate_cache,
+
+    .bdrv_co_getlength                  = read_cache_co_getlength,
+
+    .bdrv_co_preadv_part                = read_cache_co_preadv_part,
+    .bdrv_co_pwritev_part               = read_cache_co_pwritev_part,
+    .bdrv_co_pwrite_zeroes              = read_cache_co_pwrite_zeroes,
+    .bdrv_co_pdiscard                   = read_cache_co_pdiscard,
+    .bdrv_co_truncate                   = read_cache_co_truncate,
+    .bdrv_co_flush                      = read_cache_co_flush,
+
+    .bdrv_get_specific_stats            = read_cache_get_specific_stats,
+
+    .strong_runtime_opts                = read_cache_strong_runtime_opts,
+    .is_filter                          = true,
+};
+
+static void bdrv_read_cache_init(void)
+{
+    bdrv_register(&bdrv_read_cache);
+}
+
+block_init(bdrv_read_cache_init);
@@ -62,6 +62,15 @@ static void timer_cb(ThrottleGroupMember *tgm, ThrottleDirection direction);
  * blk_set_aio_context()). Therefore in this file a thread will
  * access some other ThrottleGroupMember's timers only after verifying that
  * that ThrottleGroupMember has throttled requests in the queue.
+ *
+ * While no request is waiting, a member whose request went through
+ * without waiting also borrows a share of what is left in the group's
+ * buckets (see throttle_borrow()). Following requests spend that credit
+ * under the member's own credit_lock, without taking the group lock or
+ * touching timers, so members in different iothreads do not contend on
+ * the group until it actually runs out of capacity. At that point the
+ * unused credit of every member is given back before deciding how long
+ * the group must wait.
  */
 struct ThrottleGroup {
     Object parent_obj;
@@ -70,11 +79,13 @@ struct ThrottleGroup {
     bool is_initialized;
     char *name; /* This is constant during the lifetime of the group */
 
-    QemuMutex lock; /* This lock protects the following four fields */
+    QemuMutex lock; /* This lock protects the following six fields */
     ThrottleState ts;
     QLIST_HEAD(, ThrottleGroupMember) head;
+    unsigned nb_members;
     ThrottleGroupMember *tokens[THROTTLE_MAX];
     bool any_timer_armed[THROTTLE_MAX];
+    bool credit_lent[THROTTLE_MAX];
     QEMUClockType clock_type;
 
     /* This field is protected by the global QEMU mutex */
@@ -254,6 +265,69 @@ static ThrottleGroupMember *next_throttle_token(ThrottleGroupMember *tgm,
     return token;
 }
 
+/* Give the unused credit of all members back to the group.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tg:        the ThrottleGroup
+ * @direction: the ThrottleDirection
+ */
+static void throttle_group_revoke_credit(ThrottleGroup *tg,
+                                         ThrottleDirection direction)
+{
+    ThrottleGroupMember *tgm;
+
+    QLIST_FOREACH(tgm, &tg->head, round_robin) {
+        qemu_spin_lock(&tgm->credit_lock);
+        throttle_repay(&tg->ts, direction, &tgm->credit[direction]);
+        qemu_spin_unlock(&tgm->credit_lock);
+    }
+    tg->credit_lent[direction] = false;
+}
+
+/* Lend a ThrottleGroupMember a share of the capacity left in its group.
+ * Each member gets at most half of it divided by the number of members,
+ * so that a single member can not starve the others.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tgm:       the ThrottleGroupMember
+ * @direction: the ThrottleDirection
+ */
+static void throttle_group_lend_credit(ThrottleGroupMember *tgm,
+                                       ThrottleDirection direction)
+{
+    ThrottleState *ts = tgm->throttle_state;
+    ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
+
+    qemu_spin_lock(&tgm->credit_lock);
+    throttle_borrow(ts, direction, 1.0 / (2 * tg->nb_members),
+                    &tgm->credit[direction]);
+    qemu_spin_unlock(&tgm->credit_lock);
+    tg->credit_lent[direction] = true;
+}
+
+/* Try to let an I/O request through using the credit of its
+ * ThrottleGroupMember. This does not take tg->lock.
+ *
+ * @tgm:       the ThrottleGroupMember
+ * @bytes:     the number of bytes for this I/O
+ * @direction: the ThrottleDirection
+ * @ret:       whether the request was accounted and can run immediately
+ */
+static bool throttle_group_consume_credit(ThrottleGroupMember *tgm,
+                                          int64_t bytes,
+                                          ThrottleDirection direction)
+{
+    bool ret;
+
+    qemu_spin_lock(&tgm->credit_lock);
+    ret = throttle_credit_consume(&tgm->credit[direction], bytes);
+    qemu_spin_unlock(&tgm->credit_lock);
+
+    return ret;
+}
+
 /* Check if the next I/O request for a ThrottleGroupMember needs to be
  * throttled or not. If there's no timer set in this group, set one and update
  * the token accordingly.
@@ -283,6 +357,14 @@ static bool throttle_group_schedule_timer(ThrottleGroupMember *tgm,
 
     must_wait = throttle_schedule_timer(ts, tt, direction);
 
+    /* Capacity lent to members counts as used, so take back what they
+     * did not spend yet and check again before making anyone wait */
+    if (must_wait && tg->credit_lent[direction]) {
+        throttle_group_revoke_credit(tg, direction);
+        timer_del(tt->timers[direction]);
+        must_wait = throttle_schedule_timer(ts, tt, direction);
+    }
+
     /* If a timer just got armed, set tgm as the current token */
     if (must_wait) {
         tg->tokens[direction] = tgm;
@@ -362,19 +444,28 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
                                                         int64_t bytes,
                                                         ThrottleDirection direction)
 {
-    bool must_wait;
+    bool must_wait, lend;
     ThrottleGroupMember *token;
     ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
 
     assert(bytes >= 0);
     assert(direction < THROTTLE_MAX);
 
+    /* Nothing is queued while there is credit, so there is no need to
+     * schedule anything either */
+    if (throttle_group_consume_credit(tgm, bytes, direction)) {
+        return;
+    }
+
     qemu_mutex_lock(&tg->lock);
 
     /* First we check if this I/O has to be throttled. */
     token = next_throttle_token(tgm, direction);
     must_wait = throttle_group_schedule_timer(token, direction);
 
+    /* If no one is waiting, let the next requests skip all of this */
+    lend = !must_wait && token == tgm && !tgm->pending_reqs[direction];
+
     /* Wait if there's a timer set or queued requests of this type */
     if (must_wait || tgm->pending_reqs[direction]) {
         tgm->pending_reqs[direction]++;
@@ -389,6 +480,9 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
 
     /* The I/O will be executed, so do the accounting */
     throttle_account(tgm->throttle_state, direction, bytes);
+    if (lend) {
+        throttle_group_lend_credit(tgm, direction);
+    }
 
     /* Schedule the next request */
     schedule_next_request(tgm, direction);
@@ -476,7 +570,12 @@ void throttle_group_config(ThrottleGroupMember *tgm, ThrottleConfig *cfg)
 {
     ThrottleState *ts = tgm->throttle_state;
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
+    ThrottleDirection dir;
+
     qemu_mutex_lock(&tg->lock);
+    for (dir = THROTTLE_READ; dir < THROTTLE_MAX; dir++) {
+        throttle_group_revoke_credit(tg, dir);
+    }
     throttle_config(ts, tg->clock_type, cfg);
     qemu_mutex_unlock(&tg->lock);
 
@@ -562,6 +661,10 @@ void throttle_group_register_tgm(ThrottleGroupMember *tgm,
     }
 
     QLIST_INSERT_HEAD(&tg->head, tgm, round_robin);
+    tg->nb_members++;
+
+    qemu_spin_init(&tgm->credit_lock);
+    memset(tgm->credit, 0, sizeof(tgm->credit));
 
     throttle_timers_init(&tgm->throttle_timers,
                          tgm->aio_context,
@@ -602,6 +705,7 @@ void throttle_group_unregister_tgm(ThrottleGroupMember *tgm)
             assert(tgm->pending_reqs[dir] == 0);
             assert(qemu_co_queue_empty(&tgm->throttled_reqs[dir]));
             assert(!timer_pending(tgm->throttle_timers.timers[dir]));
+            throttle_repay(ts, dir, &tgm->credit[dir]);
             if (tg->tokens[dir] == tgm) {
                 token = throttle_group_next_tgm(tgm);
                 /* Take care of the case where this is the last tgm in the group */
@@ -614,6 +718,7 @@ void throttle_group_unregister_tgm(ThrottleGroupMember *tgm)
 
         /* remove the current tgm from the list */
         QLIST_REMOVE(tgm, round_robin);
+        tg->nb_members--;
         throttle_timers_destroy(&tgm->throttle_timers);
     }
 
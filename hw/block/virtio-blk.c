@@ -38,6 +38,9 @@
 #include "hw/virtio/virtio-blk-common.h"
 #include "qemu/coroutine.h"
 
+/* Maximum number of requests popped from a virtqueue at once */
+#define VIRTIO_BLK_POP_BATCH 16
+
 static void virtio_blk_ioeventfd_attach(VirtIOBlock *s);
 
 static void virtio_blk_init_request(VirtIOBlock *s, VirtQueue *vq,
@@ -164,14 +167,17 @@ static void virtio_blk_discard_write_zeroes_complete(void *opaque, int ret)
     g_free(req);
 }
 
-static VirtIOBlockReq *virtio_blk_get_request(VirtIOBlock *s, VirtQueue *vq)
+static unsigned int virtio_blk_get_requests(VirtIOBlock *s, VirtQueue *vq,
+                                            VirtIOBlockReq **reqs,
+                                            unsigned int max)
 {
-    VirtIOBlockReq *req = virtqueue_pop(vq, sizeof(VirtIOBlockReq));
+    unsigned int i, n;
 
-    if (req) {
-        virtio_blk_init_request(s, vq, req);
+    n = virtqueue_pop_batch(vq, sizeof(VirtIOBlockReq), (void **)reqs, max);
+    for (i = 0; i < n; i++) {
+        virtio_blk_init_request(s, vq, reqs[i]);
     }
-    return req;
+    return n;
 }
 
 static void virtio_blk_handle_scsi(VirtIOBlockReq *req)
@@ -976,7 +982,8 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
 
 void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
 {
-    VirtIOBlockReq *req;
+    VirtIOBlockReq *reqs[VIRTIO_BLK_POP_BATCH];
+    unsigned int i, n;
     MultiReqBuffer mrb = {};
     bool suppress_notifications = virtio_queue_get_notification(vq);
 
@@ -987,10 +994,18 @@ void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
             virtio_queue_set_notification(vq, 0);
         }
 
-        while ((req = virtio_blk_get_request(s, vq))) {
-            if (virtio_blk_handle_request(req, &mrb)) {
-                virtqueue_detach_element(req->vq, &req->elem, 0);
-                g_free(req);
+        while ((n = virtio_blk_get_requests(s, vq, reqs, ARRAY_SIZE(reqs)))) {
+            for (i = 0; i < n; i++) {
+                if (virtio_blk_handle_request(reqs[i], &mrb)) {
+                    break;
+                }
+            }
+            if (i < n) {
+                /* The device is broken, drop the rest of the batch too */
+                for (; i < n; i++) {
+                    virtqueue_detach_element(vq, &reqs[i]->elem, 0);
+                    g_free(reqs[i]);
+                }
                 break;
             }
         }
@@ -585,8 +585,12 @@ static void net_tx_pkt_sendv(
     }
 }
 
+/* TCP headers, including options, are at most 60 bytes */
+#define NET_TX_PKT_MAX_TCP_HDR_LEN (15 * sizeof(uint32_t))
+
 static bool net_tx_pkt_tcp_fragment_init(struct NetTxPkt *pkt,
                                          struct iovec *fragment,
+                                         uint8_t *l4hdr_buf,
                                          int *pl_idx,
                                          size_t *l4hdr_len,
                                          int *src_idx,
@@ -602,7 +606,10 @@ static bool net_tx_pkt_tcp_fragment_init(struct NetTxPkt *pkt,
     }
 
     l4->iov_len = pkt->virt_hdr.hdr_len - pkt->hdr_len;
-    l4->iov_base = g_malloc(l4->iov_len);
+    if (l4->iov_len > NET_TX_PKT_MAX_TCP_HDR_LEN) {
+        return false;
+    }
+    l4->iov_base = l4hdr_buf;
 
     *src_idx = NET_TX_PKT_PL_START_FRAG;
     while (pkt->vec[*src_idx].iov_len < l4->iov_len - bytes_read) {
@@ -613,7 +620,6 @@ static bool net_tx_pkt_tcp_fragment_init(struct NetTxPkt *pkt,
 
         (*src_idx)++;
         if (*src_idx >= pkt->payload_frags + NET_TX_PKT_PL_START_FRAG) {
-            g_free(l4->iov_base);
             return false;
         }
     }
@@ -632,11 +638,6 @@ static bool net_tx_pkt_tcp_fragment_init(struct NetTxPkt *pkt,
     return true;
 }
 
-static void net_tx_pkt_tcp_fragment_deinit(struct iovec *fragment)
-{
-    g_free(fragment[NET_TX_PKT_PL_START_FRAG].iov_base);
-}
-
 static void net_tx_pkt_tcp_fragment_fix(struct NetTxPkt *pkt,
                                         struct iovec *fragment,
                                         size_t fragment_len,
@@ -722,6 +723,7 @@ static bool net_tx_pkt_do_sw_fragmentation(struct NetTxPkt *pkt,
     uint8_t gso_type = pkt->virt_hdr.gso_type & ~VIRTIO_NET_HDR_GSO_ECN;
 
     struct iovec fragment[NET_MAX_FRAG_SG_LIST];
+    uint8_t l4hdr_buf[NET_TX_PKT_MAX_TCP_HDR_LEN];
     size_t fragment_len;
     size_t l4hdr_len;
     size_t src_len;
@@ -743,7 +745,8 @@ static bool net_tx_pkt_do_sw_fragmentation(struct NetTxPkt *pkt,
     switch (gso_type) {
     case VIRTIO_NET_HDR_GSO_TCPV4:
     case VIRTIO_NET_HDR_GSO_TCPV6:
-        if (!net_tx_pkt_tcp_fragment_init(pkt, fragment, &pl_idx, &l4hdr_len,
+        if (!net_tx_pkt_tcp_fragment_init(pkt, fragment, l4hdr_buf,
+                                          &pl_idx, &l4hdr_len,
                                           &src_idx, &src_offset, &src_len)) {
             return false;
         }
@@ -798,11 +801,6 @@ static bool net_tx_pkt_do_sw_fragmentation(struct NetTxPkt *pkt,
         fragment_offset += fragment_len;
     }
 
-    if (gso_type == VIRTIO_NET_HDR_GSO_TCPV4 ||
-        gso_type == VIRTIO_NET_HDR_GSO_TCPV6) {
-        net_tx_pkt_tcp_fragment_deinit(fragment);
-    }
-
     return true;
 }
 
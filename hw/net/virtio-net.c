@@ -14,6 +14,7 @@
 #include "qemu/osdep.h"
 #include "qemu/atomic.h"
 #include "qemu/iov.h"
+#include "qemu/lockable.h"
 #include "qemu/log.h"
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
@@ -31,6 +32,8 @@
 #include "net/vhost_net.h"
 #include "net/announce.h"
 #include "hw/virtio/virtio-bus.h"
+#include "hw/virtio/iothread-vq-mapping.h"
+#include "block/aio-wait.h"
 #include "qapi/error.h"
 #include "qapi/qapi-events-net.h"
 #include "hw/qdev-properties.h"
@@ -59,6 +62,9 @@
 #define VIRTIO_NET_RX_QUEUE_MIN_SIZE VIRTIO_NET_RX_QUEUE_DEFAULT_SIZE
 #define VIRTIO_NET_TX_QUEUE_MIN_SIZE VIRTIO_NET_TX_QUEUE_DEFAULT_SIZE
 
+/* Transmitted buffers returned to the guest with a single used index update */
+#define VIRTIO_NET_TX_PUSH_BATCH 32
+
 #define VIRTIO_NET_IP4_ADDR_SIZE   8        /* ipv4 saddr + daddr */
 
 #define VIRTIO_NET_TCP_FLAG         0x3F
@@ -219,7 +225,9 @@ static void virtio_net_set_config(VirtIODevice *vdev, const uint8_t *config)
     if (!virtio_vdev_has_feature(vdev, VIRTIO_NET_F_CTRL_MAC_ADDR) &&
         !virtio_vdev_has_feature(vdev, VIRTIO_F_VERSION_1) &&
         memcmp(netcfg.mac, n->mac, ETH_ALEN)) {
-        memcpy(n->mac, netcfg.mac, ETH_ALEN);
+        WITH_QEMU_LOCK_GUARD(&n->rx_filter_lock) {
+            memcpy(n->mac, netcfg.mac, ETH_ALEN);
+        }
         qemu_format_nic_info_str(qemu_get_queue(n->nic), n->mac);
     }
 
@@ -393,6 +401,252 @@ static void virtio_net_vnet_endian_status(VirtIONet *n, uint8_t status)
     }
 }
 
+static void virtio_net_tx_bh(void *opaque);
+
+/*
+ * With iothread-vq-mapping, each queue pair and its backend are served by
+ * an IOThread while the device is running in userspace.  Control plane
+ * changes still happen in the main loop: they pause the dataplane, which
+ * moves every queue pair back to the main loop until they are done.
+ * Receive filter updates do not pause it and take rx_filter_lock instead.
+ */
+
+/* Context: BQL held */
+static bool virtio_net_dataplane_setup(VirtIONet *n, Error **errp)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+
+    if (n->net_conf.tx && !strcmp(n->net_conf.tx, "timer")) {
+        error_setg(errp, "iothread-vq-mapping requires tx=bh");
+        return false;
+    }
+    /* Both may hand packets over to another queue pair, or the main loop */
+    if (virtio_has_feature(n->host_features, VIRTIO_NET_F_RSS) ||
+        virtio_has_feature(n->host_features, VIRTIO_NET_F_RSC_EXT)) {
+        error_setg(errp, "iothread-vq-mapping is incompatible with "
+                   "rss and guest_rsc_ext");
+        return false;
+    }
+    if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
+        error_setg(errp,
+                   "device is incompatible with iothread "
+                   "(transport does not support notifiers)");
+        return false;
+    }
+    if (!virtio_device_ioeventfd_enabled(vdev)) {
+        error_setg(errp, "ioeventfd is required for iothread");
+        return false;
+    }
+
+    n->vq_aio_context = g_new(AioContext *, n->max_queue_pairs);
+    if (!iothread_vq_mapping_apply(n->net_conf.iothread_vq_mapping_list,
+                                   n->vq_aio_context, n->max_queue_pairs,
+                                   errp)) {
+        g_free(n->vq_aio_context);
+        n->vq_aio_context = NULL;
+        return false;
+    }
+    return true;
+}
+
+/* Context: BQL held */
+static void virtio_net_dataplane_start_queue(VirtIONet *n, int index)
+{
+    VirtIONetQueue *q = &n->vqs[index];
+    NetClientState *nc = qemu_get_subqueue(n->nic, index);
+    AioContext *ctx = n->vq_aio_context[index];
+
+    /* Otherwise the queue pair stays in the main loop */
+    if (q->ctx || q->reset_vqs || n->nic->peer_deleted ||
+        !nc->peer || !qemu_can_set_net_aio_context(nc->peer) ||
+        !QTAILQ_EMPTY(&nc->filters) || !QTAILQ_EMPTY(&nc->peer->filters)) {
+        return;
+    }
+
+    event_notifier_set_handler(virtio_queue_get_host_notifier(q->rx_vq), NULL);
+    event_notifier_set_handler(virtio_queue_get_host_notifier(q->tx_vq), NULL);
+
+    qemu_bh_delete(q->tx_bh);
+    q->tx_bh = aio_bh_new_guarded(ctx, virtio_net_tx_bh, q,
+                                  &DEVICE(n)->mem_reentrancy_guard);
+    q->ctx = ctx;
+    qemu_set_net_aio_context(nc, ctx);
+    qemu_set_net_aio_context(nc->peer, ctx);
+
+    if (q->tx_waiting) {
+        replay_bh_schedule_event(q->tx_bh);
+    }
+
+    /*
+     * Neither handler pops every element: rx waits for packets and tx
+     * defers to tx_bh, so polling would only spin.
+     */
+    virtio_queue_aio_attach_host_notifier_no_poll(q->rx_vq, ctx);
+    virtio_queue_aio_attach_host_notifier_no_poll(q->tx_vq, ctx);
+}
+
+/* Context: BH in IOThread */
+static void virtio_net_dataplane_stop_queue_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+    AioContext *ctx = qemu_get_current_aio_context();
+    NetClientState *nc = qemu_get_subqueue(q->n->nic, q - q->n->vqs);
+
+    virtio_queue_aio_detach_host_notifier(q->rx_vq, ctx);
+    virtio_queue_aio_detach_host_notifier(q->tx_vq, ctx);
+    qemu_bh_cancel(q->tx_bh);
+    qemu_set_net_aio_context(nc->peer, NULL);
+    qemu_set_net_aio_context(nc, NULL);
+}
+
+/* Context: BQL held */
+static void virtio_net_dataplane_stop_queue(VirtIONet *n, int index)
+{
+    VirtIONetQueue *q = &n->vqs[index];
+    VirtQueue *vqs[] = { q->rx_vq, q->tx_vq };
+    int i;
+
+    if (!q->ctx) {
+        return;
+    }
+
+    aio_wait_bh_oneshot(q->ctx, virtio_net_dataplane_stop_queue_bh, q);
+    q->ctx = NULL;
+
+    qemu_bh_delete(q->tx_bh);
+    q->tx_bh = qemu_bh_new_guarded(virtio_net_tx_bh, q,
+                                   &DEVICE(n)->mem_reentrancy_guard);
+    if (q->tx_waiting) {
+        replay_bh_schedule_event(q->tx_bh);
+    }
+
+    for (i = 0; i < ARRAY_SIZE(vqs); i++) {
+        EventNotifier *host_notifier = virtio_queue_get_host_notifier(vqs[i]);
+
+        event_notifier_set_handler(host_notifier,
+                                   virtio_queue_host_notifier_read);
+        /* Catch up with kicks that raced with the detach */
+        event_notifier_set(host_notifier);
+    }
+}
+
+/* Context: BQL held */
+static void virtio_net_dataplane_start(VirtIONet *n)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int i, r;
+
+    if (!n->vq_aio_context || n->dataplane_started || n->dataplane_fenced ||
+        n->dataplane_paused || !n->ioeventfd_started ||
+        !virtio_net_started(n, vdev->status) || n->vhost_started) {
+        return;
+    }
+
+    /*
+     * Only vhost can mask guest notifiers on behalf of the transport, which
+     * must release the irqfd of masked vectors instead.
+     */
+    n->dataplane_saved_notifier_mask = vdev->use_guest_notifier_mask;
+    vdev->use_guest_notifier_mask = false;
+
+    /* Set up guest notifier (irq) */
+    r = k->set_guest_notifiers(qbus->parent, virtio_get_num_queues(vdev),
+                               true);
+    if (r != 0) {
+        error_report("virtio-net failed to set guest notifier (%d), "
+                     "ensure -accel kvm is set.", r);
+        vdev->use_guest_notifier_mask = n->dataplane_saved_notifier_mask;
+        n->dataplane_fenced = true;
+        return;
+    }
+    n->dataplane_started = true;
+
+    for (i = 0; i < n->curr_queue_pairs; i++) {
+        virtio_net_dataplane_start_queue(n, i);
+    }
+}
+
+/* Context: BQL held */
+static void virtio_net_dataplane_stop(VirtIONet *n)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int i;
+
+    if (!n->dataplane_started) {
+        return;
+    }
+
+    for (i = 0; i < n->max_queue_pairs; i++) {
+        virtio_net_dataplane_stop_queue(n, i);
+    }
+
+    /* Clean up guest notifier (irq) */
+    k->set_guest_notifiers(qbus->parent, virtio_get_num_queues(vdev), false);
+    vdev->use_guest_notifier_mask = n->dataplane_saved_notifier_mask;
+    n->dataplane_started = false;
+}
+
+/* Context: BQL held */
+static void virtio_net_dataplane_pause(VirtIONet *n)
+{
+    if (n->dataplane_paused++ == 0) {
+        virtio_net_dataplane_stop(n);
+    }
+}
+
+/* Context: BQL held */
+static void virtio_net_dataplane_resume(VirtIONet *n)
+{
+    assert(n->dataplane_paused > 0);
+    if (--n->dataplane_paused == 0) {
+        virtio_net_dataplane_start(n);
+    }
+}
+
+/* Context: BQL held */
+static void virtio_net_dataplane_cleanup(VirtIONet *n)
+{
+    /* The backend is cleaned up next, it must not run in an IOThread */
+    virtio_net_dataplane_stop(n);
+
+    if (n->vq_aio_context) {
+        iothread_vq_mapping_cleanup(n->net_conf.iothread_vq_mapping_list);
+        g_free(n->vq_aio_context);
+        n->vq_aio_context = NULL;
+    }
+}
+
+/* Context: BQL held */
+static int virtio_net_start_ioeventfd(VirtIODevice *vdev)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    int r;
+
+    r = virtio_device_start_ioeventfd_impl(vdev);
+    if (r == 0) {
+        n->ioeventfd_started = true;
+        virtio_net_dataplane_start(n);
+    }
+    return r;
+}
+
+/* Context: BQL held */
+static void virtio_net_stop_ioeventfd(VirtIODevice *vdev)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+
+    virtio_net_dataplane_stop(n);
+    n->ioeventfd_started = false;
+    n->dataplane_fenced = false; /* Better luck next time. */
+    virtio_device_stop_ioeventfd_impl(vdev);
+}
+
 static void virtio_net_drop_tx_queue_data(VirtIODevice *vdev, VirtQueue *vq)
 {
     unsigned int dropped = virtqueue_drop_all(vq);
@@ -408,6 +662,7 @@ static int virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
     int i;
     uint8_t queue_status;
 
+    virtio_net_dataplane_pause(n);
     virtio_net_vnet_endian_status(n, status);
     virtio_net_vhost_status(n, status);
 
@@ -456,6 +711,7 @@ static int virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
             }
         }
     }
+    virtio_net_dataplane_resume(n);
     return 0;
 }
 
@@ -591,6 +847,12 @@ static void virtio_net_queue_reset(VirtIODevice *vdev, uint32_t queue_index)
         vhost_net_virtqueue_reset(vdev, nc, queue_index);
     }
 
+    /*
+     * The virtqueue itself is reset after we return, so the queue pair
+     * stays in the main loop until the guest enables it again.
+     */
+    n->vqs[vq2q(queue_index)].reset_vqs |= 1 << (queue_index % 2);
+    virtio_net_dataplane_stop_queue(n, vq2q(queue_index));
     flush_or_purge_queued_packets(nc);
 }
 
@@ -607,6 +869,11 @@ static void virtio_net_queue_enable(VirtIODevice *vdev, uint32_t queue_index)
 
     nc = qemu_get_subqueue(n->nic, vq2q(queue_index));
 
+    n->vqs[vq2q(queue_index)].reset_vqs &= ~(1 << (queue_index % 2));
+    if (n->dataplane_started && vq2q(queue_index) < n->curr_queue_pairs) {
+        virtio_net_dataplane_start_queue(n, vq2q(queue_index));
+    }
+
     if (!nc->peer || !vdev->vhost_started) {
         return;
     }
@@ -986,7 +1253,10 @@ static void virtio_net_set_features(VirtIODevice *vdev,
         virtio_has_feature_ex(vdev->guest_features_ex,
                               VIRTIO_NET_F_CTRL_VLAN)) {
         bool vlan = virtio_has_feature_ex(features, VIRTIO_NET_F_CTRL_VLAN);
-        memset(n->vlans, vlan ? 0 : 0xff, sizeof(n->vlans));
+
+        WITH_QEMU_LOCK_GUARD(&n->rx_filter_lock) {
+            memset(n->vlans, vlan ? 0 : 0xff, sizeof(n->vlans));
+        }
     }
 
     if (virtio_has_feature_ex(features, VIRTIO_NET_F_STANDBY)) {
@@ -1015,20 +1285,22 @@ static int virtio_net_handle_rx_mode(VirtIONet *n, uint8_t cmd,
         return VIRTIO_NET_ERR;
     }
 
-    if (cmd == VIRTIO_NET_CTRL_RX_PROMISC) {
-        n->promisc = on;
-    } else if (cmd == VIRTIO_NET_CTRL_RX_ALLMULTI) {
-        n->allmulti = on;
-    } else if (cmd == VIRTIO_NET_CTRL_RX_ALLUNI) {
-        n->alluni = on;
-    } else if (cmd == VIRTIO_NET_CTRL_RX_NOMULTI) {
-        n->nomulti = on;
-    } else if (cmd == VIRTIO_NET_CTRL_RX_NOUNI) {
-        n->nouni = on;
-    } else if (cmd == VIRTIO_NET_CTRL_RX_NOBCAST) {
-        n->nobcast = on;
-    } else {
-        return VIRTIO_NET_ERR;
+    WITH_QEMU_LOCK_GUARD(&n->rx_filter_lock) {
+        if (cmd == VIRTIO_NET_CTRL_RX_PROMISC) {
+            n->promisc = on;
+        } else if (cmd == VIRTIO_NET_CTRL_RX_ALLMULTI) {
+            n->allmulti = on;
+        } else if (cmd == VIRTIO_NET_CTRL_RX_ALLUNI) {
+            n->alluni = on;
+        } else if (cmd == VIRTIO_NET_CTRL_RX_NOMULTI) {
+            n->nomulti = on;
+        } else if (cmd == VIRTIO_NET_CTRL_RX_NOUNI) {
+            n->nouni = on;
+        } else if (cmd == VIRTIO_NET_CTRL_RX_NOBCAST) {
+            n->nobcast = on;
+        } else {
+            return VIRTIO_NET_ERR;
+        }
     }
 
     rxfilter_notify(nc);
@@ -1093,7 +1365,9 @@ static int virtio_net_handle_mac(VirtIONet *n, uint8_t cmd,
         if (iov_size(iov, iov_cnt) != sizeof(n->mac)) {
             return VIRTIO_NET_ERR;
         }
-        s = iov_to_buf(iov, iov_cnt, 0, &n->mac, sizeof(n->mac));
+        WITH_QEMU_LOCK_GUARD(&n->rx_filter_lock) {
+            s = iov_to_buf(iov, iov_cnt, 0, &n->mac, sizeof(n->mac));
+        }
         assert(s == sizeof(n->mac));
         qemu_format_nic_info_str(qemu_get_queue(n->nic), n->mac);
         rxfilter_notify(nc);
@@ -1162,11 +1436,13 @@ static int virtio_net_handle_mac(VirtIONet *n, uint8_t cmd,
         multi_overflow = 1;
     }
 
-    n->mac_table.in_use = in_use;
-    n->mac_table.first_multi = first_multi;
-    n->mac_table.uni_overflow = uni_overflow;
-    n->mac_table.multi_overflow = multi_overflow;
-    memcpy(n->mac_table.macs, macs, MAC_TABLE_ENTRIES * ETH_ALEN);
+    WITH_QEMU_LOCK_GUARD(&n->rx_filter_lock) {
+        n->mac_table.in_use = in_use;
+        n->mac_table.first_multi = first_multi;
+        n->mac_table.uni_overflow = uni_overflow;
+        n->mac_table.multi_overflow = multi_overflow;
+        memcpy(n->mac_table.macs, macs, MAC_TABLE_ENTRIES * ETH_ALEN);
+    }
     g_free(macs);
     rxfilter_notify(nc);
 
@@ -1194,12 +1470,15 @@ static int virtio_net_handle_vlan_table(VirtIONet *n, uint8_t cmd,
     if (vid >= MAX_VLAN)
         return VIRTIO_NET_ERR;
 
-    if (cmd == VIRTIO_NET_CTRL_VLAN_ADD)
-        n->vlans[vid >> 5] |= (1U << (vid & 0x1f));
-    else if (cmd == VIRTIO_NET_CTRL_VLAN_DEL)
-        n->vlans[vid >> 5] &= ~(1U << (vid & 0x1f));
-    else
-        return VIRTIO_NET_ERR;
+    WITH_QEMU_LOCK_GUARD(&n->rx_filter_lock) {
+        if (cmd == VIRTIO_NET_CTRL_VLAN_ADD) {
+            n->vlans[vid >> 5] |= (1U << (vid & 0x1f));
+        } else if (cmd == VIRTIO_NET_CTRL_VLAN_DEL) {
+            n->vlans[vid >> 5] &= ~(1U << (vid & 0x1f));
+        } else {
+            return VIRTIO_NET_ERR;
+        }
+    }
 
     rxfilter_notify(nc);
 
@@ -1581,9 +1860,15 @@ size_t virtio_net_handle_ctrl_iov(VirtIODevice *vdev,
     } else if (ctrl.class == VIRTIO_NET_CTRL_ANNOUNCE) {
         status = virtio_net_handle_announce(n, ctrl.cmd, iov, out_num);
     } else if (ctrl.class == VIRTIO_NET_CTRL_MQ) {
+        /* Changes the queue pairs and RSS steering used by the dataplane */
+        virtio_net_dataplane_pause(n);
         status = virtio_net_handle_mq(n, ctrl.cmd, iov, out_num);
+        virtio_net_dataplane_resume(n);
     } else if (ctrl.class == VIRTIO_NET_CTRL_GUEST_OFFLOADS) {
+        /* Reconfigures the backend that the dataplane receives from */
+        virtio_net_dataplane_pause(n);
         status = virtio_net_handle_offloads(n, ctrl.cmd, iov, out_num);
+        virtio_net_dataplane_resume(n);
     }
 
     s = iov_from_buf(in_sg, in_num, 0, &status, sizeof(status));
@@ -1595,6 +1880,7 @@ size_t virtio_net_handle_ctrl_iov(VirtIODevice *vdev,
 
 static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
 {
+    VirtIONet *n = VIRTIO_NET(vdev);
     VirtQueueElement *elem;
 
     for (;;) {
@@ -1744,6 +2030,8 @@ static int receive_filter(VirtIONet *n, const uint8_t *buf, int size)
     uint8_t *ptr = (uint8_t *)buf;
     int i;
 
+    QEMU_LOCK_GUARD(&n->rx_filter_lock);
+
     if (n->promisc)
         return 1;
 
@@ -1915,6 +2203,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     unsigned mhdr_cnt = 0;
     size_t offset, i, guest_offset, j;
     ssize_t err;
+    bool batch = nc->receive_batch;
 
     memset(&extra_hdr, 0, sizeof(extra_hdr));
 
@@ -2040,7 +2329,11 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     }
 
     virtqueue_flush(q->rx_vq, i);
-    virtio_notify(vdev, q->rx_vq);
+    if (batch) {
+        q->rx_notify_pending = true;
+    } else {
+        virtio_notify(vdev, q->rx_vq);
+    }
 
     return size;
 
@@ -2715,11 +3008,31 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 }
 
 /* TX */
+static void virtio_net_tx_push_batch(VirtIONetQueue *q,
+                                     VirtQueueElement **elems,
+                                     unsigned int *count)
+{
+    unsigned int i;
+
+    if (!*count) {
+        return;
+    }
+
+    virtqueue_push_batch(q->tx_vq, elems, NULL, *count);
+    virtio_notify(VIRTIO_DEVICE(q->n), q->tx_vq);
+    for (i = 0; i < *count; i++) {
+        g_free(elems[i]);
+    }
+    *count = 0;
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     VirtQueueElement *elem;
+    VirtQueueElement *sent[VIRTIO_NET_TX_PUSH_BATCH];
+    unsigned int n_sent = 0;
     int32_t num_packets = 0;
     int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
@@ -2795,23 +3108,27 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
                                       out_sg, out_num, virtio_net_tx_complete);
         if (ret == 0) {
+            virtio_net_tx_push_batch(q, sent, &n_sent);
             virtio_queue_set_notification(q->tx_vq, 0);
             q->async_tx.elem = elem;
             return -EBUSY;
         }
 
 drop:
-        virtqueue_push(q->tx_vq, elem, 0);
-        virtio_notify(vdev, q->tx_vq);
-        g_free(elem);
+        sent[n_sent++] = elem;
+        if (n_sent == ARRAY_SIZE(sent)) {
+            virtio_net_tx_push_batch(q, sent, &n_sent);
+        }
 
         if (++num_packets >= n->tx_burst) {
             break;
         }
     }
+    virtio_net_tx_push_batch(q, sent, &n_sent);
     return num_packets;
 
 detach:
+    virtio_net_tx_push_batch(q, sent, &n_sent);
     virtqueue_detach_element(q->tx_vq, elem, 0);
     g_free(elem);
     return -EINVAL;
@@ -3628,14 +3945,51 @@ static const VMStateDescription vmstate_virtio_net_device = {
     }
 };
 
+static void virtio_net_rx_notify_pending(VirtIONet *n, VirtIONetQueue *q)
+{
+    if (q->rx_notify_pending) {
+        q->rx_notify_pending = false;
+        virtio_notify(VIRTIO_DEVICE(n), q->rx_vq);
+    }
+}
+
+static void virtio_net_receive_batch_end(NetClientState *nc)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    int i;
+
+    /* With software RSS, packets may have been steered to any queue */
+    if (n->rss_data.enabled && n->rss_data.enabled_software_rss) {
+        for (i = 0; i < n->max_queue_pairs; i++) {
+            virtio_net_rx_notify_pending(n, &n->vqs[i]);
+        }
+    } else {
+        virtio_net_rx_notify_pending(n, virtio_net_get_subqueue(nc));
+    }
+}
+
+/* Context: BQL held */
+static void virtio_net_quiesce(NetClientState *nc, bool quiesce)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+
+    if (quiesce) {
+        virtio_net_dataplane_pause(n);
+    } else {
+        virtio_net_dataplane_resume(n);
+    }
+}
+
 static NetClientInfo net_virtio_info = {
     .type = NET_CLIENT_DRIVER_NIC,
     .size = sizeof(NICState),
     .can_receive = virtio_net_can_receive,
     .receive = virtio_net_receive,
+    .receive_batch_end = virtio_net_receive_batch_end,
     .link_status_changed = virtio_net_set_link_status,
     .query_rx_filter = virtio_net_query_rxfilter,
     .announce = virtio_net_announce,
+    .quiesce = virtio_net_quiesce,
 };
 
 static bool virtio_net_guest_notifier_pending(VirtIODevice *vdev, int idx)
@@ -3960,6 +4314,12 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
         virtio_cleanup(vdev);
         return;
     }
+
+    if (n->net_conf.iothread_vq_mapping_list &&
+        !virtio_net_dataplane_setup(n, errp)) {
+        virtio_cleanup(vdev);
+        return;
+    }
     n->vqs = g_new0(VirtIONetQueue, n->max_queue_pairs);
     n->curr_queue_pairs = 1;
     n->tx_timeout = n->net_conf.txtimer;
@@ -4017,6 +4377,7 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
     virtio_net_set_mrg_rx_bufs(n, 0, 0, 0, 0);
     n->promisc = 1; /* for compatibility */
 
+    qemu_mutex_init(&n->rx_filter_lock);
     n->mac_table.macs = g_malloc0(MAC_TABLE_ENTRIES * ETH_ALEN);
 
     memset(n->vlans, 0xff, sizeof(n->vlans));
@@ -4061,6 +4422,7 @@ static void virtio_net_device_unrealize(DeviceState *dev)
 
     /* This will stop vhost backend if appropriate. */
     virtio_net_set_status(vdev, 0);
+    virtio_net_dataplane_cleanup(n);
 
     g_free(n->netclient_name);
     n->netclient_name = NULL;
@@ -4068,6 +4430,7 @@ static void virtio_net_device_unrealize(DeviceState *dev)
     n->netclient_type = NULL;
 
     g_free(n->mac_table.macs);
+    qemu_mutex_destroy(&n->rx_filter_lock);
 
     if (n->failover) {
         qobject_unref(n->primary_opts);
@@ -4122,6 +4485,7 @@ static void virtio_net_reset(VirtIODevice *vdev)
     /* Flush any async TX */
     for (i = 0;  i < n->max_queue_pairs; i++) {
         flush_or_purge_queued_packets(qemu_get_subqueue(n->nic, i));
+        n->vqs[i].reset_vqs = 0;
     }
 
     virtio_net_disable_rss(n);
@@ -4244,6 +4608,8 @@ static const Property virtio_net_properties[] = {
                        TX_TIMER_INTERVAL),
     DEFINE_PROP_INT32("x-txburst", VirtIONet, net_conf.txburst, TX_BURST),
     DEFINE_PROP_STRING("tx", VirtIONet, net_conf.tx),
+    DEFINE_PROP_IOTHREAD_VQ_MAPPING_LIST("iothread-vq-mapping", VirtIONet,
+                                         net_conf.iothread_vq_mapping_list),
     DEFINE_PROP_UINT16("rx_queue_size", VirtIONet, net_conf.rx_queue_size,
                        VIRTIO_NET_RX_QUEUE_DEFAULT_SIZE),
     DEFINE_PROP_UINT16("tx_queue_size", VirtIONet, net_conf.tx_queue_size,
@@ -4333,6 +4699,8 @@ static void virtio_net_class_init(ObjectClass *klass, const void *data)
     vdc->queue_reset = virtio_net_queue_reset;
     vdc->queue_enable = virtio_net_queue_enable;
     vdc->set_status = virtio_net_set_status;
+    vdc->start_ioeventfd = virtio_net_start_ioeventfd;
+    vdc->stop_ioeventfd = virtio_net_stop_ioeventfd;
     vdc->guest_notifier_mask = virtio_net_guest_notifier_mask;
     vdc->guest_notifier_pending = virtio_net_guest_notifier_pending;
     vdc->legacy_features |= (0x1 << VIRTIO_NET_F_GSO);
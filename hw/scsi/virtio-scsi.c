@@ -32,6 +32,9 @@
 #include "hw/virtio/virtio-access.h"
 #include "trace.h"
 
+/* Maximum number of requests popped from a command virtqueue at once */
+#define VIRTIO_SCSI_POP_BATCH 16
+
 typedef struct VirtIOSCSIReq {
     /*
      * Note:
@@ -249,6 +252,21 @@ static VirtIOSCSIReq *virtio_scsi_pop_req(VirtIOSCSI *s, VirtQueue *vq, QemuMute
     return req;
 }
 
+static unsigned int virtio_scsi_pop_reqs(VirtIOSCSI *s, VirtQueue *vq,
+                                         VirtIOSCSIReq **reqs,
+                                         unsigned int max)
+{
+    VirtIOSCSICommon *vs = (VirtIOSCSICommon *)s;
+    unsigned int i, n;
+
+    n = virtqueue_pop_batch(vq, sizeof(VirtIOSCSIReq) + vs->cdb_size,
+                            (void **)reqs, max);
+    for (i = 0; i < n; i++) {
+        virtio_scsi_init_req(s, vq, reqs[i]);
+    }
+    return n;
+}
+
 static void virtio_scsi_save_request(QEMUFile *f, SCSIRequest *sreq)
 {
     VirtIOSCSIReq *req = sreq->hba_private;
@@ -907,6 +925,8 @@ static void virtio_scsi_handle_cmd_req_submit(VirtIOSCSI *s, VirtIOSCSIReq *req)
 static void virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
 {
     VirtIOSCSIReq *req, *next;
+    VirtIOSCSIReq *batch[VIRTIO_SCSI_POP_BATCH];
+    unsigned int i, n;
     int ret = 0;
     bool suppress_notifications = virtio_queue_get_notification(vq);
 
@@ -917,11 +937,18 @@ static void virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
             virtio_queue_set_notification(vq, 0);
         }
 
-        while ((req = virtio_scsi_pop_req(s, vq, NULL))) {
-            ret = virtio_scsi_handle_cmd_req_prepare(s, req);
-            if (!ret) {
-                QTAILQ_INSERT_TAIL(&reqs, req, next);
-            } else if (ret == -EINVAL) {
+        while (ret != -EINVAL &&
+               (n = virtio_scsi_pop_reqs(s, vq, batch, ARRAY_SIZE(batch)))) {
+            for (i = 0; i < n; i++) {
+                req = batch[i];
+                ret = virtio_scsi_handle_cmd_req_prepare(s, req);
+                if (!ret) {
+                    QTAILQ_INSERT_TAIL(&reqs, req, next);
+                } else if (ret == -EINVAL) {
+                    break;
+                }
+            }
+            if (ret == -EINVAL) {
                 /* The device is broken and shouldn't process any request */
                 while (!QTAILQ_EMPTY(&reqs)) {
                     req = QTAILQ_FIRST(&reqs);
@@ -931,6 +958,11 @@ static void virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
                     virtqueue_detach_element(req->vq, &req->elem, 0);
                     virtio_scsi_free_req(req);
                 }
+                /* batch[i] was freed by the failed prepare */
+                for (i++; i < n; i++) {
+                    virtqueue_detach_element(vq, &batch[i]->elem, 0);
+                    virtio_scsi_free_req(batch[i]);
+                }
             }
         }
 
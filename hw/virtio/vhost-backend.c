@@ -393,32 +393,47 @@ const VhostOps kernel_ops = {
 };
 #endif
 
-int vhost_backend_update_device_iotlb(struct vhost_dev *dev,
-                                             uint64_t iova, uint64_t uaddr,
-                                             uint64_t len,
-                                             IOMMUAccessFlags perm)
+int vhost_backend_fill_device_iotlb_update(struct vhost_iotlb_msg *imsg,
+                                           uint64_t iova, uint64_t uaddr,
+                                           uint64_t len,
+                                           IOMMUAccessFlags perm)
 {
-    struct vhost_iotlb_msg imsg;
-
-    imsg.iova =  iova;
-    imsg.uaddr = uaddr;
-    imsg.size = len;
-    imsg.type = VHOST_IOTLB_UPDATE;
+    imsg->iova =  iova;
+    imsg->uaddr = uaddr;
+    imsg->size = len;
+    imsg->type = VHOST_IOTLB_UPDATE;
 
     switch (perm) {
     case IOMMU_RO:
-        imsg.perm = VHOST_ACCESS_RO;
+        imsg->perm = VHOST_ACCESS_RO;
         break;
     case IOMMU_WO:
-        imsg.perm = VHOST_ACCESS_WO;
+        imsg->perm = VHOST_ACCESS_WO;
         break;
     case IOMMU_RW:
-        imsg.perm = VHOST_ACCESS_RW;
+        imsg->perm = VHOST_ACCESS_RW;
         break;
     default:
         return -EINVAL;
     }
 
+    return 0;
+}
+
+int vhost_backend_update_device_iotlb(struct vhost_dev *dev,
+                                             uint64_t iova, uint64_t uaddr,
+                                             uint64_t len,
+                                             IOMMUAccessFlags perm)
+{
+    struct vhost_iotlb_msg imsg;
+    int ret;
+
+    ret = vhost_backend_fill_device_iotlb_update(&imsg, iova, uaddr, len,
+                                                 perm);
+    if (ret) {
+        return ret;
+    }
+
     if (dev->vhost_ops && dev->vhost_ops->vhost_send_device_iotlb_msg)
         return dev->vhost_ops->vhost_send_device_iotlb_msg(dev, &imsg);
 
@@ -34,6 +34,9 @@ struct VhostIOVATree {
 
     /* GPA->IOVA address memory maps */
     IOVATree *gpa_iova_map;
+
+    /* Incremented whenever a map is removed */
+    uint64_t generation;
 };
 
 /**
@@ -52,6 +55,7 @@ VhostIOVATree *vhost_iova_tree_new(hwaddr iova_first, hwaddr iova_last)
     tree->iova_taddr_map = iova_tree_new();
     tree->iova_map = iova_tree_new();
     tree->gpa_iova_map = gpa_tree_new();
+    tree->generation = 0;
     return tree;
 }
 
@@ -126,6 +130,7 @@ void vhost_iova_tree_remove(VhostIOVATree *iova_tree, DMAMap map)
 {
     iova_tree_remove(iova_tree->iova_taddr_map, map);
     iova_tree_remove(iova_tree->iova_map, map);
+    iova_tree->generation++;
 }
 
 /**
@@ -188,4 +193,18 @@ void vhost_iova_tree_remove_gpa(VhostIOVATree *iova_tree, DMAMap map)
 {
     iova_tree_remove(iova_tree->gpa_iova_map, map);
     iova_tree_remove(iova_tree->iova_map, map);
+    iova_tree->generation++;
+}
+
+/**
+ * Return the generation of the tree
+ *
+ * @iova_tree: The iova tree
+ *
+ * The generation changes every time a map is removed, so a copy of a map
+ * that was looked up is still valid as long as the generation is the same.
+ */
+uint64_t vhost_iova_tree_generation(const VhostIOVATree *iova_tree)
+{
+    return iova_tree->generation;
 }
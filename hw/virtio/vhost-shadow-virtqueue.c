@@ -71,6 +71,38 @@ uint16_t vhost_svq_available_slots(const VhostShadowVirtqueue *svq)
     return svq->num_free;
 }
 
+/*
+ * Return the cached map if it contains all of @needle and no map was
+ * removed from the IOVA tree since it was looked up.
+ */
+static const DMAMap *vhost_svq_cache_lookup(const VhostShadowVirtqueue *svq,
+                                            const SVQTranslationCache *cache,
+                                            const DMAMap *needle)
+{
+    hwaddr start = cache->map.translated_addr;
+
+    if (!cache->valid ||
+        cache->generation != vhost_iova_tree_generation(svq->iova_tree)) {
+        return NULL;
+    }
+    if (needle->translated_addr < start ||
+        needle->translated_addr - start > cache->map.size ||
+        needle->size - 1 > cache->map.size -
+                           (needle->translated_addr - start)) {
+        return NULL;
+    }
+    return &cache->map;
+}
+
+static void vhost_svq_cache_update(const VhostShadowVirtqueue *svq,
+                                   SVQTranslationCache *cache,
+                                   const DMAMap *map)
+{
+    cache->map = *map;
+    cache->generation = vhost_iova_tree_generation(svq->iova_tree);
+    cache->valid = true;
+}
+
 /**
  * Translate addresses between the qemu's virtual address and the SVQ IOVA
  *
@@ -79,11 +111,16 @@ uint16_t vhost_svq_available_slots(const VhostShadowVirtqueue *svq)
  * @iovec: Source qemu's VA addresses
  * @num: Length of iovec and minimum length of vaddr
  * @gpas: Descriptors' GPAs, if backed by guest memory
+ *
+ * Consecutive descriptors usually fall in the same memory region, so the
+ * last map found is remembered and tried before searching the tree.
  */
-static bool vhost_svq_translate_addr(const VhostShadowVirtqueue *svq,
+static bool vhost_svq_translate_addr(VhostShadowVirtqueue *svq,
                                      hwaddr *addrs, const struct iovec *iovec,
                                      size_t num, const hwaddr *gpas)
 {
+    SVQTranslationCache *cache = gpas ? &svq->gpa_cache : &svq->hva_cache;
+
     if (num == 0) {
         return true;
     }
@@ -101,14 +138,20 @@ static bool vhost_svq_translate_addr(const VhostShadowVirtqueue *svq,
                 .translated_addr = gpas[i],
                 .size = iovec[i].iov_len,
             };
-            map = vhost_iova_tree_find_gpa(svq->iova_tree, &needle);
+            map = vhost_svq_cache_lookup(svq, cache, &needle);
+            if (!map) {
+                map = vhost_iova_tree_find_gpa(svq->iova_tree, &needle);
+            }
         } else {
             /* Search the IOVA->HVA tree */
             needle = (DMAMap) {
                 .translated_addr = (hwaddr)(uintptr_t)iovec[i].iov_base,
                 .size = iovec[i].iov_len,
             };
-            map = vhost_iova_tree_find_iova(svq->iova_tree, &needle);
+            map = vhost_svq_cache_lookup(svq, cache, &needle);
+            if (!map) {
+                map = vhost_iova_tree_find_iova(svq->iova_tree, &needle);
+            }
         }
 
         /*
@@ -133,6 +176,10 @@ static bool vhost_svq_translate_addr(const VhostShadowVirtqueue *svq,
                           "Guest buffer expands over iova range");
             return false;
         }
+
+        if (map != &cache->map) {
+            vhost_svq_cache_update(svq, cache, map);
+        }
     }
 
     return true;
@@ -198,7 +245,13 @@ static bool vhost_svq_add_split(VhostShadowVirtqueue *svq,
     unsigned avail_idx;
     vring_avail_t *avail = svq->vring.avail;
     bool ok;
-    g_autofree hwaddr *sgs = g_new(hwaddr, MAX(out_num, in_num));
+    hwaddr sgs_buf[16];
+    g_autofree hwaddr *sgs_heap = NULL;
+    hwaddr *sgs = sgs_buf;
+
+    if (MAX(out_num, in_num) > ARRAY_SIZE(sgs_buf)) {
+        sgs = sgs_heap = g_new(hwaddr, MAX(out_num, in_num));
+    }
 
     *head = svq->free_head;
 
@@ -249,12 +302,14 @@ static void vhost_svq_kick(VhostShadowVirtqueue *svq)
     if (virtio_vdev_has_feature(svq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
         uint16_t avail_event = le16_to_cpu(
                 *(uint16_t *)(&svq->vring.used->ring[svq->vring.num]));
-        needs_kick = vring_need_event(avail_event, svq->shadow_avail_idx, svq->shadow_avail_idx - 1);
+        needs_kick = vring_need_event(avail_event, svq->shadow_avail_idx,
+                                      svq->kicked_avail_idx);
     } else {
         needs_kick =
                 !(svq->vring.used->flags & cpu_to_le16(VRING_USED_F_NO_NOTIFY));
     }
 
+    svq->kicked_avail_idx = svq->shadow_avail_idx;
     if (!needs_kick) {
         return;
     }
@@ -289,7 +344,9 @@ int vhost_svq_add(VhostShadowVirtqueue *svq, const struct iovec *out_sg,
     svq->num_free -= ndescs;
     svq->desc_state[qemu_head].elem = elem;
     svq->desc_state[qemu_head].ndescs = ndescs;
-    vhost_svq_kick(svq);
+    if (!svq->defer_kick) {
+        vhost_svq_kick(svq);
+    }
     return 0;
 }
 
@@ -314,11 +371,8 @@ static int vhost_svq_add_element(VhostShadowVirtqueue *svq,
  * If that happens, guest's kick notifications will be disabled until the
  * device uses some buffers.
  */
-static void vhost_handle_guest_kick(VhostShadowVirtqueue *svq)
+static void vhost_svq_forward_avail(VhostShadowVirtqueue *svq)
 {
-    /* Clear event notifier */
-    event_notifier_test_and_clear(&svq->svq_kick);
-
     /* Forward to the device as many available buffers as possible */
     do {
         virtio_queue_set_notification(svq->vq, false);
@@ -369,6 +423,27 @@ static void vhost_handle_guest_kick(VhostShadowVirtqueue *svq)
     } while (!virtio_queue_empty(svq->vq));
 }
 
+static void vhost_handle_guest_kick(VhostShadowVirtqueue *svq)
+{
+    /* Clear event notifier */
+    event_notifier_test_and_clear(&svq->svq_kick);
+
+    /*
+     * Notify the device once for all the buffers the guest made available
+     * rather than once per buffer.  Callers with their own avail_handler
+     * may wait for the device to use a buffer, so they keep kicking every
+     * time.
+     */
+    svq->defer_kick = !svq->ops;
+    vhost_svq_forward_avail(svq);
+    if (svq->defer_kick) {
+        svq->defer_kick = false;
+        if (svq->shadow_avail_idx != svq->kicked_avail_idx) {
+            vhost_svq_kick(svq);
+        }
+    }
+}
+
 /**
  * Handle guest's kick.
  *
@@ -687,6 +762,10 @@ void vhost_svq_start(VhostShadowVirtqueue *svq, VirtIODevice *vdev,
     event_notifier_set_handler(&svq->hdev_call, vhost_svq_handle_call);
     svq->next_guest_avail_elem = NULL;
     svq->shadow_avail_idx = 0;
+    svq->kicked_avail_idx = 0;
+    svq->defer_kick = false;
+    svq->gpa_cache.valid = false;
+    svq->hva_cache.valid = false;
     svq->shadow_used_idx = 0;
     svq->last_used_idx = 0;
     svq->vdev = vdev;
@@ -25,6 +25,14 @@ typedef struct SVQDescState {
     unsigned int ndescs;
 } SVQDescState;
 
+/* Last map used to translate a descriptor, see vhost_svq_translate_addr() */
+typedef struct SVQTranslationCache {
+    DMAMap map;
+    /* VhostIOVATree generation at the time map was looked up */
+    uint64_t generation;
+    bool valid;
+} SVQTranslationCache;
+
 typedef struct VhostShadowVirtqueue VhostShadowVirtqueue;
 
 /**
@@ -78,6 +86,10 @@ typedef struct VhostShadowVirtqueue {
     /* IOVA mapping */
     VhostIOVATree *iova_tree;
 
+    /* Last GPA->IOVA and HVA->IOVA maps hit by a descriptor */
+    SVQTranslationCache gpa_cache;
+    SVQTranslationCache hva_cache;
+
     /* SVQ vring descriptors state */
     SVQDescState *desc_state;
 
@@ -99,6 +111,12 @@ typedef struct VhostShadowVirtqueue {
     /* Next head to expose to the device */
     uint16_t shadow_avail_idx;
 
+    /* shadow_avail_idx when the device was last considered for a kick */
+    uint16_t kicked_avail_idx;
+
+    /* Kicks are deferred until the guest's available buffers are added */
+    bool defer_kick;
+
     /* Next free descriptor */
     uint16_t free_head;
 
@@ -335,16 +335,16 @@ static int vhost_user_read(struct vhost_dev *dev, VhostUserMsg *msg)
     return 0;
 }
 
-static int process_message_reply(struct vhost_dev *dev,
-                                 const VhostUserMsg *msg)
+/*
+ * Read the REPLY_ACK for @msg.  A negative return value means the channel
+ * is unusable; otherwise the backend's status is stored in @status.
+ */
+static int vhost_user_read_ack(struct vhost_dev *dev,
+                               const VhostUserMsg *msg, uint64_t *status)
 {
     int ret;
     VhostUserMsg msg_reply;
 
-    if ((msg->hdr.flags & VHOST_USER_NEED_REPLY_MASK) == 0) {
-        return 0;
-    }
-
     ret = vhost_user_read(dev, &msg_reply);
     if (ret < 0) {
         return ret;
@@ -357,7 +357,38 @@ static int process_message_reply(struct vhost_dev *dev,
         return -EPROTO;
     }
 
-    return msg_reply.payload.u64 ? -EIO : 0;
+    *status = msg_reply.payload.u64;
+    return 0;
+}
+
+static int process_message_reply(struct vhost_dev *dev,
+                                 const VhostUserMsg *msg)
+{
+    uint64_t status;
+    int ret;
+
+    if ((msg->hdr.flags & VHOST_USER_NEED_REPLY_MASK) == 0) {
+        return 0;
+    }
+
+    ret = vhost_user_read_ack(dev, msg, &status);
+    if (ret < 0) {
+        return ret;
+    }
+
+    return status ? -EIO : 0;
+}
+
+/*
+ * Whether several requests with need_reply set may be sent before reading
+ * the first reply.
+ */
+static bool vhost_user_pipeline_supported(struct vhost_dev *dev)
+{
+    return virtio_has_feature(dev->protocol_features,
+                              VHOST_USER_PROTOCOL_F_REPLY_ACK) &&
+           virtio_has_feature(dev->protocol_features,
+                              VHOST_USER_PROTOCOL_F_PIPELINED_REPLY);
 }
 
 static bool vhost_user_per_device_request(VhostUserRequest request)
@@ -656,6 +687,16 @@ static void scrub_shadow_regions(struct vhost_dev *dev,
     *nr_add_reg = add_idx;
 }
 
+static void vhost_user_remove_shadow_region(struct vhost_user *u,
+                                            int shadow_reg_idx)
+{
+    memmove(&u->shadow_regions[shadow_reg_idx],
+            &u->shadow_regions[shadow_reg_idx + 1],
+            sizeof(struct vhost_memory_region) *
+            (u->num_shadow_regions - shadow_reg_idx - 1));
+    u->num_shadow_regions--;
+}
+
 static int send_remove_regions(struct vhost_dev *dev,
                                struct scrub_regions *remove_reg,
                                int nr_rem_reg, VhostUserMsg *msg,
@@ -663,22 +704,28 @@ static int send_remove_regions(struct vhost_dev *dev,
 {
     struct vhost_user *u = dev->opaque;
     struct vhost_memory_region *shadow_reg;
-    int i, fd, shadow_reg_idx, ret;
+    int i, fd, ret, nack = 0;
     ram_addr_t offset;
     VhostUserMemoryRegion region_buffer;
+    bool sent[VHOST_USER_MAX_RAM_SLOTS];
+    bool pipeline = reply_supported && vhost_user_pipeline_supported(dev) &&
+                    (msg->hdr.flags & VHOST_USER_NEED_REPLY_MASK);
 
     /*
      * The regions in remove_reg appear in the same order they do in the
      * shadow table. Therefore we can minimize memory copies by iterating
      * through remove_reg backwards.
+     *
+     * If the backend allows it, all the removals are sent before waiting
+     * for any reply, which costs one round trip instead of one per region.
      */
     for (i = nr_rem_reg - 1; i >= 0; i--) {
         shadow_reg = remove_reg[i].region;
-        shadow_reg_idx = remove_reg[i].reg_idx;
 
         vhost_user_get_mr_data(shadow_reg->userspace_addr, &offset, &fd);
 
-        if (fd > 0) {
+        sent[i] = fd > 0;
+        if (sent[i]) {
             msg->hdr.request = VHOST_USER_REM_MEM_REG;
             vhost_user_fill_msg_region(&region_buffer, shadow_reg, 0);
             msg->payload.mem_reg.region = region_buffer;
@@ -687,12 +734,16 @@ static int send_remove_regions(struct vhost_dev *dev,
             if (ret < 0) {
                 return ret;
             }
+        }
 
-            if (reply_supported) {
-                ret = process_message_reply(dev, msg);
-                if (ret) {
-                    return ret;
-                }
+        if (pipeline) {
+            continue;
+        }
+
+        if (sent[i] && reply_supported) {
+            ret = process_message_reply(dev, msg);
+            if (ret) {
+                return ret;
             }
         }
 
@@ -700,14 +751,44 @@ static int send_remove_regions(struct vhost_dev *dev,
          * At this point we know the backend has unmapped the region. It is now
          * safe to remove it from the shadow table.
          */
-        memmove(&u->shadow_regions[shadow_reg_idx],
-                &u->shadow_regions[shadow_reg_idx + 1],
-                sizeof(struct vhost_memory_region) *
-                (u->num_shadow_regions - shadow_reg_idx - 1));
-        u->num_shadow_regions--;
+        vhost_user_remove_shadow_region(u, remove_reg[i].reg_idx);
     }
 
-    return 0;
+    if (!pipeline) {
+        return 0;
+    }
+
+    for (i = nr_rem_reg - 1; i >= 0; i--) {
+        if (sent[i]) {
+            uint64_t status;
+
+            ret = vhost_user_read_ack(dev, msg, &status);
+            if (ret < 0) {
+                return ret;
+            }
+            if (status) {
+                /* Keep reading, the other replies are still queued */
+                nack = -EIO;
+                continue;
+            }
+        }
+
+        vhost_user_remove_shadow_region(u, remove_reg[i].reg_idx);
+    }
+
+    return nack;
+}
+
+static void vhost_user_add_shadow_region(struct vhost_user *u,
+                                         struct vhost_memory_region *reg)
+{
+    u->shadow_regions[u->num_shadow_regions].guest_phys_addr =
+        reg->guest_phys_addr;
+    u->shadow_regions[u->num_shadow_regions].userspace_addr =
+        reg->userspace_addr;
+    u->shadow_regions[u->num_shadow_regions].memory_size =
+        reg->memory_size;
+    u->num_shadow_regions++;
 }
 
 static int send_add_regions(struct vhost_dev *dev,
@@ -716,13 +797,21 @@ static int send_add_regions(struct vhost_dev *dev,
                             bool reply_supported, bool track_ramblocks)
 {
     struct vhost_user *u = dev->opaque;
-    int i, fd, ret, reg_idx, reg_fd_idx;
+    int i, fd, ret, reg_idx, reg_fd_idx, nack = 0;
     struct vhost_memory_region *reg;
     MemoryRegion *mr;
     ram_addr_t offset;
     VhostUserMsg msg_reply;
     VhostUserMemoryRegion region_buffer;
+    bool ack_pending[VHOST_USER_MAX_RAM_SLOTS] = {};
+    bool pipeline = reply_supported && !track_ramblocks &&
+                    vhost_user_pipeline_supported(dev);
 
+    /*
+     * If the backend allows it, and unless postcopy needs each reply before
+     * going on, all the additions are sent first and their acks are
+     * collected afterwards.
+     */
     for (i = 0; i < nr_add_reg; i++) {
         reg = add_reg[i].region;
         reg_idx = add_reg[i].reg_idx;
@@ -793,6 +882,10 @@ static int send_add_regions(struct vhost_dev *dev,
                                  dev->mem->regions[reg_idx].guest_phys_addr);
                     return -EPROTO;
                 }
+            } else if (pipeline &&
+                       (msg->hdr.flags & VHOST_USER_NEED_REPLY_MASK)) {
+                ack_pending[i] = true;
+                continue;
             } else if (reply_supported) {
                 ret = process_message_reply(dev, msg);
                 if (ret) {
@@ -810,16 +903,30 @@ static int send_add_regions(struct vhost_dev *dev,
          *
          * The region should now be added to the shadow table.
          */
-        u->shadow_regions[u->num_shadow_regions].guest_phys_addr =
-            reg->guest_phys_addr;
-        u->shadow_regions[u->num_shadow_regions].userspace_addr =
-            reg->userspace_addr;
-        u->shadow_regions[u->num_shadow_regions].memory_size =
-            reg->memory_size;
-        u->num_shadow_regions++;
+        vhost_user_add_shadow_region(u, reg);
     }
 
-    return 0;
+    for (i = 0; i < nr_add_reg; i++) {
+        uint64_t status;
+
+        if (!ack_pending[i]) {
+            continue;
+        }
+
+        msg->hdr.request = VHOST_USER_ADD_MEM_REG;
+        ret = vhost_user_read_ack(dev, msg, &status);
+        if (ret < 0) {
+            return ret;
+        }
+        if (status) {
+            /* Keep reading, the other replies are still queued */
+            nack = -EIO;
+            continue;
+        }
+        vhost_user_add_shadow_region(u, add_reg[i].region);
+    }
+
+    return nack;
 }
 
 static int vhost_user_add_remove_regions(struct vhost_dev *dev,
@@ -2415,23 +2522,66 @@ static int vhost_user_net_set_mtu(struct vhost_dev *dev, uint16_t mtu)
     return 0;
 }
 
-static int vhost_user_send_device_iotlb_msg(struct vhost_dev *dev,
-                                            struct vhost_iotlb_msg *imsg)
+/*
+ * If the backend allows it, all messages are written before the first ack
+ * is read, so that a batch costs a single round trip to the backend.
+ */
+static int vhost_user_send_device_iotlb_msgs(struct vhost_dev *dev,
+                                             struct vhost_iotlb_msg *imsgs,
+                                             unsigned int n)
 {
-    int ret;
     VhostUserMsg msg = {
         .hdr.request = VHOST_USER_IOTLB_MSG,
         .hdr.size = sizeof(msg.payload.iotlb),
         .hdr.flags = VHOST_USER_VERSION | VHOST_USER_NEED_REPLY_MASK,
-        .payload.iotlb = *imsg,
     };
+    bool pipeline = vhost_user_pipeline_supported(dev);
+    unsigned int i;
+    int ret, nack = 0;
 
-    ret = vhost_user_write(dev, &msg, NULL, 0);
-    if (ret < 0) {
-        return ret;
+    for (i = 0; i < n; i++) {
+        msg.payload.iotlb = imsgs[i];
+        ret = vhost_user_write(dev, &msg, NULL, 0);
+        if (ret < 0) {
+            return ret;
+        }
+
+        if (!pipeline) {
+            ret = process_message_reply(dev, &msg);
+            if (ret) {
+                return ret;
+            }
+        }
     }
 
-    return process_message_reply(dev, &msg);
+    if (!pipeline) {
+        return 0;
+    }
+
+    for (i = 0; i < n; i++) {
+        uint64_t status;
+
+        ret = vhost_user_read_ack(dev, &msg, &status);
+        if (ret < 0) {
+            return ret;
+        }
+        if (status) {
+            nack = -EIO;
+        }
+    }
+
+    return nack;
+}
+
+static int vhost_user_send_device_iotlb_msg(struct vhost_dev *dev,
+                                            struct vhost_iotlb_msg *imsg)
+{
+    return vhost_user_send_device_iotlb_msgs(dev, imsg, 1);
+}
+
+static bool vhost_user_can_batch_device_iotlb(struct vhost_dev *dev)
+{
+    return vhost_user_pipeline_supported(dev);
 }
 
 
@@ -3048,6 +3198,8 @@ const VhostOps user_ops = {
         .vhost_net_set_mtu = vhost_user_net_set_mtu,
         .vhost_set_iotlb_callback = vhost_user_set_iotlb_callback,
         .vhost_send_device_iotlb_msg = vhost_user_send_device_iotlb_msg,
+        .vhost_send_device_iotlb_msgs = vhost_user_send_device_iotlb_msgs,
+        .vhost_can_batch_device_iotlb = vhost_user_can_batch_device_iotlb,
         .vhost_get_config = vhost_user_get_config,
         .vhost_set_config = vhost_user_set_config,
         .vhost_crypto_create_session = vhost_user_crypto_create_session,
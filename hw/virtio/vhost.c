@@ -1212,6 +1212,59 @@ static int vhost_memory_region_lookup(struct vhost_dev *hdev,
     return -EFAULT;
 }
 
+/* Translations sent to the backend for one miss, including the missing one */
+#define VHOST_IOTLB_PREFETCH 8
+
+/*
+ * Backends that take several IOTLB updates in one round trip also get the
+ * mapped pages that follow the missing one, so that a device walking a
+ * buffer does not fault on every IOMMU page.  Called with the RCU read
+ * lock held.
+ */
+static int vhost_device_iotlb_prefetch(struct vhost_dev *dev, uint64_t iova,
+                                       uint64_t uaddr, uint64_t len,
+                                       IOMMUAccessFlags perm, int write)
+{
+    struct vhost_iotlb_msg imsgs[VHOST_IOTLB_PREFETCH];
+    unsigned int n = 0;
+    int ret;
+
+    ret = vhost_backend_fill_device_iotlb_update(&imsgs[n++], iova, uaddr,
+                                                 len, perm);
+    if (ret) {
+        return ret;
+    }
+
+    while (n < VHOST_IOTLB_PREFETCH) {
+        uint64_t next = iova + len;
+        IOMMUTLBEntry iotlb;
+
+        if (next < iova) {
+            break;
+        }
+
+        iotlb = address_space_get_iotlb_entry(dev->vdev->dma_as, next, write,
+                                              MEMTXATTRS_UNSPECIFIED);
+        /* Only whole IOMMU pages, so that entries never overlap */
+        if (iotlb.target_as == NULL || (next & iotlb.addr_mask) ||
+            vhost_memory_region_lookup(dev, iotlb.translated_addr,
+                                       &uaddr, &len)) {
+            break;
+        }
+
+        iova = next;
+        len = MIN(iotlb.addr_mask + 1, len);
+        if (vhost_backend_fill_device_iotlb_update(&imsgs[n], iova, uaddr,
+                                                   len, iotlb.perm)) {
+            break;
+        }
+        n++;
+    }
+
+    trace_vhost_iotlb_prefetch(dev, imsgs[0].iova, n);
+    return dev->vhost_ops->vhost_send_device_iotlb_msgs(dev, imsgs, n);
+}
+
 int vhost_device_iotlb_miss(struct vhost_dev *dev, uint64_t iova, int write)
 {
     IOMMUTLBEntry iotlb;
@@ -1238,8 +1291,14 @@ int vhost_device_iotlb_miss(struct vhost_dev *dev, uint64_t iova, int write)
         len = MIN(iotlb.addr_mask + 1, len);
         iova = iova & ~iotlb.addr_mask;
 
-        ret = vhost_backend_update_device_iotlb(dev, iova, uaddr,
-                                                len, iotlb.perm);
+        if (dev->vhost_ops->vhost_can_batch_device_iotlb &&
+            dev->vhost_ops->vhost_can_batch_device_iotlb(dev)) {
+            ret = vhost_device_iotlb_prefetch(dev, iova, uaddr, len,
+                                              iotlb.perm, write);
+        } else {
+            ret = vhost_backend_update_device_iotlb(dev, iova, uaddr,
+                                                    len, iotlb.perm);
+        }
         if (ret) {
             trace_vhost_iotlb_miss(dev, 4);
             error_report("Fail to update device iotlb");
@@ -1198,6 +1198,22 @@ void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
     virtqueue_flush(vq, 1);
 }
 
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement *const *elems,
+                          const unsigned int *lens, unsigned int count)
+{
+    unsigned int i;
+
+    if (!count) {
+        return;
+    }
+
+    RCU_READ_LOCK_GUARD();
+    for (i = 0; i < count; i++) {
+        virtqueue_fill(vq, elems[i], lens ? lens[i] : 0, i);
+    }
+    virtqueue_flush(vq, count);
+}
+
 /* Called within rcu_read_lock().  */
 static int virtqueue_num_heads(VirtQueue *vq, unsigned int idx)
 {
@@ -1701,7 +1717,12 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     return elem;
 }
 
-static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+/*
+ * With @set_avail_event false the caller must publish the avail event index
+ * itself once done popping, see virtqueue_pop_batch().
+ */
+static void *virtqueue_split_pop(VirtQueue *vq, size_t sz,
+                                 bool set_avail_event)
 {
     unsigned int i, head, max, idx;
     VRingMemoryRegionCaches *caches;
@@ -1740,7 +1761,8 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         goto done;
     }
 
-    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+    if (set_avail_event &&
+        virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
         vring_set_avail_event(vq, vq->last_avail_idx);
     }
 
@@ -2007,8 +2029,61 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
     if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
         return virtqueue_packed_pop(vq, sz);
     } else {
-        return virtqueue_split_pop(vq, sz);
+        return virtqueue_split_pop(vq, sz, true);
+    }
+}
+
+static unsigned int virtqueue_split_pop_batch(VirtQueue *vq, size_t sz,
+                                              void **elems, unsigned int max)
+{
+    bool event_idx = virtio_vdev_has_feature(vq->vdev,
+                                             VIRTIO_RING_F_EVENT_IDX);
+    unsigned int n = 0;
+
+    RCU_READ_LOCK_GUARD();
+    for (;;) {
+        while (n < max && (elems[n] = virtqueue_split_pop(vq, sz, false))) {
+            n++;
+        }
+        if (!n || !event_idx || virtio_device_disabled(vq->vdev)) {
+            return n;
+        }
+
+        /*
+         * Publish the avail event index once for the whole batch instead of
+         * once per element.  The driver might have skipped a notification
+         * because it saw the old value, so check again for buffers that
+         * were made available in the meantime.
+         */
+        vring_set_avail_event(vq, vq->last_avail_idx);
+        if (n == max) {
+            return n;
+        }
+        smp_mb();
+        if (virtio_queue_empty_rcu(vq)) {
+            return n;
+        }
+    }
+}
+
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max)
+{
+    unsigned int n = 0;
+
+    if (virtio_device_disabled(vq->vdev)) {
+        return 0;
+    }
+
+    if (!virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        return virtqueue_split_pop_batch(vq, sz, elems, max);
+    }
+
+    RCU_READ_LOCK_GUARD();
+    while (n < max && (elems[n] = virtqueue_packed_pop(vq, sz))) {
+        n++;
     }
+    return n;
 }
 
 static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
@@ -4104,7 +4179,7 @@ static const Property virtio_properties[] = {
                      disable_legacy_check, false),
 };
 
-static int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev)
+int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev)
 {
     VirtioBusState *qbus = VIRTIO_BUS(qdev_get_parent_bus(DEVICE(vdev)));
     int i, n, r, err;
@@ -4174,7 +4249,7 @@ int virtio_device_start_ioeventfd(VirtIODevice *vdev)
     return virtio_bus_start_ioeventfd(vbus);
 }
 
-static void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev)
+void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev)
 {
     VirtioBusState *qbus = VIRTIO_BUS(qdev_get_parent_bus(DEVICE(vdev)));
     int n, r;
@@ -21,6 +21,7 @@
 #include "qemu/queue.h"
 #include "qemu/event_notifier.h"
 #include "qemu/lockcnt.h"
+#include "qemu/seqlock.h"
 #include "qemu/thread.h"
 #include "qemu/timer.h"
 #include "block/graph-lock.h"
@@ -335,6 +336,17 @@ struct AioContext {
     /* AIO engine parameters */
     int64_t aio_max_batch;  /* maximum number of requests in a batch */
 
+    /*
+     * Nanoseconds spent in blocking aio_poll() waiting for events, either
+     * busy polling or sleeping, and the start of the wait in progress or
+     * 0.  The latter keeps a thread that sleeps for a long time from being
+     * reported as busy.  Written only by the event loop thread under
+     * idle_seqlock, see aio_context_get_idle_ns().
+     */
+    int64_t idle_ns;
+    int64_t idle_since_ns;
+    QemuSeqLock idle_seqlock;
+
     /*
      * List of handlers participating in userspace polling.  Protected by
      * ctx->list_lock.  Iterated and modified mostly by the event loop thread
@@ -812,6 +824,35 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
  */
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch);
 
+/**
+ * aio_context_idle_begin:
+ * @ctx: the aio context
+ * @start: QEMU_CLOCK_REALTIME time at which the wait starts
+ *
+ * Called by blocking aio_poll() before it waits for events.  Must be
+ * followed by aio_context_idle_end() once the wait is over.
+ */
+void aio_context_idle_begin(AioContext *ctx, int64_t start);
+
+/**
+ * aio_context_idle_end:
+ * @ctx: the aio context
+ *
+ * Returns: how long the wait took, in nanoseconds
+ */
+int64_t aio_context_idle_end(AioContext *ctx);
+
+/**
+ * aio_context_get_idle_ns:
+ * @ctx: the aio context
+ * @now: set to the QEMU_CLOCK_REALTIME time that the result refers to
+ *
+ * Return how long @ctx has waited for events in blocking aio_poll(),
+ * including a wait that is still in progress.  May be called from any
+ * thread; successive calls never return less than an earlier one.
+ */
+int64_t aio_context_get_idle_ns(AioContext *ctx, int64_t *now);
+
 /**
  * aio_context_set_thread_pool_params:
  * @ctx: the aio context
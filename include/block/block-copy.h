@@ -36,6 +36,16 @@ void block_copy_set_copy_opts(BlockCopyState *s, bool use_copy_range,
                               bool compress);
 void block_copy_set_progress_meter(BlockCopyState *s, ProgressMeter *pm);
 
+/*
+ * Tune chunk size and parallelism from the observed throughput and latency
+ * of the copy operations.  @max_workers and @max_chunk (zero means no
+ * limit) bound the values chosen.  With compression, the chunk size stays
+ * at the cluster size.  Must be called after block_copy_set_copy_opts() and
+ * prior any actual copy request.
+ */
+void block_copy_set_adaptive(BlockCopyState *s, int max_workers,
+                             int64_t max_chunk);
+
 void block_copy_state_free(BlockCopyState *s);
 
 void block_copy_reset(BlockCopyState *s, int64_t offset, int64_t bytes);
@@ -99,6 +109,10 @@ void block_copy_call_cancel(BlockCopyCallState *call_state);
 
 BdrvDirtyBitmap *block_copy_dirty_bitmap(BlockCopyState *s);
 int64_t block_copy_cluster_size(BlockCopyState *s);
+/* Chunk size of the most recently started copy operation */
+int64_t block_copy_chunk(BlockCopyState *s);
+/* Current number of parallel workers chosen in adaptive mode, else 0 */
+int block_copy_adaptive_workers(BlockCopyState *s);
 void block_copy_set_skip_unallocated(BlockCopyState *s, bool skip);
 
 #endif /* BLOCK_COPY_H */
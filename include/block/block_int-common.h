@@ -28,6 +28,7 @@
 #include "block/block-common.h"
 #include "block/block-global-state.h"
 #include "block/snapshot.h"
+#include "qemu/interval-tree.h"
 #include "qemu/iov.h"
 #include "qemu/rcu.h"
 #include "qemu/stats64.h"
@@ -1079,21 +1080,26 @@ struct BdrvChild {
 };
 
 /*
- * Allows bdrv_co_block_status() to cache one data region for a
- * protocol node.
+ * Allows bdrv_co_block_status() to cache data regions of a protocol node,
+ * so that repeated inquiries over the same ranges (e.g. from block jobs or
+ * NBD exports) can be answered without asking the driver again.
  *
- * @valid: Whether the cache is valid (should be accessed with atomic
- *         functions so this can be reset by RCU readers)
- * @data_start: Offset where we know (or strongly assume) is data
- * @data_end: Offset where the data region ends (which is not necessarily
- *            the start of a zeroed region)
+ * Lookups only take an RCU read guard.  Writers take @lock, and free
+ * regions that they drop only after a grace period.
+ *
+ * @lock: Serializes writers
+ * @extents: Cached data regions, which never overlap or adjoin each other
+ * @clock: The same regions, in the order in which the CLOCK eviction
+ *         algorithm visits them
+ * @clock_hand: Next region to be visited in @clock, NULL for the first
+ * @nb_extents: Number of cached data regions
  */
 typedef struct BdrvBlockStatusCache {
-    struct rcu_head rcu;
-
-    bool valid;
-    int64_t data_start;
-    int64_t data_end;
+    QemuMutex lock;
+    IntervalTreeRoot extents;
+    QTAILQ_HEAD(, BdrvBlockStatusExtent) clock;
+    struct BdrvBlockStatusExtent *clock_hand;
+    unsigned int nb_extents;
 } BdrvBlockStatusCache;
 
 struct BlockDriverState {
@@ -1277,9 +1283,7 @@ struct BlockDriverState {
     /* BdrvChild links to this node may never be frozen */
     bool never_freeze;
 
-    /* Lock for block-status cache RCU writers */
-    CoMutex bsc_modify_lock;
-    /* Always non-NULL, but must only be dereferenced under an RCU read guard */
+    /* Always non-NULL while the node is open */
     BdrvBlockStatusCache *block_status_cache;
 
     /* array of write pointers' location of each zone in the zoned device. */
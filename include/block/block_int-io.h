@@ -166,19 +166,19 @@ bdrv_primary_bs(BlockDriverState *bs)
 }
 
 /**
- * Check whether the given offset is in the cached block-status data
- * region.
+ * Check whether the given offset is in one of the cached block-status
+ * data regions.
  *
- * If it is, and @pnum is not NULL, *pnum is set to
- * `bsc.data_end - offset`, i.e. how many bytes, starting from
- * @offset, are data (according to the cache).
+ * If it is, and @pnum is not NULL, *pnum is set to how many bytes,
+ * starting from @offset, are data (according to the cache), up to the
+ * end of that region.
  * Otherwise, *pnum is not touched.
  */
 bool bdrv_bsc_is_data(BlockDriverState *bs, int64_t offset, int64_t *pnum);
 
 /**
- * If [offset, offset + bytes) overlaps with the currently cached
- * block-status region, invalidate the cache.
+ * Drop [offset, offset + bytes) from the cached block-status data
+ * regions; parts of the regions outside of that range stay cached.
  *
  * (To be used by I/O paths that cause data regions to be zero or
  * holes.)
@@ -187,7 +187,8 @@ void bdrv_bsc_invalidate_range(BlockDriverState *bs,
                                int64_t offset, int64_t bytes);
 
 /**
- * Mark the range [offset, offset + bytes) as a data region.
+ * Mark the range [offset, offset + bytes) as a data region.  If the cache
+ * is full, a region that was not used recently is evicted.
  */
 void bdrv_bsc_fill(BlockDriverState *bs, int64_t offset, int64_t bytes);
 
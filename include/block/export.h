@@ -48,6 +48,9 @@ typedef struct BlockExportDriver {
      * shutting down.
      */
     void (*request_shutdown)(BlockExport *);
+
+    /* Optional, fills in the export type specific part of @info */
+    void (*query)(BlockExport *, BlockExportInfo *info);
 } BlockExportDriver;
 
 struct BlockExport {
@@ -26,6 +26,7 @@
 #define THROTTLE_GROUPS_H
 
 #include "qemu/coroutine.h"
+#include "qemu/thread.h"
 #include "qemu/throttle.h"
 #include "qom/object.h"
 
@@ -49,6 +50,13 @@ typedef struct ThrottleGroupMember {
      */
     unsigned int restart_pending;
 
+    /* Capacity lent by the group, used to let requests through without
+     * taking the ThrottleGroup lock. credit_lock protects the credit and
+     * nests inside the ThrottleGroup lock.
+     */
+    QemuSpin       credit_lock;
+    ThrottleCredit credit[THROTTLE_MAX];
+
     /* The following fields are protected by the ThrottleGroup lock.
      * See the ThrottleGroup documentation for details.
      * throttle_state tells us if I/O limits are configured. */
@@ -119,6 +119,10 @@ typedef void (*vhost_set_iotlb_callback_op)(struct vhost_dev *dev,
                                            int enabled);
 typedef int (*vhost_send_device_iotlb_msg_op)(struct vhost_dev *dev,
                                               struct vhost_iotlb_msg *imsg);
+typedef int (*vhost_send_device_iotlb_msgs_op)(struct vhost_dev *dev,
+                                               struct vhost_iotlb_msg *imsgs,
+                                               unsigned int n);
+typedef bool (*vhost_can_batch_device_iotlb_op)(struct vhost_dev *dev);
 typedef int (*vhost_set_config_op)(struct vhost_dev *dev, const uint8_t *data,
                                    uint32_t offset, uint32_t size,
                                    uint32_t flags);
@@ -205,6 +209,12 @@ typedef struct VhostOps {
     vhost_vsock_set_running_op vhost_vsock_set_running;
     vhost_set_iotlb_callback_op vhost_set_iotlb_callback;
     vhost_send_device_iotlb_msg_op vhost_send_device_iotlb_msg;
+    /*
+     * Optional, for backends that can take several updates at once, which
+     * vhost_can_batch_device_iotlb() tells for a given device.
+     */
+    vhost_send_device_iotlb_msgs_op vhost_send_device_iotlb_msgs;
+    vhost_can_batch_device_iotlb_op vhost_can_batch_device_iotlb;
     vhost_get_config_op vhost_get_config;
     vhost_set_config_op vhost_set_config;
     vhost_crypto_create_session_op vhost_crypto_create_session;
@@ -222,6 +232,11 @@ typedef struct VhostOps {
     vhost_check_device_state_op vhost_check_device_state;
 } VhostOps;
 
+int vhost_backend_fill_device_iotlb_update(struct vhost_iotlb_msg *imsg,
+                                           uint64_t iova, uint64_t uaddr,
+                                           uint64_t len,
+                                           IOMMUAccessFlags perm);
+
 int vhost_backend_update_device_iotlb(struct vhost_dev *dev,
                                              uint64_t iova, uint64_t uaddr,
                                              uint64_t len,
@@ -22,6 +22,7 @@
 #include "qom/object.h"
 
 #include "ebpf/ebpf_rss.h"
+#include "qapi/qapi-types-virtio.h"
 
 #define TYPE_VIRTIO_NET "virtio-net-device"
 OBJECT_DECLARE_SIMPLE_TYPE(VirtIONet, VIRTIO_NET)
@@ -56,6 +57,8 @@ typedef struct virtio_net_conf
     char *duplex_str;
     uint8_t duplex;
     char *primary_id_str;
+    /* vqs index queue pairs rather than virtqueues */
+    IOThreadVirtQueueMappingList *iothread_vq_mapping_list;
 } virtio_net_conf;
 
 /* Coalesced packets type & status */
@@ -164,6 +167,12 @@ typedef struct VirtIONetQueue {
     struct {
         VirtQueueElement *elem;
     } async_tx;
+    /* rx buffers were used during a receive batch, notify at its end */
+    bool rx_notify_pending;
+    /* IOThread serving the queue pair, NULL while it runs in the main loop */
+    AioContext *ctx;
+    /* Bitmap of the queue pair's virtqueues being reset, rx is bit 0 */
+    uint8_t reset_vqs;
     struct VirtIONet *n;
 } VirtIONetQueue;
 
@@ -188,6 +197,11 @@ struct VirtIONet {
     uint8_t rsc6_enabled;
     uint8_t has_ufo;
     uint32_t mergeable_rx_bufs;
+    /*
+     * Protects mac, the rx mode flags, mac_table and vlans, which are
+     * read by receive_filter() in the IOThreads of iothread-vq-mapping.
+     */
+    QemuMutex rx_filter_lock;
     uint8_t promisc;
     uint8_t allmulti;
     uint8_t alluni;
@@ -231,6 +245,15 @@ struct VirtIONet {
     struct EBPFRSSContext ebpf_rss;
     uint32_t nr_ebpf_rss_fds;
     char **ebpf_rss_fds;
+    /* IOThread of each queue pair, from iothread-vq-mapping */
+    AioContext **vq_aio_context;
+    bool ioeventfd_started;
+    bool dataplane_started;
+    bool dataplane_fenced;
+    /* vdev->use_guest_notifier_mask while the dataplane clears it */
+    bool dataplane_saved_notifier_mask;
+    /* Nesting depth of control plane changes that need the main loop */
+    unsigned int dataplane_paused;
 };
 
 size_t virtio_net_handle_ctrl_iov(VirtIODevice *vdev,
@@ -270,6 +270,12 @@ void virtio_delete_queue(VirtQueue *vq);
 void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
                     unsigned int len);
 void virtqueue_flush(VirtQueue *vq, unsigned int count);
+/*
+ * Complete @count elements at once and update the used index only once.
+ * @lens may be NULL if nothing was written to any of the elements.
+ */
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement *const *elems,
+                          const unsigned int *lens, unsigned int count);
 void virtqueue_detach_element(VirtQueue *vq, const VirtQueueElement *elem,
                               unsigned int len);
 void virtqueue_unpop(VirtQueue *vq, const VirtQueueElement *elem,
@@ -280,6 +286,14 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
 
 void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem);
 void *virtqueue_pop(VirtQueue *vq, size_t sz);
+/*
+ * Pop up to @max elements of size @sz into @elems, like calling
+ * virtqueue_pop() repeatedly but with a single RCU critical section and,
+ * for split rings, a single update of the avail event index.
+ * Returns the number of elements popped.
+ */
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max);
 unsigned int virtqueue_drop_all(VirtQueue *vq);
 void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz);
 void qemu_put_virtqueue_element(VirtIODevice *vdev, QEMUFile *f,
@@ -423,6 +437,9 @@ EventNotifier *virtio_queue_get_guest_notifier(VirtQueue *vq);
 void virtio_queue_set_guest_notifier_fd_handler(VirtQueue *vq, bool assign,
                                                 bool with_irqfd);
 int virtio_device_start_ioeventfd(VirtIODevice *vdev);
+/* Default VirtioDeviceClass::start_ioeventfd and ::stop_ioeventfd */
+int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev);
+void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev);
 int virtio_device_grab_ioeventfd(VirtIODevice *vdev);
 void virtio_device_release_ioeventfd(VirtIODevice *vdev);
 bool virtio_device_ioeventfd_enabled(VirtIODevice *vdev);
@@ -281,4 +281,34 @@ int qio_channel_socket_set_send_buffer(QIOChannelSocket *ioc,
                                        size_t size,
                                        Error **errp);
 
+/**
+ * qio_channel_socket_enable_zero_copy:
+ * @ioc: the socket channel object
+ *
+ * Try to allow writes with QIO_CHANNEL_WRITE_FLAG_ZERO_COPY on a
+ * connected socket, such as one returned by qio_channel_socket_accept().
+ * Sockets connected with qio_channel_socket_connect_sync() already
+ * have them enabled when the host supports it.
+ *
+ * Returns: true if zero copy writes are available, false otherwise
+ */
+bool qio_channel_socket_enable_zero_copy(QIOChannelSocket *ioc);
+
+/**
+ * qio_channel_socket_zero_copy_poll:
+ * @ioc: the socket channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Collect the completion notifications of writes done with
+ * QIO_CHANNEL_WRITE_FLAG_ZERO_COPY that are already available,
+ * without waiting for the others like qio_channel_flush() does.
+ * Afterwards @ioc->zero_copy_sent tells how many of the
+ * @ioc->zero_copy_queued writes are complete, so that their buffers
+ * can be reused.
+ *
+ * Returns: 0 on success, or -1 on error
+ */
+int qio_channel_socket_zero_copy_poll(QIOChannelSocket *ioc,
+                                      Error **errp);
+
 #endif /* QIO_CHANNEL_SOCKET_H */
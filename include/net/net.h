@@ -55,6 +55,8 @@ typedef struct NetOffloads {
 /* Net clients */
 
 typedef void (NetPoll)(NetClientState *, bool enable);
+typedef void (NetSetAioContext)(NetClientState *, AioContext *);
+typedef void (NetQuiesce)(NetClientState *, bool quiesce);
 typedef bool (NetCanReceive)(NetClientState *);
 typedef int (NetStart)(NetClientState *);
 typedef int (NetLoad)(NetClientState *);
@@ -62,6 +64,7 @@ typedef void (NetStop)(NetClientState *);
 typedef ssize_t (NetReceive)(NetClientState *, const uint8_t *, size_t);
 typedef ssize_t (NetReceiveIOV)(NetClientState *, const struct iovec *, int);
 typedef void (NetCleanup) (NetClientState *);
+typedef void (NetReceiveBatchEnd)(NetClientState *);
 typedef void (LinkStatusChanged)(NetClientState *);
 typedef void (NetClientDestructor)(NetClientState *);
 typedef RxFilterInfo *(QueryRxFilter)(NetClientState *);
@@ -89,6 +92,7 @@ typedef struct NetClientInfo {
     NetReceive *receive;
     NetReceiveIOV *receive_iov;
     NetCanReceive *can_receive;
+    NetReceiveBatchEnd *receive_batch_end;
     NetStart *start;
     NetLoad *load;
     NetStop *stop;
@@ -96,6 +100,12 @@ typedef struct NetClientInfo {
     LinkStatusChanged *link_status_changed;
     QueryRxFilter *query_rx_filter;
     NetPoll *poll;
+    NetSetAioContext *set_aio_context;
+    /*
+     * For NICs that move their queues and peers to IOThreads: while
+     * quiesced, everything must be served by the main loop.  Calls nest.
+     */
+    NetQuiesce *quiesce;
     HasUfo *has_ufo;
     HasUso *has_uso;
     HasTunnel *has_tunnel;
@@ -122,6 +132,8 @@ struct NetClientState {
     char *name;
     char info_str[256];
     unsigned receive_disabled : 1;
+    unsigned int receive_batch; /* nesting depth of receive batches */
+    AioContext *ctx; /* IOThread serving this client, NULL for main loop */
     NetClientDestructor *destructor;
     unsigned int queue_index;
     unsigned rxfilter_notify_enabled:1;
@@ -193,6 +205,21 @@ ssize_t qemu_receive_packet(NetClientState *nc, const uint8_t *buf, int size);
 ssize_t qemu_send_packet_raw(NetClientState *nc, const uint8_t *buf, int size);
 ssize_t qemu_send_packet_async(NetClientState *nc, const uint8_t *buf,
                                int size, NetPacketSent *sent_cb);
+/*
+ * Packets sent between qemu_send_batch_begin() and qemu_send_batch_end()
+ * may be completed by the peer as a group, for example with a single
+ * interrupt to the guest for all of them.  Batches may nest.
+ */
+void qemu_send_batch_begin(NetClientState *nc);
+void qemu_send_batch_end(NetClientState *nc);
+/*
+ * Serve @nc from @ctx, or from the main loop if @ctx is NULL.  Backends
+ * must implement NetClientInfo.set_aio_context to be moved, NICs are moved
+ * by their device model.  Packets sent by @nc from another thread are
+ * handed over to @ctx.  Context: BQL held, or @nc's current AioContext
+ */
+bool qemu_can_set_net_aio_context(NetClientState *nc);
+void qemu_set_net_aio_context(NetClientState *nc, AioContext *ctx);
 void qemu_purge_queued_packets(NetClientState *nc);
 void qemu_flush_queued_packets(NetClientState *nc);
 void qemu_flush_or_purge_queued_packets(NetClientState *nc, bool purge);
@@ -30,6 +30,18 @@ typedef struct NetQueue NetQueue;
 
 typedef void (NetPacketSent) (NetClientState *sender, ssize_t ret);
 
+/* Backpressure counters, for "info network" */
+typedef struct NetQueueStats {
+    uint64_t queued;            /* packets that had to wait in the queue */
+    uint64_t dropped;           /* packets dropped because it was full */
+    uint64_t flushed;           /* queued packets delivered later */
+    uint64_t purged;            /* queued packets discarded by a purge */
+    uint32_t depth;             /* packets in the queue right now */
+    uint32_t max_depth;
+    uint64_t flush_latency_total_ns;
+    uint64_t flush_latency_max_ns;
+} NetQueueStats;
+
 #define QEMU_NET_PACKET_FLAG_NONE  0
 #define QEMU_NET_PACKET_FLAG_RAW  (1<<0)
 
@@ -75,5 +87,7 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
 
 void qemu_net_queue_purge(NetQueue *queue, NetClientState *from);
 bool qemu_net_queue_flush(NetQueue *queue);
+/* Context: the thread that runs the NetClientState owning @queue */
+void qemu_net_queue_get_stats(NetQueue *queue, NetQueueStats *stats);
 
 #endif /* QEMU_NET_QUEUE_H */
@@ -74,4 +74,12 @@ void qemu_coroutine_delete(Coroutine *co);
 CoroutineAction qemu_coroutine_switch(Coroutine *from, Coroutine *to,
                                       CoroutineAction action);
 
+#ifdef CONFIG_DEBUG_STACK_USAGE
+/*
+ * Return how much of @co's stack was used since the last call, see
+ * qemu_stack_usage().  @co must have terminated.
+ */
+size_t qemu_coroutine_stack_usage(Coroutine *co);
+#endif
+
 #endif
@@ -32,4 +32,7 @@
 uint32_t crc32c(uint32_t crc, const uint8_t *data, unsigned int length);
 uint32_t iov_crc32c(uint32_t crc, const struct iovec *iov, size_t iov_cnt);
 
+/* Switch to the next slower implementation, for benchmarks and tests. */
+bool test_crc32c_next_accel(void);
+
 #endif
@@ -120,6 +120,14 @@ static inline void rcu_read_unlock(void)
 
 void synchronize_rcu(void);
 
+/*
+ * Like synchronize_rcu(), but force the grace period to end as soon as
+ * possible instead of polling for it.  This also speeds up the grace
+ * period the call_rcu thread might be waiting for.  Use it sparingly,
+ * because forcing kicks all threads that registered a force_rcu notifier.
+ */
+void synchronize_rcu_expedited(void);
+
 /*
  * Reader thread registration.
  */
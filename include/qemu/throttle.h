@@ -114,6 +114,16 @@ typedef struct ThrottleTimers {
     void *timer_opaque;
 } ThrottleTimers;
 
+/* Part of the capacity of a ThrottleState that has already been accounted
+ * with throttle_borrow(), so that it can be spent later without looking
+ * at the ThrottleState. A dimension without a limit has infinite credit.
+ */
+typedef struct ThrottleCredit {
+    double bytes;             /* bytes that can still be performed */
+    double ops;               /* operations that can still be performed */
+    uint64_t op_size;         /* ThrottleConfig.op_size at borrowing time */
+} ThrottleCredit;
+
 /* operations on single leaky buckets */
 void throttle_leak_bucket(LeakyBucket *bkt, int64_t delta);
 
@@ -158,6 +168,15 @@ bool throttle_schedule_timer(ThrottleState *ts,
 
 void throttle_account(ThrottleState *ts, ThrottleDirection direction,
                       uint64_t size);
+
+void throttle_borrow(ThrottleState *ts, ThrottleDirection direction,
+                     double share, ThrottleCredit *credit);
+
+void throttle_repay(ThrottleState *ts, ThrottleDirection direction,
+                    ThrottleCredit *credit);
+
+bool throttle_credit_consume(ThrottleCredit *credit, uint64_t size);
+
 void throttle_limits_to_config(ThrottleLimits *arg, ThrottleConfig *cfg,
                                Error **errp);
 void throttle_config_to_limits(ThrottleConfig *cfg, ThrottleLimits *var);
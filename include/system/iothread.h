@@ -33,6 +33,7 @@ struct IOThread {
     bool stopping;              /* has iothread_stop() been called? */
     bool running;               /* should iothread_run() continue? */
     int thread_id;
+    int64_t start_ns;           /* QEMU_CLOCK_REALTIME when the thread started */
 
     /* AioContext poll parameters */
     int64_t poll_max_ns;
@@ -85,6 +85,31 @@ void *qemu_alloc_stack(size_t *sz);
  */
 void qemu_free_stack(void *stack, size_t sz);
 
+#ifdef CONFIG_DEBUG_STACK_USAGE
+/**
+ * qemu_stack_usage:
+ * @stack: stack allocated via qemu_alloc_stack()
+ * @sz: size of stack in bytes, as returned by qemu_alloc_stack()
+ *
+ * @live: lowest address of the frames still live on @stack, or %NULL
+ *
+ * Measure how much of @stack has been used since it was allocated or
+ * since the last call to qemu_stack_usage(), and mark it unused again so
+ * that the next call measures only what was used in between.  This lets
+ * a stack that is reused, for example by pooled coroutines, be measured
+ * once per user.  Increases of the calling thread's maximum are reported.
+ *
+ * If @stack still holds frames that will be returned to, for example
+ * those of a terminated coroutine that is kept for reuse, @live must
+ * point to the lowest of them.  The part of @stack from a safety margin
+ * below @live upwards is then left alone, so usage below that margin is
+ * over-reported.  This cannot be called while running on @stack.
+ *
+ * Returns: the high-water mark of @stack in bytes.
+ */
+size_t qemu_stack_usage(void *stack, size_t sz, void *live);
+#endif
+
 /* POSIX and Mingw32 differ in the name of the stdio lock functions.  */
 
 static inline void qemu_flockfile(FILE *f)
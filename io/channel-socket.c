@@ -183,9 +183,20 @@ int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
         return -1;
     }
 
+    qio_channel_socket_enable_zero_copy(ioc);
+
+    qio_channel_set_feature(QIO_CHANNEL(ioc),
+                            QIO_CHANNEL_FEATURE_READ_MSG_PEEK);
+
+    return 0;
+}
+
+
+bool qio_channel_socket_enable_zero_copy(QIOChannelSocket *ioc)
+{
 #ifdef QEMU_MSG_ZEROCOPY
     int ret, v = 1;
-    ret = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v));
+    ret = setsockopt(ioc->fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v));
     if (ret == 0) {
         /* Zero copy available on host */
         qio_channel_set_feature(QIO_CHANNEL(ioc),
@@ -193,10 +204,8 @@ int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
     }
 #endif
 
-    qio_channel_set_feature(QIO_CHANNEL(ioc),
-                            QIO_CHANNEL_FEATURE_READ_MSG_PEEK);
-
-    return 0;
+    return qio_channel_has_feature(QIO_CHANNEL(ioc),
+                                   QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
 }
 
 
@@ -583,6 +592,16 @@ static ssize_t qio_channel_socket_readv(QIOChannel *ioc,
     ret = recvmsg(sioc->fd, &msg, sflags);
     if (ret < 0) {
         if (errno == EAGAIN) {
+#ifdef QEMU_MSG_ZEROCOPY
+            /*
+             * Zero copy completions raise POLLERR, which also wakes up
+             * whoever waits for the socket to become readable.  Collect
+             * them here, or a reader would keep waking up without data.
+             */
+            if (sioc->zero_copy_queued > sioc->zero_copy_sent) {
+                qio_channel_socket_flush_internal(ioc, false, NULL);
+            }
+#endif
             return QIO_CHANNEL_ERR_BLOCK;
         }
         if (errno == EINTR) {
@@ -910,6 +929,16 @@ static int qio_channel_socket_flush(QIOChannel *ioc,
 
 #endif /* QEMU_MSG_ZEROCOPY */
 
+int qio_channel_socket_zero_copy_poll(QIOChannelSocket *ioc,
+                                      Error **errp)
+{
+#ifdef QEMU_MSG_ZEROCOPY
+    return qio_channel_socket_flush_internal(QIO_CHANNEL(ioc), false, errp);
+#else
+    return 0;
+#endif
+}
+
 static int
 qio_channel_socket_set_blocking(QIOChannel *ioc,
                                 bool enabled,
@@ -48,6 +48,7 @@ static void *iothread_run(void *opaque)
     g_main_context_push_thread_default(iothread->worker_context);
     qemu_set_current_aio_context(iothread->ctx);
     iothread->thread_id = qemu_get_thread_id();
+    iothread->start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     qemu_sem_post(&iothread->init_done_sem);
 
     while (iothread->running) {
@@ -344,6 +345,7 @@ static int query_one_iothread(Object *object, void *opaque)
     IOThreadInfoList ***tail = opaque;
     IOThreadInfo *info;
     IOThread *iothread;
+    int64_t now, run_ns, idle_ns;
 
     iothread = (IOThread *)object_dynamic_cast(object, TYPE_IOTHREAD);
     if (!iothread) {
@@ -358,6 +360,13 @@ static int query_one_iothread(Object *object, void *opaque)
     info->poll_shrink = iothread->poll_shrink;
     info->aio_max_batch = iothread->parent_obj.aio_max_batch;
 
+    /* A wait that is still in progress counts as idle */
+    idle_ns = aio_context_get_idle_ns(iothread->ctx, &now);
+    run_ns = now - iothread->start_ns;
+    idle_ns = MIN(idle_ns, run_ns);
+    info->idle_time_ns = idle_ns;
+    info->busy_time_ns = run_ns - idle_ns;
+
     QAPI_LIST_APPEND(*tail, info);
     return 0;
 }
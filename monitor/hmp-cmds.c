@@ -202,6 +202,10 @@ void hmp_info_iothreads(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "  poll-shrink=%" PRId64 "\n", value->poll_shrink);
         monitor_printf(mon, "  aio-max-batch=%" PRId64 "\n",
                        value->aio_max_batch);
+        monitor_printf(mon, "  busy-time-ns=%" PRId64 "\n",
+                       value->busy_time_ns);
+        monitor_printf(mon, "  idle-time-ns=%" PRId64 "\n",
+                       value->idle_time_ns);
     }
 
     qapi_free_IOThreadInfoList(info_list);
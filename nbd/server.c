@@ -23,11 +23,13 @@
 #include "block/export.h"
 #include "block/dirty-bitmap.h"
 #include "qapi/error.h"
+#include "qemu/error-report.h"
 #include "qemu/queue.h"
 #include "trace.h"
 #include "nbd-internal.h"
 #include "qemu/units.h"
 #include "qemu/memalign.h"
+#include "qemu/stats64.h"
 
 #define NBD_META_ID_BASE_ALLOCATION 0
 #define NBD_META_ID_ALLOCATION_DEPTH 1
@@ -42,6 +44,25 @@
  */
 #define NBD_MAX_BLOCK_STATUS_EXTENTS (1 * MiB / 8)
 
+/*
+ * Read payloads of at least this size are sent with MSG_ZEROCOPY when the
+ * export allows it; below it, pinning the pages costs more than copying.
+ * Once NBD_ZERO_COPY_MAX_BUFFERS request buffers are kept alive waiting
+ * for the kernel to complete such sends, replies are copied again; with
+ * the requests still in flight, at most NBD_ZERO_COPY_MAX_BUFFERS +
+ * MAX_NBD_REQUESTS buffers are held.
+ */
+#define NBD_ZERO_COPY_MIN_SIZE (64 * KiB)
+#define NBD_ZERO_COPY_MAX_BUFFERS 64
+
+/*
+ * After a client is gone, its remaining zero copy buffers are checked for
+ * completion this often, and leaked if the kernel still isn't done with
+ * them after NBD_ZERO_COPY_REAP_MAX_MS.
+ */
+#define NBD_ZERO_COPY_REAP_INTERVAL_MS 100
+#define NBD_ZERO_COPY_REAP_MAX_MS (60 * 1000)
+
 static int system_errno_to_nbd_errno(int err)
 {
     switch (err) {
@@ -81,10 +102,32 @@ typedef struct NBDRequestData NBDRequestData;
 
 struct NBDRequestData {
     NBDClient *client;
+    NBDRequest request;
     uint8_t *data;
     bool complete;
+    /* The data is in use until the socket's zero_copy_sent reaches this */
+    ssize_t zero_copy_seq;
 };
 
+typedef struct NBDZeroCopyBuffer {
+    void *data;
+    ssize_t seq; /* Free once the socket's zero_copy_sent reaches this */
+    QSIMPLEQ_ENTRY(NBDZeroCopyBuffer) next;
+} NBDZeroCopyBuffer;
+
+typedef struct NBDZeroCopyList {
+    QSIMPLEQ_HEAD(, NBDZeroCopyBuffer) bufs;
+    unsigned nbufs;
+} NBDZeroCopyList;
+
+/* Keeps the buffers of a closed client until the kernel is done with them */
+typedef struct NBDZeroCopyReaper {
+    QIOChannelSocket *sioc;
+    NBDZeroCopyList list;
+    QEMUTimer *timer;
+    int64_t deadline_ms;
+} NBDZeroCopyReaper;
+
 struct NBDExport {
     BlockExport common;
 
@@ -99,6 +142,8 @@ struct NBDExport {
     Notifier eject_notifier;
 
     bool allocation_depth;
+    bool zero_copy;
+    Stat64 zero_copy_bytes;
     BdrvDirtyBitmap **export_bitmaps;
     size_t nr_export_bitmaps;
 };
@@ -155,6 +200,14 @@ struct NBDClient {
     uint32_t opt; /* Current option being negotiated */
     uint32_t optlen; /* remaining length of data in ioc for the option being
                         negotiated now */
+
+    /*
+     * Read payloads may be sent with MSG_ZEROCOPY. Buffers of requests
+     * that completed while such sends were in flight are kept here until
+     * the kernel is done with them.
+     */
+    bool zero_copy;
+    NBDZeroCopyList zero_copy_list;
 };
 
 static void nbd_client_receive_next_request(NBDClient *client);
@@ -1562,6 +1615,98 @@ void nbd_client_get(NBDClient *client)
     qatomic_inc(&client->refcount);
 }
 
+static void nbd_zero_copy_free(NBDZeroCopyList *list, NBDZeroCopyBuffer *buf)
+{
+    QSIMPLEQ_REMOVE(&list->bufs, buf, NBDZeroCopyBuffer, next);
+    list->nbufs--;
+    qemu_vfree(buf->data);
+    g_free(buf);
+}
+
+/*
+ * Free the buffers in @list whose zero copy sends on @sioc are complete.
+ * Returns -1 if the completions could not be read; the kernel may then
+ * still have the other buffers pinned, so they are kept.
+ */
+static int nbd_zero_copy_free_done(QIOChannelSocket *sioc,
+                                   NBDZeroCopyList *list)
+{
+    NBDZeroCopyBuffer *buf, *next;
+    int ret;
+
+    if (QSIMPLEQ_EMPTY(&list->bufs)) {
+        return 0;
+    }
+
+    ret = qio_channel_socket_zero_copy_poll(sioc, NULL);
+    QSIMPLEQ_FOREACH_SAFE(buf, &list->bufs, next, next) {
+        if (sioc->zero_copy_sent >= buf->seq) {
+            nbd_zero_copy_free(list, buf);
+        }
+    }
+    return ret;
+}
+
+static void nbd_zero_copy_reap(void *opaque)
+{
+    NBDZeroCopyReaper *reaper = opaque;
+    NBDZeroCopyBuffer *buf, *next;
+    int64_t now = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    int ret;
+
+    ret = nbd_zero_copy_free_done(reaper->sioc, &reaper->list);
+    if (!reaper->list.nbufs) {
+        goto out;
+    }
+    if (ret == 0 && now < reaper->deadline_ms) {
+        timer_mod(reaper->timer, now + NBD_ZERO_COPY_REAP_INTERVAL_MS);
+        return;
+    }
+
+    /* Better leak them than hand out memory the kernel may still send */
+    warn_report("nbd: leaking %u buffers of unfinished zero copy sends",
+                reaper->list.nbufs);
+    QSIMPLEQ_FOREACH_SAFE(buf, &reaper->list.bufs, next, next) {
+        g_free(buf);
+    }
+
+out:
+    timer_free(reaper->timer);
+    object_unref(OBJECT(reaper->sioc));
+    g_free(reaper);
+}
+
+/*
+ * The client is going away, but the kernel may still be sending from the
+ * buffers of its last replies even though the socket is shut down.  Hand
+ * them over to a timer that frees them as their completions come in.  The
+ * socket is hung up, so waiting for G_IO_ERR on it would spin.
+ */
+static void nbd_client_release_zero_copy(NBDClient *client)
+{
+    NBDZeroCopyReaper *reaper;
+    int64_t now;
+
+    nbd_zero_copy_free_done(client->sioc, &client->zero_copy_list);
+    if (!client->zero_copy_list.nbufs) {
+        return;
+    }
+
+    reaper = g_new0(NBDZeroCopyReaper, 1);
+    reaper->sioc = client->sioc;
+    object_ref(OBJECT(reaper->sioc));
+    QSIMPLEQ_INIT(&reaper->list.bufs);
+    QSIMPLEQ_CONCAT(&reaper->list.bufs, &client->zero_copy_list.bufs);
+    reaper->list.nbufs = client->zero_copy_list.nbufs;
+    client->zero_copy_list.nbufs = 0;
+
+    now = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    reaper->deadline_ms = now + NBD_ZERO_COPY_REAP_MAX_MS;
+    reaper->timer = aio_timer_new(qemu_get_aio_context(), QEMU_CLOCK_REALTIME,
+                                  SCALE_MS, nbd_zero_copy_reap, reaper);
+    timer_mod(reaper->timer, now + NBD_ZERO_COPY_REAP_INTERVAL_MS);
+}
+
 void nbd_client_put(NBDClient *client)
 {
     assert(qemu_in_main_thread());
@@ -1572,6 +1717,7 @@ void nbd_client_put(NBDClient *client)
          */
         assert(client->closing);
 
+        nbd_client_release_zero_copy(client);
         object_unref(OBJECT(client->sioc));
         object_unref(OBJECT(client->ioc));
         if (client->tlscreds) {
@@ -1655,7 +1801,18 @@ static void nbd_request_put(NBDRequestData *req)
 {
     NBDClient *client = req->client;
 
-    if (req->data) {
+    if (req->data && req->zero_copy_seq) {
+        nbd_zero_copy_free_done(client->sioc, &client->zero_copy_list);
+    }
+    if (req->data && client->sioc->zero_copy_sent < req->zero_copy_seq) {
+        /* The buffer is still referenced by a zero copy send */
+        NBDZeroCopyBuffer *buf = g_new(NBDZeroCopyBuffer, 1);
+
+        buf->data = req->data;
+        buf->seq = req->zero_copy_seq;
+        QSIMPLEQ_INSERT_TAIL(&client->zero_copy_list.bufs, buf, next);
+        client->zero_copy_list.nbufs++;
+    } else {
         qemu_vfree(req->data);
     }
     g_free(req);
@@ -1933,6 +2090,7 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     }
 
     exp->allocation_depth = arg->allocation_depth;
+    exp->zero_copy = arg->zero_copy;
 
     /*
      * We need to inhibit request queuing in the block layer to ensure we can
@@ -2025,6 +2183,16 @@ static void nbd_export_delete(BlockExport *blk_exp)
     }
 }
 
+static void nbd_export_query(BlockExport *blk_exp, BlockExportInfo *info)
+{
+    NBDExport *exp = container_of(blk_exp, NBDExport, common);
+
+    if (exp->zero_copy) {
+        info->u.nbd.has_zero_copy_bytes = true;
+        info->u.nbd.zero_copy_bytes = stat64_get(&exp->zero_copy_bytes);
+    }
+}
+
 const BlockExportDriver blk_exp_nbd = {
     .type               = BLOCK_EXPORT_TYPE_NBD,
     .instance_size      = sizeof(NBDExport),
@@ -2032,6 +2200,7 @@ const BlockExportDriver blk_exp_nbd = {
     .create             = nbd_export_create,
     .delete             = nbd_export_delete,
     .request_shutdown   = nbd_export_request_shutdown,
+    .query              = nbd_export_query,
 };
 
 static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
@@ -2051,6 +2220,53 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     return ret;
 }
 
+/*
+ * Like nbd_co_send_iov(), but the last element of @iov is a read payload
+ * that is sent without copying it when possible. The headers in the other
+ * elements are usually on the stack, so they are always copied.
+ */
+static int coroutine_fn nbd_co_send_iov_payload(NBDClient *client,
+                                                NBDRequest *request,
+                                                struct iovec *iov,
+                                                unsigned niov, Error **errp)
+{
+    struct iovec *payload = &iov[niov - 1];
+    NBDRequestData *req;
+    int ret;
+
+    if (!client->zero_copy || payload->iov_len < NBD_ZERO_COPY_MIN_SIZE) {
+        return nbd_co_send_iov(client, iov, niov, errp);
+    }
+
+    nbd_zero_copy_free_done(client->sioc, &client->zero_copy_list);
+    if (client->zero_copy_list.nbufs >= NBD_ZERO_COPY_MAX_BUFFERS) {
+        return nbd_co_send_iov(client, iov, niov, errp);
+    }
+
+    /* Read payloads always live in the buffer of the request being served */
+    req = container_of(request, NBDRequestData, request);
+    assert(payload->iov_base >= (void *)req->data);
+
+    qemu_co_mutex_lock(&client->send_lock);
+    client->send_coroutine = qemu_coroutine_self();
+
+    ret = qio_channel_writev_all(client->ioc, iov, niov - 1, errp);
+    if (ret == 0) {
+        ret = qio_channel_writev_full_all(client->ioc, payload, 1, NULL, 0,
+                                          QIO_CHANNEL_WRITE_FLAG_ZERO_COPY,
+                                          errp);
+        req->zero_copy_seq = client->sioc->zero_copy_queued;
+        if (ret == 0) {
+            stat64_add(&client->exp->zero_copy_bytes, payload->iov_len);
+        }
+    }
+
+    client->send_coroutine = NULL;
+    qemu_co_mutex_unlock(&client->send_lock);
+
+    return ret < 0 ? -EIO : 0;
+}
+
 static inline void set_be_simple_reply(NBDSimpleReply *reply, uint64_t error,
                                        uint64_t cookie)
 {
@@ -2082,7 +2298,7 @@ static int coroutine_fn nbd_co_send_simple_reply(NBDClient *client,
                                    nbd_err_lookup(nbd_err), len);
     set_be_simple_reply(&reply, nbd_err, request->cookie);
 
-    return nbd_co_send_iov(client, iov, 2, errp);
+    return nbd_co_send_iov_payload(client, request, iov, 2, errp);
 }
 
 /*
@@ -2163,7 +2379,7 @@ static int coroutine_fn nbd_co_send_chunk_read(NBDClient *client,
                  NBD_REPLY_TYPE_OFFSET_DATA, request);
     stq_be_p(&chunk.offset, offset);
 
-    return nbd_co_send_iov(client, iov, 3, errp);
+    return nbd_co_send_iov_payload(client, request, iov, 3, errp);
 }
 
 static int coroutine_fn nbd_co_send_chunk_error(NBDClient *client,
@@ -3072,7 +3288,7 @@ static coroutine_fn void nbd_trip(void *opaque)
 {
     NBDRequestData *req = opaque;
     NBDClient *client = req->client;
-    NBDRequest request = { 0 };    /* GCC thinks it can be used uninitialized */
+    NBDRequest *request = &req->request;
     int ret;
     Error *local_err = NULL;
 
@@ -3110,7 +3326,7 @@ static coroutine_fn void nbd_trip(void *opaque)
     do {
         assert(client->recv_coroutine == qemu_coroutine_self());
         qemu_mutex_unlock(&client->lock);
-        ret = nbd_co_receive_request(req, &request, &local_err);
+        ret = nbd_co_receive_request(req, request, &local_err);
         qemu_mutex_lock(&client->lock);
     } while (ret == -EAGAIN && !client->quiescing);
 
@@ -3143,16 +3359,16 @@ static coroutine_fn void nbd_trip(void *opaque)
         Error *export_err = local_err;
 
         local_err = NULL;
-        ret = nbd_send_generic_reply(client, &request, -EINVAL,
+        ret = nbd_send_generic_reply(client, request, -EINVAL,
                                      error_get_pretty(export_err), &local_err);
         error_free(export_err);
     } else {
-        ret = nbd_handle_request(client, &request, req->data, &local_err);
+        ret = nbd_handle_request(client, request, req->data, &local_err);
     }
-    if (request.contexts && request.contexts != &client->contexts) {
-        assert(request.type == NBD_CMD_BLOCK_STATUS);
-        g_free(request.contexts->bitmaps);
-        g_free(request.contexts);
+    if (request->contexts && request->contexts != &client->contexts) {
+        assert(request->type == NBD_CMD_BLOCK_STATUS);
+        g_free(request->contexts->bitmaps);
+        g_free(request->contexts);
     }
 
     qio_channel_set_cork(client->ioc, false);
@@ -3255,6 +3471,12 @@ static coroutine_fn void nbd_co_client_start(void *opaque)
     }
 
     timer_free(handshake_timer);
+
+    /* Zero copy writes would have to go through the TLS channel */
+    if (client->exp->zero_copy && !client->tlscreds) {
+        client->zero_copy = qio_channel_socket_enable_zero_copy(client->sioc);
+    }
+
     WITH_QEMU_LOCK_GUARD(&client->lock) {
         nbd_client_receive_next_request(client);
     }
@@ -3278,6 +3500,7 @@ void nbd_client_new(QIOChannelSocket *sioc,
 
     client = g_new0(NBDClient, 1);
     qemu_mutex_init(&client->lock);
+    QSIMPLEQ_INIT(&client->zero_copy_list.bufs);
     client->refcount = 1;
     client->tlscreds = tlscreds;
     if (tlscreds) {
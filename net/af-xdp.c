@@ -42,6 +42,7 @@ typedef struct AFXDPState {
     int                  ifindex;
     bool                 read_poll;
     bool                 write_poll;
+    AioContext           *ctx;
     uint32_t             outstanding_tx;
 
     uint64_t             *pool;
@@ -51,6 +52,7 @@ typedef struct AFXDPState {
 
     uint32_t             xdp_flags;
     bool                 inhibit;
+    bool                 busy_poll;
 
     char                 *map_path;
     int                  map_fd;
@@ -59,16 +61,23 @@ typedef struct AFXDPState {
 
 #define AF_XDP_BATCH_SIZE 64
 
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET 70
+#endif
+
 static void af_xdp_send(void *opaque);
 static void af_xdp_writable(void *opaque);
 
 /* Set the event-loop handlers for the af-xdp backend. */
 static void af_xdp_update_fd_handler(AFXDPState *s)
 {
-    qemu_set_fd_handler(xsk_socket__fd(s->xsk),
-                        s->read_poll ? af_xdp_send : NULL,
-                        s->write_poll ? af_xdp_writable : NULL,
-                        s);
+    aio_set_fd_handler(s->ctx, xsk_socket__fd(s->xsk),
+                       s->read_poll ? af_xdp_send : NULL,
+                       s->write_poll ? af_xdp_writable : NULL,
+                       NULL, NULL, s);
 }
 
 /* Update the read handler. */
@@ -100,6 +109,17 @@ static void af_xdp_poll(NetClientState *nc, bool enable)
     }
 }
 
+/* Move the event-loop handlers to another AioContext. */
+static void af_xdp_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    aio_set_fd_handler(s->ctx, xsk_socket__fd(s->xsk),
+                       NULL, NULL, NULL, NULL, NULL);
+    s->ctx = ctx ?: iohandler_get_aio_context();
+    af_xdp_update_fd_handler(s);
+}
+
 static void af_xdp_complete_tx(AFXDPState *s)
 {
     uint32_t idx = 0;
@@ -224,11 +244,17 @@ static void af_xdp_send(void *opaque)
     uint32_t i, n_rx, idx = 0;
     AFXDPState *s = opaque;
 
+    if (s->busy_poll) {
+        /* Let the driver process its queues now, from this thread. */
+        recvfrom(xsk_socket__fd(s->xsk), NULL, 0, MSG_DONTWAIT, NULL, NULL);
+    }
+
     n_rx = xsk_ring_cons__peek(&s->rx, AF_XDP_BATCH_SIZE, &idx);
     if (!n_rx) {
         return;
     }
 
+    qemu_send_batch_begin(&s->nc);
     for (i = 0; i < n_rx; i++) {
         const struct xdp_desc *desc;
         struct iovec iov;
@@ -254,6 +280,7 @@ static void af_xdp_send(void *opaque)
             break;
         }
     }
+    qemu_send_batch_end(&s->nc);
 
     /* Release actually sent descriptors and try to re-fill. */
     xsk_ring_cons__release(&s->rx, n_rx);
@@ -403,6 +430,61 @@ static int af_xdp_socket_create(AFXDPState *s,
     return 0;
 }
 
+/*
+ * Sets a socket option unless it already has the value.  Raising busy
+ * polling options needs CAP_NET_ADMIN, so with sock-fds the management
+ * layer may have set them already.
+ */
+static int af_xdp_set_sockopt(int fd, int optname, int val)
+{
+    int cur;
+    socklen_t len = sizeof(cur);
+
+    if (!getsockopt(fd, SOL_SOCKET, optname, &cur, &len) && cur == val) {
+        return 0;
+    }
+    return setsockopt(fd, SOL_SOCKET, optname, &val, sizeof(val));
+}
+
+static int af_xdp_busy_poll_setup(AFXDPState *s,
+                                  const NetdevAFXDPOptions *opts,
+                                  Error **errp)
+{
+    int fd = xsk_socket__fd(s->xsk);
+    int timeout, budget;
+
+    if (!opts->has_busy_poll || !opts->busy_poll) {
+        return 0;
+    }
+
+    timeout = opts->busy_poll;
+    budget = opts->has_busy_poll_budget ? opts->busy_poll_budget
+                                        : AF_XDP_BATCH_SIZE;
+
+    if (af_xdp_set_sockopt(fd, SO_PREFER_BUSY_POLL, 1) ||
+        af_xdp_set_sockopt(fd, SO_BUSY_POLL, timeout) ||
+        af_xdp_set_sockopt(fd, SO_BUSY_POLL_BUDGET, budget)) {
+        if (errno == EPERM && opts->sock_fds) {
+            /* Still usable, just driven by interrupts */
+            af_xdp_set_sockopt(fd, SO_PREFER_BUSY_POLL, 0);
+            warn_report("af-xdp: no permission to enable busy polling for "
+                        "%s queue_index: %d, the passed sockets need "
+                        "SO_PREFER_BUSY_POLL, SO_BUSY_POLL and "
+                        "SO_BUSY_POLL_BUDGET set already",
+                        s->ifname, s->nc.queue_index);
+            return 0;
+        }
+        error_setg_errno(errp, errno,
+                         "failed to enable busy polling for %s queue_index: %d",
+                         s->ifname, s->nc.queue_index);
+        return -1;
+    }
+
+    s->busy_poll = true;
+
+    return 0;
+}
+
 static int af_xdp_update_xsk_map(AFXDPState *s, Error **errp)
 {
     int xsk_fd, idx, error = 0;
@@ -438,6 +520,7 @@ static NetClientInfo net_af_xdp_info = {
     .size = sizeof(AFXDPState),
     .receive = af_xdp_receive,
     .poll = af_xdp_poll,
+    .set_aio_context = af_xdp_set_aio_context,
     .cleanup = af_xdp_cleanup,
 };
 
@@ -520,6 +603,21 @@ int net_init_af_xdp(const Netdev *netdev,
         error_setg(errp, "'map-start-index' requires 'map-path'");
         return -1;
     }
+    if (opts->has_busy_poll_budget &&
+        (!opts->has_busy_poll || !opts->busy_poll)) {
+        error_setg(errp, "'busy-poll-budget' requires 'busy-poll'");
+        return -1;
+    }
+    if (opts->has_busy_poll_budget &&
+        (!opts->busy_poll_budget || opts->busy_poll_budget > UINT16_MAX)) {
+        error_setg(errp, "invalid 'busy-poll-budget' (%" PRIu32 ")",
+                   opts->busy_poll_budget);
+        return -1;
+    }
+    if (opts->has_busy_poll && opts->busy_poll > INT_MAX) {
+        error_setg(errp, "invalid 'busy-poll' (%" PRIu32 ")", opts->busy_poll);
+        return -1;
+    }
 
     map_start_index = opts->has_map_start_index ? opts->map_start_index : 0;
     if (map_start_index < 0) {
@@ -545,6 +643,7 @@ int net_init_af_xdp(const Netdev *netdev,
         }
 
         s = DO_UPCAST(AFXDPState, nc, nc);
+        s->ctx = iohandler_get_aio_context();
 
         pstrcpy(s->ifname, sizeof(s->ifname), opts->ifname);
         s->ifindex = ifindex;
@@ -556,9 +655,12 @@ int net_init_af_xdp(const Netdev *netdev,
 
         if (af_xdp_umem_create(s, sock_fds ? sock_fds[i] : -1, &err) ||
             af_xdp_socket_create(s, opts, &err) ||
+            af_xdp_busy_poll_setup(s, opts, &err) ||
             af_xdp_update_xsk_map(s, &err)) {
             goto err;
         }
+
+        af_xdp_read_poll(s, true); /* Initially only poll for reads. */
     }
 
     if (nc0 && !inhibit) {
@@ -571,8 +673,6 @@ int net_init_af_xdp(const Netdev *netdev,
         }
     }
 
-    af_xdp_read_poll(s, true); /* Initially only poll for reads. */
-
     return 0;
 
 err:
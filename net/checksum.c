@@ -18,27 +18,88 @@
 #include "qemu/osdep.h"
 #include "net/checksum.h"
 #include "net/eth.h"
+#include "host/cpuinfo.h"
 
-uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq)
+/*
+ * The accelerated functions add up @len bytes as 16-bit words in host
+ * byte order.  The result is only meaningful modulo 0xffff, but it is
+ * zero only if all the bytes are.
+ */
+typedef uint64_t (*net_checksum_accel_fn)(const uint8_t *, size_t);
+
+static uint64_t net_checksum_int(const uint8_t *buf, size_t len)
 {
-    uint32_t sum1 = 0, sum2 = 0;
-    int i;
+    uint64_t sum = 0, w;
+    size_t i;
 
-    for (i = 0; i < len - 1; i += 2) {
-        sum1 += (uint32_t)buf[i];
-        sum2 += (uint32_t)buf[i + 1];
+    for (i = 0; i + 8 <= len; i += 8) {
+        w = ldq_he_p(buf + i);
+        sum += (w & 0xffffffff) + (w >> 32);
     }
     if (i < len) {
-        sum1 += (uint32_t)buf[i];
+        uint8_t tail[8] = { 0 };
+
+        memcpy(tail, buf + i, len - i);
+        w = ldq_he_p(tail);
+        sum += (w & 0xffffffff) + (w >> 32);
+    }
+    return sum;
+}
+
+#include "host/net-checksum.c.inc"
+
+/* Below this size the indirect call costs more than it saves. */
+#define NET_CHECKSUM_ACCEL_MIN 64
+
+static net_checksum_accel_fn net_checksum_accel;
+static unsigned net_checksum_accel_index;
+
+uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq)
+{
+    uint64_t sum;
+
+    if (len <= 0) {
+        return 0;
     }
 
+    if (len < NET_CHECKSUM_ACCEL_MIN) {
+        sum = net_checksum_int(buf, len);
+    } else {
+        sum = net_checksum_accel(buf, len);
+    }
+
+    /* Fold to 16 bits; this keeps a nonzero sum nonzero. */
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+
+    /*
+     * Words starting at an even @seq are big-endian.  Swapping the bytes
+     * of a ones' complement sum is the same as summing swapped words.
+     */
     if (seq & 1) {
-        return sum1 + (sum2 << 8);
+        return le16_to_cpu(sum);
     } else {
-        return sum2 + (sum1 << 8);
+        return be16_to_cpu(sum);
     }
 }
 
+bool test_net_checksum_next_accel(void)
+{
+    if (net_checksum_accel_index != 0) {
+        net_checksum_accel =
+            net_checksum_accel_table[--net_checksum_accel_index];
+        return true;
+    }
+    return false;
+}
+
+static void __attribute__((constructor)) net_checksum_init_accel(void)
+{
+    net_checksum_accel_index = net_checksum_best_accel();
+    net_checksum_accel = net_checksum_accel_table[net_checksum_accel_index];
+}
+
 uint16_t net_checksum_finish(uint32_t sum)
 {
     while (sum>>16)
@@ -32,6 +32,8 @@
 
 #include "block/aio-wait.h"
 #include "qemu/coroutine.h"
+#include "qemu/defer-call.h"
+#include "qemu/units.h"
 
 #define TYPE_COLO_COMPARE "colo-compare"
 typedef struct CompareState CompareState;
@@ -45,6 +47,8 @@ static NotifierList colo_compare_notifiers =
     NOTIFIER_LIST_INITIALIZER(colo_compare_notifiers);
 
 #define COMPARE_READ_LEN_MAX NET_BUFSIZE
+/* Packets queued for output are coalesced into writes of up to this size */
+#define COMPARE_SEND_BATCH_MAX (64 * KiB)
 #define MAX_QUEUE_SIZE 1024
 
 #define COLO_COMPARE_FREE_PRIMARY     0x01
@@ -90,9 +94,9 @@ typedef struct SendCo {
     struct CompareState *s;
     CharFrontend *chr;
     GQueue send_list;
+    GByteArray *batch;
     bool notify_remote_frame;
     bool done;
-    int ret;
 } SendCo;
 
 typedef struct SendEntry {
@@ -597,11 +601,9 @@ static int colo_packet_compare_other(Packet *spkt, Packet *ppkt)
                                        ppkt->size - offset);
 }
 
-static int colo_old_packet_check_one(Packet *pkt, int64_t *check_time)
+static int colo_old_packet_check_one(Packet *pkt, int64_t *deadline_ms)
 {
-    int64_t now = qemu_clock_get_ms(QEMU_CLOCK_HOST);
-
-    if ((now - pkt->creation_ms) > (*check_time)) {
+    if (pkt->creation_ms < *deadline_ms) {
         trace_colo_old_packet_check_found(pkt->creation_ms);
         return 0;
     } else {
@@ -619,29 +621,22 @@ void colo_compare_unregister_notifier(Notifier *notify)
     notifier_remove(notify);
 }
 
-static int colo_old_packet_check_one_conn(Connection *conn,
-                                          CompareState *s)
+static bool colo_old_packet_check_one_conn(Connection *conn,
+                                           int64_t *deadline_ms)
 {
-    if (!g_queue_is_empty(&conn->primary_list)) {
-        if (g_queue_find_custom(&conn->primary_list,
-                                &s->compare_timeout,
-                                (GCompareFunc)colo_old_packet_check_one))
-            goto out;
+    if (!g_queue_is_empty(&conn->primary_list) &&
+        g_queue_find_custom(&conn->primary_list, deadline_ms,
+                            (GCompareFunc)colo_old_packet_check_one)) {
+        return true;
     }
 
-    if (!g_queue_is_empty(&conn->secondary_list)) {
-        if (g_queue_find_custom(&conn->secondary_list,
-                                &s->compare_timeout,
-                                (GCompareFunc)colo_old_packet_check_one))
-            goto out;
+    if (!g_queue_is_empty(&conn->secondary_list) &&
+        g_queue_find_custom(&conn->secondary_list, deadline_ms,
+                            (GCompareFunc)colo_old_packet_check_one)) {
+        return true;
     }
 
-    return 1;
-
-out:
-    /* Do checkpoint will flush old packet */
-    colo_compare_inconsistency_notify(s);
-    return 0;
+    return false;
 }
 
 /*
@@ -652,13 +647,21 @@ out:
 static void colo_old_packet_check(void *opaque)
 {
     CompareState *s = opaque;
+    int64_t deadline_ms = qemu_clock_get_ms(QEMU_CLOCK_HOST) -
+                          (int64_t)s->compare_timeout;
+    GList *l;
 
     /*
      * If we find one old packet, stop finding job and notify
      * COLO frame do checkpoint.
      */
-    g_queue_find_custom(&s->conn_list, s,
-                        (GCompareFunc)colo_old_packet_check_one_conn);
+    for (l = s->conn_list.head; l; l = l->next) {
+        if (colo_old_packet_check_one_conn(l->data, &deadline_ms)) {
+            /* Do checkpoint will flush old packet */
+            colo_compare_inconsistency_notify(s);
+            return;
+        }
+    }
 }
 
 static void colo_compare_packet(CompareState *s, Connection *conn,
@@ -721,72 +724,114 @@ static void colo_compare_connection(void *opaque, void *user_data)
     }
 }
 
+static int coroutine_fn compare_chr_write_batch(SendCo *sendco)
+{
+    GByteArray *batch = sendco->batch;
+    int ret;
+
+    if (!batch->len) {
+        return 0;
+    }
+
+    ret = qemu_chr_fe_write_all(sendco->chr, batch->data, batch->len);
+    if (ret != batch->len) {
+        ret = ret < 0 ? ret : -EIO;
+    } else {
+        ret = 0;
+    }
+    g_byte_array_set_size(batch, 0);
+    return ret;
+}
+
+/*
+ * Sends out everything on send_list, in order.  Small packets are copied
+ * into one buffer together with their length headers, so that a burst of
+ * them costs a single write instead of two or three per packet.
+ */
 static void coroutine_fn _compare_chr_send(void *opaque)
 {
     SendCo *sendco = opaque;
     CompareState *s = sendco->s;
+    bool send_vnet_hdr = !sendco->notify_remote_frame && s->vnet_hdr;
     int ret = 0;
 
     while (!g_queue_is_empty(&sendco->send_list)) {
-        SendEntry *entry = g_queue_pop_tail(&sendco->send_list);
-        uint32_t len = htonl(entry->size);
-
-        ret = qemu_chr_fe_write_all(sendco->chr, (uint8_t *)&len, sizeof(len));
+        SendEntry *entry = g_queue_pop_head(&sendco->send_list);
+        /*
+         * We send vnet header len make other module(like filter-redirector)
+         * know how to parse net packet correctly.
+         */
+        uint32_t hdr[2] = { htonl(entry->size), htonl(entry->vnet_hdr_len) };
+        size_t hdr_len = send_vnet_hdr ? sizeof(hdr) : sizeof(hdr[0]);
 
-        if (ret != sizeof(len)) {
-            g_free(entry->buf);
-            g_slice_free(SendEntry, entry);
-            goto err;
+        if (sendco->batch->len + hdr_len + entry->size >
+            COMPARE_SEND_BATCH_MAX) {
+            ret = compare_chr_write_batch(sendco);
         }
-
-        if (!sendco->notify_remote_frame && s->vnet_hdr) {
-            /*
-             * We send vnet header len make other module(like filter-redirector)
-             * know how to parse net packet correctly.
-             */
-            len = htonl(entry->vnet_hdr_len);
-
-            ret = qemu_chr_fe_write_all(sendco->chr,
-                                        (uint8_t *)&len,
-                                        sizeof(len));
-
-            if (ret != sizeof(len)) {
-                g_free(entry->buf);
-                g_slice_free(SendEntry, entry);
-                goto err;
+        if (!ret) {
+            g_byte_array_append(sendco->batch, (uint8_t *)hdr, hdr_len);
+            if (entry->size <= COMPARE_SEND_BATCH_MAX) {
+                g_byte_array_append(sendco->batch, entry->buf, entry->size);
+            } else {
+                ret = compare_chr_write_batch(sendco);
+                if (!ret) {
+                    ret = qemu_chr_fe_write_all(sendco->chr, entry->buf,
+                                                entry->size);
+                    if (ret == entry->size) {
+                        ret = 0;
+                    } else if (ret >= 0) {
+                        ret = -EIO;
+                    }
+                }
             }
         }
 
-        ret = qemu_chr_fe_write_all(sendco->chr,
-                                    (uint8_t *)entry->buf,
-                                    entry->size);
-
-        if (ret != entry->size) {
-            g_free(entry->buf);
-            g_slice_free(SendEntry, entry);
+        g_free(entry->buf);
+        g_slice_free(SendEntry, entry);
+        if (ret) {
             goto err;
         }
+    }
 
-        g_free(entry->buf);
-        g_slice_free(SendEntry, entry);
+    ret = compare_chr_write_batch(sendco);
+    if (ret) {
+        goto err;
     }
 
-    sendco->ret = 0;
     goto out;
 
 err:
     while (!g_queue_is_empty(&sendco->send_list)) {
-        SendEntry *entry = g_queue_pop_tail(&sendco->send_list);
+        SendEntry *entry = g_queue_pop_head(&sendco->send_list);
         g_free(entry->buf);
         g_slice_free(SendEntry, entry);
     }
-    sendco->ret = ret < 0 ? ret : -EIO;
+    /* compare_chr_send() has usually returned by now, so report it here */
+    error_report("colo-compare: failed to send %s",
+                 sendco->notify_remote_frame ? "notification" : "packets");
 out:
     sendco->co = NULL;
     sendco->done = true;
     aio_wait_kick();
 }
 
+static void compare_chr_kick(void *opaque)
+{
+    SendCo *sendco = opaque;
+
+    if (sendco->done && !g_queue_is_empty(&sendco->send_list)) {
+        sendco->co = qemu_coroutine_create(_compare_chr_send, sendco);
+        sendco->done = false;
+        qemu_coroutine_enter(sendco->co);
+    }
+}
+
+/*
+ * Inside a defer_call_begin()/defer_call_end() section the packets are only
+ * queued, and go out together when the section ends.  Write errors are
+ * reported by _compare_chr_send() because they may happen after this has
+ * returned.
+ */
 static int compare_chr_send(CompareState *s,
                             uint8_t *buf,
                             uint32_t size,
@@ -819,16 +864,8 @@ static int compare_chr_send(CompareState *s,
     g_queue_push_tail(&sendco->send_list, entry);
 
     if (sendco->done) {
-        sendco->co = qemu_coroutine_create(_compare_chr_send, sendco);
-        sendco->done = false;
-        qemu_coroutine_enter(sendco->co);
-        if (sendco->done) {
-            /* report early errors */
-            return sendco->ret;
-        }
+        defer_call(compare_chr_kick, sendco);
     }
-
-    /* assume success */
     return 0;
 }
 
@@ -846,7 +883,9 @@ static void compare_pri_chr_in(void *opaque, const uint8_t *buf, int size)
     CompareState *s = COLO_COMPARE(opaque);
     int ret;
 
+    defer_call_begin();
     ret = net_fill_rstate(&s->pri_rs, buf, size);
+    defer_call_end();
     if (ret == -1) {
         qemu_chr_fe_set_handlers(&s->chr_pri_in, NULL, NULL, NULL, NULL,
                                  NULL, NULL, true);
@@ -863,7 +902,9 @@ static void compare_sec_chr_in(void *opaque, const uint8_t *buf, int size)
     CompareState *s = COLO_COMPARE(opaque);
     int ret;
 
+    defer_call_begin();
     ret = net_fill_rstate(&s->sec_rs, buf, size);
+    defer_call_end();
     if (ret == -1) {
         qemu_chr_fe_set_handlers(&s->chr_sec_in, NULL, NULL, NULL, NULL,
                                  NULL, NULL, true);
@@ -951,7 +992,9 @@ static void colo_compare_handle_event(void *opaque)
 
     switch (s->event) {
     case COLO_EVENT_CHECKPOINT:
+        defer_call_begin();
         g_queue_foreach(&s->conn_list, colo_flush_packets, s);
+        defer_call_end();
         break;
     case COLO_EVENT_FAILOVER:
         break;
@@ -1196,7 +1239,9 @@ static void compare_notify_rs_finalize(SocketReadState *notify_rs)
                                   notify_rs->buf,
                                   notify_rs->packet_len)) {
         /* colo-compare do checkpoint, flush pri packet and remove sec packet */
+        defer_call_begin();
         g_queue_foreach(&s->conn_list, colo_flush_packets, s);
+        defer_call_end();
     } else {
         error_report("COLO compare got unsupported instruction");
     }
@@ -1302,6 +1347,7 @@ static void colo_compare_complete(UserCreatable *uc, Error **errp)
     s->out_sendco.notify_remote_frame = false;
     s->out_sendco.done = true;
     g_queue_init(&s->out_sendco.send_list);
+    s->out_sendco.batch = g_byte_array_sized_new(COMPARE_SEND_BATCH_MAX);
 
     if (s->notify_dev) {
         s->notify_sendco.s = s;
@@ -1309,6 +1355,7 @@ static void colo_compare_complete(UserCreatable *uc, Error **errp)
         s->notify_sendco.notify_remote_frame = true;
         s->notify_sendco.done = true;
         g_queue_init(&s->notify_sendco.send_list);
+        s->notify_sendco.batch = g_byte_array_new();
     }
 
     g_queue_init(&s->conn_list);
@@ -1446,8 +1493,14 @@ static void colo_compare_finalize(Object *obj)
 
     g_queue_clear(&s->conn_list);
     g_queue_clear(&s->out_sendco.send_list);
+    if (s->out_sendco.batch) {
+        g_byte_array_unref(s->out_sendco.batch);
+    }
     if (s->notify_dev) {
         g_queue_clear(&s->notify_sendco.send_list);
+        if (s->notify_sendco.batch) {
+            g_byte_array_unref(s->notify_sendco.batch);
+        }
     }
 
     if (s->connection_track_table) {
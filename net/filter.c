@@ -245,6 +245,12 @@ static void netfilter_complete(UserCreatable *uc, Error **errp)
         return;
     }
 
+    /* Filters run in the main loop, see qemu_set_net_aio_context() */
+    if (ncs[0]->ctx) {
+        error_setg(errp, "Netdev served by an IOThread is not supported");
+        return;
+    }
+
     if (strcmp(nf->position, "head") && strcmp(nf->position, "tail")) {
         Object *container;
         Object *obj;
@@ -350,6 +350,7 @@ static void net_l2tpv3_process_queue(NetL2TPV3State *s)
 
     /* go into ring mode only if there is a "pending" tail */
     if (s->queue_depth > 0) {
+        qemu_send_batch_begin(&s->nc);
         do {
             msgvec = s->msgvec + s->queue_tail;
             if (msgvec->msg_len > 0) {
@@ -390,6 +391,7 @@ static void net_l2tpv3_process_queue(NetL2TPV3State *s)
                  qemu_can_send_packet(&s->nc) &&
                 ((size > 0) || bad_read)
             );
+        qemu_send_batch_end(&s->nc);
     }
 }
 
@@ -47,6 +47,7 @@
 #include "qemu/iov.h"
 #include "qemu/qemu-print.h"
 #include "qemu/main-loop.h"
+#include "block/aio-wait.h"
 #include "qemu/option.h"
 #include "qemu/keyval.h"
 #include "qapi/error.h"
@@ -381,6 +382,23 @@ NetClientState *qemu_get_peer(NetClientState *nc, int queue_index)
     return ncs->peer;
 }
 
+/*
+ * Bring @nc and its peer back to the main loop if the NIC among them has
+ * moved them to an IOThread, or let the NIC move them again.
+ */
+static void net_client_quiesce(NetClientState *nc, bool quiesce)
+{
+    NetClientState *nic = nc;
+
+    if (nc->info->type != NET_CLIENT_DRIVER_NIC) {
+        nic = nc->peer;
+    }
+    if (nic && nic->info->type == NET_CLIENT_DRIVER_NIC &&
+        nic->info->quiesce) {
+        nic->info->quiesce(nic, quiesce);
+    }
+}
+
 static void qemu_cleanup_net_client(NetClientState *nc,
                                     bool remove_from_net_clients)
 {
@@ -424,6 +442,9 @@ void qemu_del_net_client(NetClientState *nc)
                                           MAX_QUEUE_NUM);
     assert(queues != 0);
 
+    /* The NIC does not move a deleted peer to an IOThread again */
+    net_client_quiesce(nc, true);
+
     QTAILQ_FOREACH_SAFE(nf, &nc->filters, next, next) {
         object_unparent(OBJECT(nf));
     }
@@ -438,6 +459,7 @@ void qemu_del_net_client(NetClientState *nc)
     if (nc->peer && nc->peer->info->type == NET_CLIENT_DRIVER_NIC) {
         NICState *nic = qemu_get_nic(nc->peer);
         if (nic->peer_deleted) {
+            net_client_quiesce(nc, false);
             return;
         }
         nic->peer_deleted = true;
@@ -451,9 +473,11 @@ void qemu_del_net_client(NetClientState *nc)
             nc->peer->info->link_status_changed(nc->peer);
         }
 
+        net_client_quiesce(nc, false);
         return;
     }
 
+    /* Only NIC peers are moved to IOThreads, so nothing to resume here */
     for (i = 0; i < queues; i++) {
         qemu_cleanup_net_client(ncs[i], true);
         qemu_free_net_client(ncs[i]);
@@ -700,8 +724,81 @@ void qemu_purge_queued_packets(NetClientState *nc)
     qemu_net_queue_purge(nc->peer->incoming_queue, nc);
 }
 
+static void net_receive_batch_begin(NetClientState *nc)
+{
+    nc->receive_batch++;
+}
+
+static void net_receive_batch_end(NetClientState *nc)
+{
+    assert(nc->receive_batch > 0);
+    if (--nc->receive_batch == 0 && nc->info->receive_batch_end) {
+        nc->info->receive_batch_end(nc);
+    }
+}
+
+void qemu_send_batch_begin(NetClientState *nc)
+{
+    if (nc->peer) {
+        net_receive_batch_begin(nc->peer);
+    }
+}
+
+void qemu_send_batch_end(NetClientState *nc)
+{
+    if (nc->peer) {
+        net_receive_batch_end(nc->peer);
+    }
+}
+
+bool qemu_can_set_net_aio_context(NetClientState *nc)
+{
+    return nc->info->set_aio_context != NULL;
+}
+
+void qemu_set_net_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    if (nc->info->set_aio_context) {
+        nc->info->set_aio_context(nc, ctx);
+    }
+    nc->ctx = ctx;
+}
+
+/* A packet sent from outside the sender's IOThread, see net_send_elsewhere() */
+typedef struct NetSendElsewhere {
+    NetClientState *sender;
+    unsigned flags;
+    const uint8_t *buf;
+    int size;
+    const struct iovec *iov;
+    int iovcnt;
+    NetPacketSent *sent_cb;
+    ssize_t ret;
+} NetSendElsewhere;
+
+static void net_send_elsewhere_bh(void *opaque);
+
+/*
+ * Clients served by an IOThread only expect packets from it, but the main
+ * loop still sends some of its own, e.g. self-announcements.  Send them
+ * from the IOThread and wait for the result.
+ */
+static bool net_send_elsewhere(NetSendElsewhere *s)
+{
+    AioContext *ctx = s->sender->ctx;
+
+    if (likely(!ctx || ctx == qemu_get_current_aio_context())) {
+        return false;
+    }
+
+    aio_wait_bh_oneshot(ctx, net_send_elsewhere_bh, s);
+    return true;
+}
+
 void qemu_flush_or_purge_queued_packets(NetClientState *nc, bool purge)
 {
+    bool flushed;
+
     nc->receive_disabled = 0;
 
     if (nc->peer && nc->peer->info->type == NET_CLIENT_DRIVER_HUBPORT) {
@@ -709,7 +806,12 @@ void qemu_flush_or_purge_queued_packets(NetClientState *nc, bool purge)
             qemu_notify_event();
         }
     }
-    if (qemu_net_queue_flush(nc->incoming_queue)) {
+
+    net_receive_batch_begin(nc);
+    flushed = qemu_net_queue_flush(nc->incoming_queue);
+    net_receive_batch_end(nc);
+
+    if (flushed) {
         /* We emptied the queue successfully, signal to the IO thread to repoll
          * the file descriptor (for tap, for example).
          */
@@ -732,6 +834,14 @@ static ssize_t qemu_send_packet_async_with_flags(NetClientState *sender,
 {
     NetQueue *queue;
     int ret;
+    NetSendElsewhere s = {
+        .sender = sender, .flags = flags, .buf = buf, .size = size,
+        .sent_cb = sent_cb,
+    };
+
+    if (net_send_elsewhere(&s)) {
+        return s.ret;
+    }
 
 #ifdef DEBUG_NET
     printf("qemu_send_packet_async:\n");
@@ -887,11 +997,18 @@ ssize_t qemu_sendv_packet_async(NetClientState *sender,
     NetQueue *queue;
     size_t size = iov_size(iov, iovcnt);
     int ret;
+    NetSendElsewhere s = {
+        .sender = sender, .iov = iov, .iovcnt = iovcnt, .sent_cb = sent_cb,
+    };
 
     if (size > NET_BUFSIZE) {
         return size;
     }
 
+    if (net_send_elsewhere(&s)) {
+        return s.ret;
+    }
+
     if (sender->link_down || !sender->peer) {
         return size;
     }
@@ -922,6 +1039,20 @@ qemu_sendv_packet(NetClientState *nc, const struct iovec *iov, int iovcnt)
     return qemu_sendv_packet_async(nc, iov, iovcnt, NULL);
 }
 
+static void net_send_elsewhere_bh(void *opaque)
+{
+    NetSendElsewhere *s = opaque;
+
+    if (s->iov) {
+        s->ret = qemu_sendv_packet_async(s->sender, s->iov, s->iovcnt,
+                                         s->sent_cb);
+    } else {
+        s->ret = qemu_send_packet_async_with_flags(s->sender, s->flags,
+                                                   s->buf, s->size,
+                                                   s->sent_cb);
+    }
+}
+
 NetClientState *qemu_find_netdev(const char *id)
 {
     NetClientState *nc;
@@ -1545,6 +1676,31 @@ static void netfilter_print_info(Monitor *mon, NetFilterState *nf)
     monitor_printf(mon, "\n");
 }
 
+typedef struct NetQueueStatsRequest {
+    NetQueue *queue;
+    NetQueueStats *stats;
+} NetQueueStatsRequest;
+
+static void net_queue_get_stats_bh(void *opaque)
+{
+    NetQueueStatsRequest *req = opaque;
+
+    qemu_net_queue_get_stats(req->queue, req->stats);
+}
+
+/* The queue belongs to @nc's IOThread if it has one */
+static void net_client_get_queue_stats(NetClientState *nc,
+                                       NetQueueStats *stats)
+{
+    NetQueueStatsRequest req = { nc->incoming_queue, stats };
+
+    if (nc->ctx && nc->ctx != qemu_get_current_aio_context()) {
+        aio_wait_bh_oneshot(nc->ctx, net_queue_get_stats_bh, &req);
+    } else {
+        net_queue_get_stats_bh(&req);
+    }
+}
+
 void print_net_client(Monitor *mon, NetClientState *nc)
 {
     NetFilterState *nf;
@@ -1553,6 +1709,23 @@ void print_net_client(Monitor *mon, NetClientState *nc)
                    nc->queue_index,
                    NetClientDriver_str(nc->info->type),
                    nc->info_str);
+    if (nc->incoming_queue) {
+        NetQueueStats stats;
+
+        net_client_get_queue_stats(nc, &stats);
+        if (stats.queued || stats.dropped) {
+            monitor_printf(mon, "  queue: depth=%" PRIu32
+                           ",max-depth=%" PRIu32 ",queued=%" PRIu64
+                           ",dropped=%" PRIu64 ",flushed=%" PRIu64
+                           ",purged=%" PRIu64 ",flush-latency-avg=%" PRIu64
+                           "us,flush-latency-max=%" PRIu64 "us\n",
+                           stats.depth, stats.max_depth, stats.queued,
+                           stats.dropped, stats.flushed, stats.purged,
+                           stats.flushed ? stats.flush_latency_total_ns /
+                                           stats.flushed / SCALE_US : 0,
+                           stats.flush_latency_max_ns / SCALE_US);
+        }
+    }
     if (!QTAILQ_EMPTY(&nc->filters)) {
         monitor_printf(mon, "filters:\n");
     }
@@ -1640,6 +1813,9 @@ void net_client_set_link(NetClientState **ncs, int queues, bool up)
 
     nc = ncs[0];
 
+    /* Link status changes flush and purge queues that IOThreads use */
+    net_client_quiesce(nc, true);
+
     for (i = 0; i < queues; i++) {
         ncs[i]->link_down = !up;
     }
@@ -1666,6 +1842,8 @@ void net_client_set_link(NetClientState **ncs, int queues, bool up)
             nc->peer->info->link_status_changed(nc->peer);
         }
     }
+
+    net_client_quiesce(nc, false);
 }
 
 void qmp_set_link(const char *name, bool up, Error **errp)
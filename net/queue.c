@@ -23,8 +23,12 @@
 
 #include "qemu/osdep.h"
 #include "net/queue.h"
-#include "qemu/queue.h"
+#include "qemu/host-utils.h"
+#include "qemu/iov.h"
+#include "qemu/timer.h"
+#include "qemu/units.h"
 #include "net/net.h"
+#include "trace.h"
 
 /* The delivery handler may only return zero if it will call
  * qemu_net_queue_flush() when it determines that it is once again able
@@ -40,12 +44,30 @@
  * unbounded queueing.
  */
 
+/*
+ * Queued packets are kept in a ring of pointers that grows on demand, and
+ * the buffers of delivered packets are recycled for later ones.  A queue
+ * that is under sustained backpressure then stops hitting the allocator
+ * for every packet it holds.  The recycled buffers are limited in number
+ * and in total size, since they stay around for the queue's lifetime.  A
+ * queue is only ever touched from the thread that runs its NetClientState,
+ * so none of this needs locking.
+ */
+
+#define NET_QUEUE_RING_MIN          16
+#define NET_QUEUE_CACHE_SIZE        16
+#define NET_QUEUE_CACHE_BYTES       (128 * KiB)
+#define NET_PACKET_MIN              256
+#define NET_PACKET_ALIGN            2048
+#define NET_PACKET_CACHE_MAX        (64 * KiB + NET_PACKET_ALIGN)
+
 struct NetPacket {
-    QTAILQ_ENTRY(NetPacket) entry;
     NetClientState *sender;
     unsigned flags;
     int size;
+    size_t capacity;
     NetPacketSent *sent_cb;
+    int64_t queued_ns;
     uint8_t data[];
 };
 
@@ -55,7 +77,17 @@ struct NetQueue {
     uint32_t nq_count;
     NetQueueDeliverFunc *deliver;
 
-    QTAILQ_HEAD(, NetPacket) packets;
+    /* Ring of nq_count packets starting at ring_head; ring_size is 2^n */
+    NetPacket **ring;
+    uint32_t ring_size;
+    uint32_t ring_head;
+
+    /* Buffers of delivered packets, waiting to be reused */
+    NetPacket *cache[NET_QUEUE_CACHE_SIZE];
+    unsigned cache_count;
+    size_t cache_bytes;
+
+    NetQueueStats stats;
 
     unsigned delivering : 1;
 };
@@ -71,8 +103,6 @@ NetQueue *qemu_new_net_queue(NetQueueDeliverFunc *deliver, void *opaque)
     queue->nq_count = 0;
     queue->deliver = deliver;
 
-    QTAILQ_INIT(&queue->packets);
-
     queue->delivering = 0;
 
     return queue;
@@ -80,16 +110,161 @@ NetQueue *qemu_new_net_queue(NetQueueDeliverFunc *deliver, void *opaque)
 
 void qemu_del_net_queue(NetQueue *queue)
 {
-    NetPacket *packet, *next;
+    uint32_t i;
 
-    QTAILQ_FOREACH_SAFE(packet, &queue->packets, entry, next) {
-        QTAILQ_REMOVE(&queue->packets, packet, entry);
-        g_free(packet);
+    for (i = 0; i < queue->nq_count; i++) {
+        g_free(queue->ring[(queue->ring_head + i) & (queue->ring_size - 1)]);
+    }
+    for (i = 0; i < queue->cache_count; i++) {
+        g_free(queue->cache[i]);
     }
 
+    g_free(queue->ring);
     g_free(queue);
 }
 
+void qemu_net_queue_get_stats(NetQueue *queue, NetQueueStats *stats)
+{
+    *stats = queue->stats;
+    stats->depth = queue->nq_count;
+}
+
+/*
+ * Rounds buffers that may be recycled up to a few size classes, so that
+ * they fit later packets of similar size: powers of two for small packets,
+ * 2 KiB steps above.  Buffers that are too large to be cached are
+ * allocated to the exact size.
+ */
+static size_t qemu_net_packet_capacity(size_t size)
+{
+    if (size > NET_PACKET_CACHE_MAX) {
+        return size;
+    }
+    if (size <= NET_PACKET_ALIGN) {
+        return MAX(pow2ceil(size), NET_PACKET_MIN);
+    }
+    return QEMU_ALIGN_UP(size, NET_PACKET_ALIGN);
+}
+
+/* Takes the smallest cached buffer that fits, so large ones are kept */
+static NetPacket *qemu_net_packet_alloc(NetQueue *queue, size_t size)
+{
+    size_t capacity = qemu_net_packet_capacity(size);
+    NetPacket *packet;
+    unsigned i, best = queue->cache_count;
+
+    for (i = 0; i < queue->cache_count; i++) {
+        packet = queue->cache[i];
+        if (packet->capacity >= size &&
+            (best == queue->cache_count ||
+             packet->capacity < queue->cache[best]->capacity)) {
+            best = i;
+            if (packet->capacity == capacity) {
+                break;
+            }
+        }
+    }
+
+    if (best < queue->cache_count) {
+        packet = queue->cache[best];
+        queue->cache[best] = queue->cache[--queue->cache_count];
+        queue->cache_bytes -= packet->capacity;
+        return packet;
+    }
+
+    packet = g_malloc(sizeof(NetPacket) + capacity);
+    packet->capacity = capacity;
+    return packet;
+}
+
+static void qemu_net_packet_free(NetQueue *queue, NetPacket *packet)
+{
+    if (queue->cache_count < NET_QUEUE_CACHE_SIZE &&
+        packet->capacity <= NET_PACKET_CACHE_MAX &&
+        queue->cache_bytes + packet->capacity <= NET_QUEUE_CACHE_BYTES) {
+        queue->cache[queue->cache_count++] = packet;
+        queue->cache_bytes += packet->capacity;
+    } else {
+        g_free(packet);
+    }
+}
+
+static void qemu_net_queue_grow(NetQueue *queue)
+{
+    uint32_t new_size = MAX(queue->ring_size * 2, NET_QUEUE_RING_MIN);
+    NetPacket **ring = g_new(NetPacket *, new_size);
+    uint32_t i;
+
+    for (i = 0; i < queue->nq_count; i++) {
+        ring[i] = queue->ring[(queue->ring_head + i) & (queue->ring_size - 1)];
+    }
+
+    g_free(queue->ring);
+    queue->ring = ring;
+    queue->ring_size = new_size;
+    queue->ring_head = 0;
+}
+
+static void qemu_net_queue_insert_tail(NetQueue *queue, NetPacket *packet)
+{
+    if (queue->nq_count == queue->ring_size) {
+        qemu_net_queue_grow(queue);
+    }
+    queue->ring[(queue->ring_head + queue->nq_count) &
+                (queue->ring_size - 1)] = packet;
+    queue->nq_count++;
+}
+
+static void qemu_net_queue_insert_head(NetQueue *queue, NetPacket *packet)
+{
+    if (queue->nq_count == queue->ring_size) {
+        qemu_net_queue_grow(queue);
+    }
+    queue->ring_head = (queue->ring_head - 1) & (queue->ring_size - 1);
+    queue->ring[queue->ring_head] = packet;
+    queue->nq_count++;
+}
+
+static NetPacket *qemu_net_queue_remove_head(NetQueue *queue)
+{
+    NetPacket *packet = queue->ring[queue->ring_head];
+
+    queue->ring_head = (queue->ring_head + 1) & (queue->ring_size - 1);
+    queue->nq_count--;
+    return packet;
+}
+
+static NetPacket *qemu_net_queue_new_packet(NetQueue *queue,
+                                            NetClientState *sender,
+                                            unsigned flags,
+                                            size_t size,
+                                            NetPacketSent *sent_cb)
+{
+    NetPacket *packet;
+
+    if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
+        /* drop if queue full and no callback */
+        queue->stats.dropped++;
+        trace_qemu_net_queue_drop(queue, size);
+        return NULL;
+    }
+
+    packet = qemu_net_packet_alloc(queue, size);
+    packet->sender = sender;
+    packet->flags = flags;
+    packet->size = size;
+    packet->sent_cb = sent_cb;
+    packet->queued_ns = get_clock();
+    return packet;
+}
+
+static void qemu_net_queue_append_packet(NetQueue *queue, NetPacket *packet)
+{
+    qemu_net_queue_insert_tail(queue, packet);
+    queue->stats.queued++;
+    queue->stats.max_depth = MAX(queue->stats.max_depth, queue->nq_count);
+}
+
 static void qemu_net_queue_append(NetQueue *queue,
                                   NetClientState *sender,
                                   unsigned flags,
@@ -99,18 +274,13 @@ static void qemu_net_queue_append(NetQueue *queue,
 {
     NetPacket *packet;
 
-    if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
-        return; /* drop if queue full and no callback */
+    packet = qemu_net_queue_new_packet(queue, sender, flags, size, sent_cb);
+    if (!packet) {
+        return;
     }
-    packet = g_malloc(sizeof(NetPacket) + size);
-    packet->sender = sender;
-    packet->flags = flags;
-    packet->size = size;
-    packet->sent_cb = sent_cb;
     memcpy(packet->data, buf, size);
 
-    queue->nq_count++;
-    QTAILQ_INSERT_TAIL(&queue->packets, packet, entry);
+    qemu_net_queue_append_packet(queue, packet);
 }
 
 void qemu_net_queue_append_iov(NetQueue *queue,
@@ -121,31 +291,15 @@ void qemu_net_queue_append_iov(NetQueue *queue,
                                NetPacketSent *sent_cb)
 {
     NetPacket *packet;
-    size_t max_len = 0;
-    int i;
+    size_t size = iov_size(iov, iovcnt);
 
-    if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
-        return; /* drop if queue full and no callback */
-    }
-    for (i = 0; i < iovcnt; i++) {
-        max_len += iov[i].iov_len;
+    packet = qemu_net_queue_new_packet(queue, sender, flags, size, sent_cb);
+    if (!packet) {
+        return;
     }
+    iov_to_buf(iov, iovcnt, 0, packet->data, size);
 
-    packet = g_malloc(sizeof(NetPacket) + max_len);
-    packet->sender = sender;
-    packet->sent_cb = sent_cb;
-    packet->flags = flags;
-    packet->size = 0;
-
-    for (i = 0; i < iovcnt; i++) {
-        size_t len = iov[i].iov_len;
-
-        memcpy(packet->data + packet->size, iov[i].iov_base, len);
-        packet->size += len;
-    }
-
-    queue->nq_count++;
-    QTAILQ_INSERT_TAIL(&queue->packets, packet, entry);
+    qemu_net_queue_append_packet(queue, packet);
 }
 
 static ssize_t qemu_net_queue_deliver(NetQueue *queue,
@@ -245,18 +399,37 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
 
 void qemu_net_queue_purge(NetQueue *queue, NetClientState *from)
 {
-    NetPacket *packet, *next;
+    g_autofree NetPacket **purged = NULL;
+    uint32_t i, kept = 0, n_purged = 0;
+
+    if (!queue->nq_count) {
+        return;
+    }
+
+    /*
+     * Compact the ring first and run the callbacks afterwards, since they
+     * may queue new packets.
+     */
+    purged = g_new(NetPacket *, queue->nq_count);
+    for (i = 0; i < queue->nq_count; i++) {
+        uint32_t mask = queue->ring_size - 1;
+        NetPacket *packet = queue->ring[(queue->ring_head + i) & mask];
 
-    QTAILQ_FOREACH_SAFE(packet, &queue->packets, entry, next) {
         if (packet->sender == from) {
-            QTAILQ_REMOVE(&queue->packets, packet, entry);
-            queue->nq_count--;
-            if (packet->sent_cb) {
-                packet->sent_cb(packet->sender, 0);
-            }
-            g_free(packet);
+            purged[n_purged++] = packet;
+        } else {
+            queue->ring[(queue->ring_head + kept++) & mask] = packet;
         }
     }
+    queue->nq_count = kept;
+    queue->stats.purged += n_purged;
+
+    for (i = 0; i < n_purged; i++) {
+        if (purged[i]->sent_cb) {
+            purged[i]->sent_cb(purged[i]->sender, 0);
+        }
+        qemu_net_packet_free(queue, purged[i]);
+    }
 }
 
 bool qemu_net_queue_flush(NetQueue *queue)
@@ -264,13 +437,12 @@ bool qemu_net_queue_flush(NetQueue *queue)
     if (queue->delivering)
         return false;
 
-    while (!QTAILQ_EMPTY(&queue->packets)) {
+    while (queue->nq_count) {
         NetPacket *packet;
+        uint64_t latency;
         int ret;
 
-        packet = QTAILQ_FIRST(&queue->packets);
-        QTAILQ_REMOVE(&queue->packets, packet, entry);
-        queue->nq_count--;
+        packet = qemu_net_queue_remove_head(queue);
 
         ret = qemu_net_queue_deliver(queue,
                                      packet->sender,
@@ -278,16 +450,21 @@ bool qemu_net_queue_flush(NetQueue *queue)
                                      packet->data,
                                      packet->size);
         if (ret == 0) {
-            queue->nq_count++;
-            QTAILQ_INSERT_HEAD(&queue->packets, packet, entry);
+            qemu_net_queue_insert_head(queue, packet);
             return false;
         }
 
+        latency = get_clock() - packet->queued_ns;
+        queue->stats.flushed++;
+        queue->stats.flush_latency_total_ns += latency;
+        queue->stats.flush_latency_max_ns =
+            MAX(queue->stats.flush_latency_max_ns, latency);
+
         if (packet->sent_cb) {
             packet->sent_cb(packet->sender, ret);
         }
 
-        g_free(packet);
+        qemu_net_packet_free(queue, packet);
     }
     return true;
 }
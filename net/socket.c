@@ -43,6 +43,7 @@ typedef struct NetSocketState {
     IOHandler *send_fn;           /* differs between SOCK_STREAM/SOCK_DGRAM */
     bool read_poll;               /* waiting to receive data? */
     bool write_poll;              /* waiting to transmit data? */
+    AioContext *ctx;              /* where the fd handlers run */
 } NetSocketState;
 
 static void net_socket_accept(void *opaque);
@@ -50,10 +51,10 @@ static void net_socket_writable(void *opaque);
 
 static void net_socket_update_fd_handler(NetSocketState *s)
 {
-    qemu_set_fd_handler(s->fd,
-                        s->read_poll ? s->send_fn : NULL,
-                        s->write_poll ? net_socket_writable : NULL,
-                        s);
+    aio_set_fd_handler(s->ctx, s->fd,
+                       s->read_poll ? s->send_fn : NULL,
+                       s->write_poll ? net_socket_writable : NULL,
+                       NULL, NULL, s);
 }
 
 static void net_socket_read_poll(NetSocketState *s, bool enable)
@@ -322,10 +323,29 @@ static void net_socket_cleanup(NetClientState *nc)
     }
 }
 
+/*
+ * Only the handlers of the data socket move; accepting and connecting
+ * always happen in the main loop.
+ */
+static void net_socket_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    NetSocketState *s = DO_UPCAST(NetSocketState, nc, nc);
+    bool active = s->fd != -1 && s->send_fn;
+
+    if (active) {
+        aio_set_fd_handler(s->ctx, s->fd, NULL, NULL, NULL, NULL, NULL);
+    }
+    s->ctx = ctx ?: iohandler_get_aio_context();
+    if (active) {
+        net_socket_update_fd_handler(s);
+    }
+}
+
 static NetClientInfo net_dgram_socket_info = {
     .type = NET_CLIENT_DRIVER_SOCKET,
     .size = sizeof(NetSocketState),
     .receive = net_socket_receive_dgram,
+    .set_aio_context = net_socket_set_aio_context,
     .cleanup = net_socket_cleanup,
 };
 
@@ -381,6 +401,7 @@ static NetSocketState *net_socket_fd_init_dgram(NetClientState *peer,
 
     s->fd = fd;
     s->listen_fd = -1;
+    s->ctx = iohandler_get_aio_context();
     s->send_fn = net_socket_send_dgram;
     net_socket_rs_init(&s->rs, net_socket_rs_finalize, false);
     net_socket_read_poll(s, true);
@@ -409,6 +430,8 @@ err:
 static void net_socket_connect(void *opaque)
 {
     NetSocketState *s = opaque;
+    /* The pending connect is watched in the main loop even if s->ctx isn't */
+    qemu_set_fd_handler(s->fd, NULL, NULL, NULL);
     s->send_fn = net_socket_send;
     net_socket_read_poll(s, true);
 }
@@ -417,6 +440,7 @@ static NetClientInfo net_socket_info = {
     .type = NET_CLIENT_DRIVER_SOCKET,
     .size = sizeof(NetSocketState),
     .receive = net_socket_receive,
+    .set_aio_context = net_socket_set_aio_context,
     .cleanup = net_socket_cleanup,
 };
 
@@ -436,6 +460,7 @@ static NetSocketState *net_socket_fd_init_stream(NetClientState *peer,
 
     s->fd = fd;
     s->listen_fd = -1;
+    s->ctx = iohandler_get_aio_context();
     net_socket_rs_init(&s->rs, net_socket_rs_finalize, false);
 
     /* Disable Nagle algorithm on TCP sockets to reduce latency */
@@ -536,6 +561,7 @@ static int net_socket_listen_init(NetClientState *peer,
     s = DO_UPCAST(NetSocketState, nc, nc);
     s->fd = -1;
     s->listen_fd = fd;
+    s->ctx = iohandler_get_aio_context();
     s->nc.link_down = true;
     net_socket_rs_init(&s->rs, net_socket_rs_finalize, false);
 
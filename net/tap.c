@@ -83,6 +83,7 @@ typedef struct TAPState {
     VHostNetState *vhost_net;
     unsigned host_vnet_hdr_len;
     Notifier exit;
+    AioContext *ctx; /* where the fd handlers run */
 } TAPState;
 
 static void launch_script(const char *setup_script, const char *ifname,
@@ -93,10 +94,10 @@ static void tap_writable(void *opaque);
 
 static void tap_update_fd_handler(TAPState *s)
 {
-    qemu_set_fd_handler(s->fd,
-                        s->read_poll && s->enabled ? tap_send : NULL,
-                        s->write_poll && s->enabled ? tap_writable : NULL,
-                        s);
+    aio_set_fd_handler(s->ctx, s->fd,
+                       s->read_poll && s->enabled ? tap_send : NULL,
+                       s->write_poll && s->enabled ? tap_writable : NULL,
+                       NULL, NULL, s);
 }
 
 static void tap_read_poll(TAPState *s, bool enable)
@@ -183,6 +184,7 @@ static void tap_send(void *opaque)
     int size;
     int packets = 0;
 
+    qemu_send_batch_begin(&s->nc);
     while (true) {
         uint8_t *buf = s->buf;
         uint8_t min_pkt[ETH_ZLEN];
@@ -229,6 +231,7 @@ static void tap_send(void *opaque)
             break;
         }
     }
+    qemu_send_batch_end(&s->nc);
 }
 
 static bool tap_has_ufo(NetClientState *nc)
@@ -347,6 +350,15 @@ static void tap_poll(NetClientState *nc, bool enable)
     tap_write_poll(s, enable);
 }
 
+static void tap_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+
+    aio_set_fd_handler(s->ctx, s->fd, NULL, NULL, NULL, NULL, NULL);
+    s->ctx = ctx ?: iohandler_get_aio_context();
+    tap_update_fd_handler(s);
+}
+
 static bool tap_set_steering_ebpf(NetClientState *nc, int prog_fd)
 {
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
@@ -382,6 +394,7 @@ static NetClientInfo net_tap_info = {
     .receive = tap_receive,
     .receive_iov = tap_receive_iov,
     .poll = tap_poll,
+    .set_aio_context = tap_set_aio_context,
     .cleanup = tap_cleanup,
     .has_ufo = tap_has_ufo,
     .has_uso = tap_has_uso,
@@ -417,6 +430,7 @@ static TAPState *net_tap_fd_init(NetClientState *peer,
     s->has_uso = tap_probe_has_uso(s->fd);
     s->has_tunnel = tap_probe_has_tunnel(s->fd);
     s->enabled = true;
+    s->ctx = iohandler_get_aio_context();
     tap_set_offload(&s->nc, &ol);
     /*
      * Make sure host header length is set correctly in tap:
@@ -1660,7 +1660,8 @@ enum ImgConvertBlockStatus {
     BLK_BACKING_FILE,
 };
 
-#define MAX_COROUTINES 16
+#define MAX_COROUTINES 64
+#define DEFAULT_COROUTINES 8
 #define CONVERT_THROTTLE_GROUP "img_convert"
 
 typedef struct ImgConvertState {
@@ -2257,7 +2258,6 @@ static int img_convert(const img_cmd_t *ccmd, int argc, char **argv)
         .copy_range         = false,
         .buf_sectors        = IO_BUF_SIZE / BDRV_SECTOR_SIZE,
         .wr_in_order        = true,
-        .num_coroutines     = 8,
     };
 
     for(;;) {
@@ -2352,7 +2352,8 @@ static int img_convert(const img_cmd_t *ccmd, int argc, char **argv)
 "  -r, --rate-limit RATE\n"
 "     I/O rate limit, in bytes per second\n"
 "  -m, --parallel NUM_PARALLEL\n"
-"     specify parallelism (default: 8)\n"
+"     specify parallelism (default: 8, or one per host CPU for compressed\n"
+"     output)\n"
 "  -C, --copy-range-offloading\n"
 "     try to use copy offloading\n"
 "  -W, --oob-writes\n"
@@ -2860,6 +2861,21 @@ static int img_convert(const img_cmd_t *ccmd, int argc, char **argv)
         s.cluster_sectors = bdi.cluster_size / BDRV_SECTOR_SIZE;
     }
 
+    if (!s.num_coroutines) {
+        /*
+         * Compressed writes cover only a single cluster each, and the
+         * compression of a cluster happens in a worker thread while its
+         * coroutine waits. Keep enough requests in flight to use all host
+         * CPUs for compression.
+         */
+        s.num_coroutines = DEFAULT_COROUTINES;
+        if (s.compressed) {
+            s.num_coroutines = MIN(MAX_COROUTINES,
+                                   MAX(DEFAULT_COROUTINES,
+                                       g_get_num_processors()));
+        }
+    }
+
     if (rate_limit) {
         set_rate_limit(s.target, rate_limit);
     }
@@ -71,6 +71,7 @@
 #define QEMU_NBD_OPT_SELINUX_LABEL   266
 #define QEMU_NBD_OPT_TLSHOSTNAME     267
 #define QEMU_NBD_OPT_HANDSHAKE_LIMIT 268
+#define QEMU_NBD_OPT_ZERO_COPY       269
 
 #define MBR_SIZE 512
 
@@ -109,6 +110,7 @@ static void usage(const char *name)
 "  -o, --offset=OFFSET       offset into the image\n"
 "  -A, --allocation-depth    expose the allocation depth\n"
 "  -B, --bitmap=NAME         expose a persistent dirty bitmap\n"
+"      --zero-copy           send large reads without copying (MSG_ZEROCOPY)\n"
 "\n"
 "General purpose options:\n"
 "  -L, --list                list exports available from another NBD server\n"
@@ -573,6 +575,7 @@ int main(int argc, char **argv)
         { "description", required_argument, NULL, 'D' },
         { "handshake-limit", required_argument, NULL,
           QEMU_NBD_OPT_HANDSHAKE_LIMIT },
+        { "zero-copy", no_argument, NULL, QEMU_NBD_OPT_ZERO_COPY },
         { "tls-creds", required_argument, NULL, QEMU_NBD_OPT_TLSCREDS },
         { "tls-hostname", required_argument, NULL, QEMU_NBD_OPT_TLSHOSTNAME },
         { "tls-authz", required_argument, NULL, QEMU_NBD_OPT_TLSAUTHZ },
@@ -601,6 +604,7 @@ int main(int argc, char **argv)
     const char *export_description = NULL;
     BlockDirtyBitmapOrStrList *bitmaps = NULL;
     bool alloc_depth = false;
+    bool zero_copy = false;
     const char *tlscredsid = NULL;
     const char *tlshostname = NULL;
     bool imageOpts = false;
@@ -826,6 +830,9 @@ int main(int argc, char **argv)
                 exit(EXIT_FAILURE);
             }
             break;
+        case QEMU_NBD_OPT_ZERO_COPY:
+            zero_copy = true;
+            break;
         }
     }
 
@@ -1189,6 +1196,8 @@ int main(int argc, char **argv)
             .bitmaps              = bitmaps,
             .has_allocation_depth = alloc_depth,
             .allocation_depth     = alloc_depth,
+            .has_zero_copy        = zero_copy,
+            .zero_copy            = zero_copy,
         },
     };
     blk_exp_add(export_opts, &error_fatal);
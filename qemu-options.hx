@@ -2978,6 +2978,7 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off]\n"
     "         [,queues=n][,start-queue=m][,inhibit=on|off][,sock-fds=x:y:...:z]\n"
     "         [,map-path=/path/to/socket/map][,map-start-index=i]\n"
+    "         [,busy-poll=usecs][,busy-poll-budget=n]\n"
     "                attach to the existing network interface 'name' with AF_XDP socket\n"
     "                use 'mode=MODE' to specify an XDP program attach mode\n"
     "                use 'force-copy=on|off' to force XDP copy mode even if device supports zero-copy (default: off)\n"
@@ -2989,6 +2990,8 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "                  and use 'map-start-index' to specify the starting index for the map (default: 0) (Since 10.1)\n"
     "                use 'queues=n' to specify how many queues of a multiqueue interface should be used\n"
     "                use 'start-queue=m' to specify the first queue that should be used\n"
+    "                use 'busy-poll=usecs' to busy poll the device queues from QEMU (Since 10.2)\n"
+    "                use 'busy-poll-budget=n' to limit the packets per busy poll (default: 64)\n"
 #endif
 #ifdef CONFIG_POSIX
     "-netdev vhost-user,id=str,chardev=dev[,vhostforce=on|off]\n"
@@ -3817,7 +3820,7 @@ SRST
         # launch QEMU instance
         |qemu_system| linux.img -nic vde,sock=/tmp/myswitch
 
-``-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off][,queues=n][,start-queue=m][,inhibit=on|off][,sock-fds=x:y:...:z][,map-path=/path/to/socket/map][,map-start-index=i]``
+``-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off][,queues=n][,start-queue=m][,inhibit=on|off][,sock-fds=x:y:...:z][,map-path=/path/to/socket/map][,map-start-index=i][,busy-poll=usecs][,busy-poll-budget=n]``
     Configure AF_XDP backend to connect to a network interface 'name'
     using AF_XDP socket.  A specific program attach mode for a default
     XDP program can be forced with 'mode', defaults to best-effort,
@@ -3882,6 +3885,24 @@ SRST
     for insertion into the socket map.  The combination of 'map-path' and
     'sock-fds' together is not supported.
 
+    'busy-poll' makes the sockets prefer busy polling, with the given
+    timeout in microseconds: the device queues are then processed when
+    QEMU reads from them rather than from interrupts.  'busy-poll-budget'
+    limits how many packets are processed per busy poll.  The interface
+    should be configured to defer hard interrupts so that they only fire
+    when QEMU stops polling.  Enabling busy polling requires the
+    CAP_NET_ADMIN capability.  With 'sock-fds', QEMU may run without it if
+    the management layer sets SO_PREFER_BUSY_POLL, SO_BUSY_POLL and
+    SO_BUSY_POLL_BUDGET on the sockets to the same values beforehand;
+    otherwise QEMU warns and the queues are processed from interrupts.
+
+    .. parsed-literal::
+
+        echo 2 > /sys/class/net/eth0/napi_defer_hard_irqs
+        echo 200000 > /sys/class/net/eth0/gro_flush_timeout
+        |qemu_system| linux.img -device virtio-net-pci,netdev=n1 \\
+            -netdev af-xdp,id=n1,ifname=eth0,queues=4,busy-poll=20
+
 ``-netdev vhost-user,chardev=id[,vhostforce=on|off][,queues=n]``
     Establish a vhost-user netdev, backed by a chardev id. The chardev
     should be a unix domain socket backed one. The vhost-user uses a
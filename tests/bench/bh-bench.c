@@ -0,0 +1,221 @@
+/*
+ * Bottom half scheduling benchmark
+ *
+ * Several producer threads schedule bottom halves in one AioContext that is
+ * run by a separate thread, like vCPU threads kicking an iothread that
+ * serves several virtqueues.  Measures the cost of scheduling from other
+ * threads and how many requests the event loop folds into one callback.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/atomic.h"
+#include "qemu/main-loop.h"
+#include "qemu/processor.h"
+#include "qemu/thread.h"
+#include "block/aio.h"
+
+struct thread_info {
+    QEMUBH *bh;
+    uint64_t scheduled;
+    unsigned int in_flight;
+} QEMU_ALIGNED(64); /* avoid false sharing among threads */
+
+static unsigned int duration = 1;
+static unsigned int n_threads = 4;
+static unsigned int queue_depth = 16;
+static bool oneshot;
+
+static bool test_start;
+static bool test_stop;
+static bool loop_stop;
+
+static AioContext *ctx;
+static struct thread_info *info;
+static uint64_t *callbacks;
+static QemuThread *threads;
+static QemuThread loop_thread;
+
+static const char commands_string[] =
+    " -d = duration, in seconds\n"
+    " -n = number of producer threads\n"
+    " -o = schedule one-shot bottom halves instead of a persistent one\n"
+    " -q = one-shot bottom halves in flight per producer";
+
+static void usage_complete(int argc, char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+    exit(-1);
+}
+
+/* Runs in the event loop thread */
+static void bh_cb(void *opaque)
+{
+    struct thread_info *ti = opaque;
+
+    callbacks[ti - info]++;
+}
+
+static void oneshot_cb(void *opaque)
+{
+    struct thread_info *ti = opaque;
+
+    callbacks[ti - info]++;
+    qatomic_dec(&ti->in_flight);
+}
+
+static void *producer_func(void *p)
+{
+    struct thread_info *ti = p;
+
+    while (!qatomic_read(&test_start)) {
+        cpu_relax();
+    }
+
+    while (!qatomic_read(&test_stop)) {
+        if (oneshot) {
+            if (qatomic_read(&ti->in_flight) >= queue_depth) {
+                cpu_relax();
+                continue;
+            }
+            qatomic_inc(&ti->in_flight);
+            aio_bh_schedule_oneshot(ctx, oneshot_cb, ti);
+        } else {
+            qemu_bh_schedule(ti->bh);
+        }
+        ti->scheduled++;
+    }
+    return NULL;
+}
+
+static void *loop_func(void *p)
+{
+    qemu_set_current_aio_context(ctx);
+
+    while (!qatomic_read(&loop_stop)) {
+        aio_poll(ctx, true);
+    }
+
+    /* Run whatever was scheduled before the producers stopped */
+    while (aio_poll(ctx, false)) {
+        /* nothing */
+    }
+    return NULL;
+}
+
+static void setup(void)
+{
+    unsigned int i;
+
+    ctx = aio_context_new(&error_abort);
+    info = g_new0(struct thread_info, n_threads);
+    callbacks = g_new0(uint64_t, n_threads);
+    threads = g_new(QemuThread, n_threads);
+
+    for (i = 0; i < n_threads; i++) {
+        info[i].bh = aio_bh_new(ctx, bh_cb, &info[i]);
+    }
+
+    qemu_thread_create(&loop_thread, "bh-bench-loop", loop_func, NULL,
+                       QEMU_THREAD_JOINABLE);
+    for (i = 0; i < n_threads; i++) {
+        qemu_thread_create(&threads[i], "bh-bench", producer_func, &info[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void pr_params(void)
+{
+    printf("Parameters:\n");
+    printf(" duration:          %d s\n", duration);
+    printf(" # of producers:    %u\n", n_threads);
+    printf(" bottom halves:     %s\n", oneshot ? "one-shot" : "persistent");
+    if (oneshot) {
+        printf(" in flight/thread:  %u\n", queue_depth);
+    }
+}
+
+static void pr_stats(void)
+{
+    uint64_t scheduled = 0, run = 0;
+    unsigned int i;
+
+    printf("Results:\n");
+    for (i = 0; i < n_threads; i++) {
+        printf(" producer %u:        %.2f Mops/s scheduled, %.2f Mops/s run\n",
+               i, (double)info[i].scheduled / 1e6 / duration,
+               (double)callbacks[i] / 1e6 / duration);
+        scheduled += info[i].scheduled;
+        run += callbacks[i];
+    }
+    printf(" total:             %.2f Mops/s scheduled, %.2f Mops/s run\n",
+           (double)scheduled / 1e6 / duration,
+           (double)run / 1e6 / duration);
+    printf(" requests/callback: %.2f\n", run ? (double)scheduled / run : 0.0);
+}
+
+static void run_test(void)
+{
+    unsigned int i;
+
+    qatomic_set(&test_start, true);
+    g_usleep(duration * G_USEC_PER_SEC);
+    qatomic_set(&test_stop, true);
+
+    for (i = 0; i < n_threads; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+
+    qatomic_set(&loop_stop, true);
+    aio_notify(ctx);
+    qemu_thread_join(&loop_thread);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "d:hn:oq:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'h':
+            usage_complete(argc, argv);
+            exit(0);
+        case 'n':
+            n_threads = atoi(optarg);
+            break;
+        case 'o':
+            oneshot = true;
+            break;
+        case 'q':
+            queue_depth = atoi(optarg);
+            break;
+        }
+    }
+
+    if (!duration || !n_threads || !queue_depth) {
+        usage_complete(argc, argv);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    parse_args(argc, argv);
+
+    qemu_init_main_loop(&error_fatal);
+
+    pr_params();
+    setup();
+    run_test();
+    pr_stats();
+    return 0;
+}
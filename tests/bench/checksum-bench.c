@@ -0,0 +1,86 @@
+/*
+ * Internet checksum and CRC32C speed benchmark
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include "qemu/osdep.h"
+#include "qemu/crc32c.h"
+#include "qemu/units.h"
+#include "net/checksum.h"
+
+static void *bench_buffer(size_t len)
+{
+    uint8_t *buf = g_malloc(len);
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        buf[i] = i * 31 + 7;
+    }
+    return buf;
+}
+
+static void test_net_checksum(const void *opaque)
+{
+    size_t max = 64 * KiB;
+    uint8_t *buf = bench_buffer(max);
+    int accel_index = 0;
+
+    do {
+        if (accel_index != 0) {
+            g_test_message("%s", "");  /* gnu_printf Werror for simple "" */
+        }
+        for (size_t len = 64; len <= max; len *= 4) {
+            double total = 0.0;
+
+            g_test_timer_start();
+            do {
+                net_checksum_add(len, buf);
+                total += len;
+            } while (g_test_timer_elapsed() < 0.5);
+
+            total /= MiB;
+            g_test_message("net_checksum #%d: %6zu bytes %8.0f MB/sec",
+                           accel_index, len, total / g_test_timer_last());
+        }
+        accel_index++;
+    } while (test_net_checksum_next_accel());
+
+    g_free(buf);
+}
+
+static void test_crc32c(const void *opaque)
+{
+    size_t max = 64 * KiB;
+    uint8_t *buf = bench_buffer(max);
+    int accel_index = 0;
+
+    do {
+        if (accel_index != 0) {
+            g_test_message("%s", "");  /* gnu_printf Werror for simple "" */
+        }
+        for (size_t len = 64; len <= max; len *= 4) {
+            double total = 0.0;
+
+            g_test_timer_start();
+            do {
+                crc32c(0xffffffff, buf, len);
+                total += len;
+            } while (g_test_timer_elapsed() < 0.5);
+
+            total /= MiB;
+            g_test_message("crc32c #%d: %6zu bytes %8.0f MB/sec",
+                           accel_index, len, total / g_test_timer_last());
+        }
+        accel_index++;
+    } while (test_crc32c_next_accel());
+
+    g_free(buf);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_data_func("/net/checksum/speed", NULL, test_net_checksum);
+    g_test_add_data_func("/crc32c/speed", NULL, test_crc32c);
+    return g_test_run();
+}
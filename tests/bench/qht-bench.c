@@ -11,6 +11,11 @@
 #include "qemu/rcu.h"
 #include "qemu/xxhash.h"
 #include "qemu/memalign.h"
+#include "qemu/host-utils.h"
+#include "qemu/timer.h"
+
+/* latency histogram; bucket i counts latencies in [2^(i-1), 2^i) ns */
+#define LAT_BUCKETS 64
 
 struct thread_stats {
     size_t rd;
@@ -21,6 +26,8 @@ struct thread_stats {
     size_t not_rm;
     size_t rz;
     size_t not_rz;
+    uint64_t rd_lat[LAT_BUCKETS];
+    uint64_t up_lat[LAT_BUCKETS];
 };
 
 struct thread_info {
@@ -61,6 +68,7 @@ static double resize_rate; /* 0.0 to 1.0 */
 static unsigned int n_rz_threads = 1;
 static QemuThread *rz_threads;
 static bool precompute_hash;
+static bool measure_latency;
 
 static double update_rate; /* 0.0 to 1.0 */
 static uint64_t update_threshold;
@@ -80,6 +88,7 @@ static const char commands_string[] =
     "\n"
     " -o = offset at which keys start\n"
     " -p = precompute hashes\n"
+    " -L = measure the latency of each operation\n"
     "\n"
     " -g = set -s,-k,-K,-l,-r to the same value\n"
     " -s = initial size hint\n"
@@ -156,13 +165,25 @@ static void do_rz(struct thread_info *info)
     g_usleep(resize_delay);
 }
 
+static void lat_add(uint64_t *lat, int64_t start)
+{
+    int64_t ns = get_clock() - start;
+
+    lat[ns > 0 ? 64 - clz64(ns) : 0]++;
+}
+
 static void do_rw(struct thread_info *info)
 {
     struct thread_stats *stats = &info->stats;
     uint64_t r = info->seed - 1;
+    int64_t start = 0;
     uint32_t hash;
     long *p;
 
+    if (measure_latency) {
+        start = get_clock();
+    }
+
     if (r >= update_threshold) {
         bool read;
 
@@ -174,6 +195,9 @@ static void do_rw(struct thread_info *info)
         } else {
             stats->not_rd++;
         }
+        if (measure_latency) {
+            lat_add(stats->rd_lat, start);
+        }
     } else {
         p = &keys[r & (update_range - 1)];
         hash = hfunc(*p);
@@ -201,6 +225,9 @@ static void do_rw(struct thread_info *info)
             }
         }
         info->write_op = !info->write_op;
+        if (measure_latency) {
+            lat_add(stats->up_lat, start);
+        }
     }
 }
 
@@ -368,7 +395,7 @@ static void htable_init(void)
 
 static void add_stats(struct thread_stats *s, struct thread_info *info, int n)
 {
-    int i;
+    int i, j;
 
     for (i = 0; i < n; i++) {
         struct thread_stats *stats = &info[i].stats;
@@ -384,7 +411,47 @@ static void add_stats(struct thread_stats *s, struct thread_info *info, int n)
 
         s->rz += stats->rz;
         s->not_rz += stats->not_rz;
+
+        for (j = 0; j < LAT_BUCKETS; j++) {
+            s->rd_lat[j] += stats->rd_lat[j];
+            s->up_lat[j] += stats->up_lat[j];
+        }
+    }
+}
+
+/* upper bound of the latency below which a fraction @pct of the samples are */
+static uint64_t lat_percentile(const uint64_t *lat, uint64_t total, double pct)
+{
+    uint64_t sum = 0;
+    int i;
+
+    for (i = 0; i < LAT_BUCKETS - 1; i++) {
+        sum += lat[i];
+        if (sum >= total * pct) {
+            break;
+        }
     }
+    return 1ULL << i;
+}
+
+static void pr_lat(const char *name, const uint64_t *lat)
+{
+    uint64_t total = 0;
+    int i, max = 0;
+
+    for (i = 0; i < LAT_BUCKETS; i++) {
+        if (lat[i]) {
+            total += lat[i];
+            max = i;
+        }
+    }
+    if (!total) {
+        return;
+    }
+    printf(" %-19s p50 < %" PRIu64 " ns, p99 < %" PRIu64 " ns, "
+           "p99.9 < %" PRIu64 " ns, max < %" PRIu64 " ns\n", name,
+           lat_percentile(lat, total, 0.5), lat_percentile(lat, total, 0.99),
+           lat_percentile(lat, total, 0.999), 1ULL << max);
 }
 
 static void pr_stats(void)
@@ -418,6 +485,11 @@ static void pr_stats(void)
     tx = (s.rd + s.not_rd + s.in + s.not_in + s.rm + s.not_rm) / 1e6 / duration;
     printf(" Throughput:        %.2f MT/s\n", tx);
     printf(" Throughput/thread: %.2f MT/s/thread\n", tx / n_rw_threads);
+
+    if (measure_latency) {
+        pr_lat("Lookup latency:", s.rd_lat);
+        pr_lat("Update latency:", s.up_lat);
+    }
 }
 
 static void run_test(void)
@@ -445,7 +517,7 @@ static void parse_args(int argc, char *argv[])
     int c;
 
     for (;;) {
-        c = getopt(argc, argv, "d:D:g:k:K:l:hn:N:o:pr:Rs:S:u:");
+        c = getopt(argc, argv, "d:D:g:k:K:l:hLn:N:o:pr:Rs:S:u:");
         if (c < 0) {
             break;
         }
@@ -475,6 +547,9 @@ static void parse_args(int argc, char *argv[])
         case 'l':
             lookup_range = pow2ceil(atol(optarg));
             break;
+        case 'L':
+            measure_latency = true;
+            break;
         case 'n':
             n_rw_threads = atoi(optarg);
             break;
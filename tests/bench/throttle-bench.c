@@ -0,0 +1,232 @@
+/*
+ * Throttle group contention benchmark
+ *
+ * Many members of a single throttle group issue requests from several
+ * threads, each with its own AioContext, to measure the overhead of the
+ * group's accounting when its limits are high.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/atomic.h"
+#include "qemu/coroutine.h"
+#include "qemu/main-loop.h"
+#include "qemu/module.h"
+#include "qemu/processor.h"
+#include "qemu/thread.h"
+#include "block/aio.h"
+#include "block/throttle-groups.h"
+
+/* Thread i runs members i, i + n_threads, i + 2 * n_threads, ... */
+struct thread_info {
+    AioContext *ctx;
+    unsigned int running;
+    uint64_t ops;
+} QEMU_ALIGNED(64); /* avoid false sharing among threads */
+
+static unsigned int duration = 1;
+static unsigned int n_threads = 4;
+static unsigned int n_members = 64;
+static unsigned int queue_depth = 4;
+static uint64_t iops = 10000000;
+static uint64_t request_size = 4096;
+
+static bool test_start;
+static bool test_stop;
+
+static ThrottleGroupMember *members;
+static struct thread_info *info;
+static QemuThread *threads;
+
+static const char commands_string[] =
+    " -d = duration, in seconds\n"
+    " -n = number of threads\n"
+    " -m = number of group members, spread over the threads\n"
+    " -q = requests in flight per member\n"
+    " -i = iops-total limit of the group\n"
+    " -s = request size in bytes";
+
+static void usage_complete(int argc, char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+    exit(-1);
+}
+
+static void coroutine_fn request_entry(void *opaque)
+{
+    ThrottleGroupMember *tgm = opaque;
+    struct thread_info *ti = &info[(tgm - members) % n_threads];
+
+    while (!qatomic_read(&test_stop)) {
+        throttle_group_co_io_limits_intercept(tgm, request_size,
+                                              THROTTLE_READ);
+        ti->ops++;
+
+        /* Complete asynchronously, like real I/O */
+        aio_co_schedule(ti->ctx, qemu_coroutine_self());
+        qemu_coroutine_yield();
+    }
+    ti->running--;
+}
+
+static bool restart_pending(struct thread_info *ti)
+{
+    unsigned int i;
+
+    for (i = ti - info; i < n_members; i += n_threads) {
+        if (qatomic_read(&members[i].restart_pending)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void *thread_func(void *p)
+{
+    struct thread_info *ti = p;
+    unsigned int i, j;
+
+    qemu_set_current_aio_context(ti->ctx);
+
+    while (!qatomic_read(&test_start)) {
+        cpu_relax();
+    }
+
+    for (i = ti - info; i < n_members; i += n_threads) {
+        for (j = 0; j < queue_depth; j++) {
+            Coroutine *co = qemu_coroutine_create(request_entry, &members[i]);
+            ti->running++;
+            aio_co_enter(ti->ctx, co);
+        }
+    }
+
+    while (ti->running || restart_pending(ti)) {
+        aio_poll(ti->ctx, true);
+    }
+    return NULL;
+}
+
+static void setup(void)
+{
+    ThrottleConfig cfg;
+    unsigned int i;
+
+    members = g_new0(ThrottleGroupMember, n_members);
+    info = g_new0(struct thread_info, n_threads);
+    threads = g_new(QemuThread, n_threads);
+
+    for (i = 0; i < n_threads; i++) {
+        info[i].ctx = aio_context_new(&error_abort);
+    }
+
+    for (i = 0; i < n_members; i++) {
+        throttle_group_register_tgm(&members[i], "bench",
+                                    info[i % n_threads].ctx);
+    }
+
+    throttle_config_init(&cfg);
+    cfg.buckets[THROTTLE_OPS_TOTAL].avg = iops;
+    throttle_group_config(&members[0], &cfg);
+
+    for (i = 0; i < n_threads; i++) {
+        qemu_thread_create(&threads[i], "throttle-bench", thread_func,
+                           &info[i], QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void pr_params(void)
+{
+    printf("Parameters:\n");
+    printf(" duration:          %d s\n", duration);
+    printf(" # of threads:      %u\n", n_threads);
+    printf(" # of members:      %u\n", n_members);
+    printf(" requests/member:   %u\n", queue_depth);
+    printf(" iops limit:        %" PRIu64 "\n", iops);
+    printf(" request size:      %" PRIu64 "\n", request_size);
+}
+
+static void pr_stats(void)
+{
+    uint64_t ops = 0;
+    unsigned int i;
+
+    printf("Results:\n");
+    for (i = 0; i < n_threads; i++) {
+        printf(" thread %u:          %.2f Mops/s\n", i,
+               (double)info[i].ops / 1e6 / duration);
+        ops += info[i].ops;
+    }
+    printf(" total:             %.2f Mops/s (%.1f%% of the limit)\n",
+           (double)ops / 1e6 / duration,
+           (double)ops * 100 / duration / iops);
+}
+
+static void run_test(void)
+{
+    unsigned int i;
+
+    qatomic_set(&test_start, true);
+    g_usleep(duration * G_USEC_PER_SEC);
+    qatomic_set(&test_stop, true);
+
+    for (i = 0; i < n_threads; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "d:hi:m:n:q:s:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'h':
+            usage_complete(argc, argv);
+            exit(0);
+        case 'i':
+            iops = atoll(optarg);
+            break;
+        case 'm':
+            n_members = atoi(optarg);
+            break;
+        case 'n':
+            n_threads = atoi(optarg);
+            break;
+        case 'q':
+            queue_depth = atoi(optarg);
+            break;
+        case 's':
+            request_size = atoll(optarg);
+            break;
+        }
+    }
+
+    if (!duration || !n_threads || !n_members || !queue_depth || !iops) {
+        usage_complete(argc, argv);
+    }
+    n_threads = MIN(n_threads, n_members);
+}
+
+int main(int argc, char *argv[])
+{
+    parse_args(argc, argv);
+
+    qemu_init_main_loop(&error_fatal);
+    module_call_init(MODULE_INIT_QOM);
+
+    pr_params();
+    setup();
+    run_test();
+    pr_stats();
+    return 0;
+}
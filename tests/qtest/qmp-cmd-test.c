@@ -15,6 +15,7 @@
 #include "qapi/error.h"
 #include "qapi/qapi-visit-introspect.h"
 #include "qobject/qdict.h"
+#include "qobject/qlist.h"
 #include "qapi/qobject-input-visitor.h"
 
 const char common_args[] = "-nodefaults -machine none";
@@ -343,6 +344,44 @@ static void test_object_add_failure_modes(void)
     qtest_quit(qts);
 }
 
+static void query_iothread_time(QTestState *qts, int64_t *busy_ns,
+                                int64_t *idle_ns)
+{
+    QDict *resp, *info;
+    QList *list;
+
+    resp = qtest_qmp(qts, "{'execute': 'query-iothreads'}");
+    list = qdict_get_qlist(resp, "return");
+    g_assert_cmpint(qlist_size(list), ==, 1);
+    info = qobject_to(QDict, qlist_peek(list));
+    g_assert_cmpstr(qdict_get_str(info, "id"), ==, "iothread0");
+    g_assert(qdict_haskey(info, "busy-time-ns"));
+    g_assert(qdict_haskey(info, "idle-time-ns"));
+    *busy_ns = qdict_get_int(info, "busy-time-ns");
+    *idle_ns = qdict_get_int(info, "idle-time-ns");
+    g_assert_cmpint(*busy_ns, >=, 0);
+    g_assert_cmpint(*idle_ns, >=, 0);
+    qobject_unref(resp);
+}
+
+static void test_query_iothreads_time(void)
+{
+    QTestState *qts;
+    int64_t busy1, idle1, busy2, idle2;
+
+    qts = qtest_initf("%s -object iothread,id=iothread0", common_args);
+
+    query_iothread_time(qts, &busy1, &idle1);
+    g_usleep(100 * 1000);
+    query_iothread_time(qts, &busy2, &idle2);
+
+    /* The iothread has nothing to do, so it sleeps most of the time */
+    g_assert_cmpint(busy2 + idle2, >, busy1 + idle1);
+    g_assert_cmpint(idle2 - idle1, >=, 50 * 1000 * 1000);
+
+    qtest_quit(qts);
+}
+
 int main(int argc, char *argv[])
 {
     QmpSchema schema;
@@ -355,6 +394,7 @@ int main(int argc, char *argv[])
 
     qtest_add_func("qmp/object-add-failure-modes",
                    test_object_add_failure_modes);
+    qtest_add_func("qmp/query-iothreads-time", test_query_iothreads_time);
 
     ret = g_test_run();
 
@@ -60,8 +60,12 @@
 
 #define VHOST_USER_PROTOCOL_F_MQ 0
 #define VHOST_USER_PROTOCOL_F_LOG_SHMFD 1
+#define VHOST_USER_PROTOCOL_F_REPLY_ACK 3
+#define VHOST_USER_PROTOCOL_F_BACKEND_REQ 5
 #define VHOST_USER_PROTOCOL_F_CROSS_ENDIAN   6
 #define VHOST_USER_PROTOCOL_F_CONFIG 9
+#define VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS 15
+#define VHOST_USER_PROTOCOL_F_PIPELINED_REPLY 20
 
 #define VHOST_LOG_PAGE 0x1000
 
@@ -85,8 +89,13 @@ typedef enum VhostUserRequest {
     VHOST_USER_SET_PROTOCOL_FEATURES = 16,
     VHOST_USER_GET_QUEUE_NUM = 17,
     VHOST_USER_SET_VRING_ENABLE = 18,
+    VHOST_USER_SET_BACKEND_REQ_FD = 21,
+    VHOST_USER_IOTLB_MSG = 22,
     VHOST_USER_GET_CONFIG = 24,
     VHOST_USER_SET_CONFIG = 25,
+    VHOST_USER_GET_MAX_MEM_SLOTS = 36,
+    VHOST_USER_ADD_MEM_REG = 37,
+    VHOST_USER_REM_MEM_REG = 38,
     VHOST_USER_MAX
 } VhostUserRequest;
 
@@ -113,6 +122,7 @@ typedef struct VhostUserMsg {
 
 #define VHOST_USER_VERSION_MASK     (0x3)
 #define VHOST_USER_REPLY_MASK       (0x1<<2)
+#define VHOST_USER_NEED_REPLY_MASK  (0x1<<3)
     uint32_t flags;
     uint32_t size; /* the following payload size */
     union {
@@ -169,6 +179,15 @@ typedef struct TestServer {
     bool test_fail;
     int test_flags;
     int queues;
+    int backend_fd;
+    bool iommu;
+    bool pipelined_reply;
+    /* acks held back so that the test sees how many requests are in flight */
+    bool defer_acks;
+    GQueue acks;
+    int acks_count[VHOST_USER_MAX];
+    int acks_pending[VHOST_USER_MAX];
+    int acks_max_pending[VHOST_USER_MAX];
     struct vhost_user_ops *vu_ops;
 } TestServer;
 
@@ -323,6 +342,62 @@ static void *thread_function(void *data)
     return NULL;
 }
 
+static void reply_ack(TestServer *s, VhostUserRequest request)
+{
+    VhostUserMsg msg = {
+        .request = request,
+        .flags = VHOST_USER_VERSION | VHOST_USER_REPLY_MASK,
+        .size = sizeof(m.payload.u64),
+    };
+
+    qemu_chr_fe_write_all(&s->chr, (uint8_t *) &msg,
+                          VHOST_USER_HDR_SIZE + msg.size);
+}
+
+/* Called with data_mutex held */
+static void flush_acks(TestServer *s)
+{
+    while (!g_queue_is_empty(&s->acks)) {
+        VhostUserRequest request = GPOINTER_TO_UINT(g_queue_pop_head(&s->acks));
+
+        s->acks_pending[request]--;
+        reply_ack(s, request);
+    }
+    g_cond_broadcast(&s->data_cond);
+}
+
+static gboolean flush_acks_cb(gpointer user_data)
+{
+    TestServer *s = user_data;
+
+    g_mutex_lock(&s->data_mutex);
+    flush_acks(s);
+    g_mutex_unlock(&s->data_mutex);
+
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * Hold back the ack for a while.  A front-end that waits for each reply
+ * stalls meanwhile, one that pipelines its requests keeps sending.
+ */
+static void defer_ack(TestServer *s, VhostUserRequest request)
+{
+    if (g_queue_is_empty(&s->acks)) {
+        GSource *src = g_timeout_source_new(50);
+
+        g_source_set_callback(src, flush_acks_cb, s, NULL);
+        g_source_attach(src, s->context);
+        g_source_unref(src);
+    }
+
+    g_queue_push_tail(&s->acks, GUINT_TO_POINTER(request));
+    s->acks_count[request]++;
+    s->acks_pending[request]++;
+    s->acks_max_pending[request] = MAX(s->acks_max_pending[request],
+                                       s->acks_pending[request]);
+}
+
 static int chr_can_read(void *opaque)
 {
     return VHOST_USER_HDR_SIZE;
@@ -511,11 +586,50 @@ static void chr_read(void *opaque, const uint8_t *buf, int size)
                    msg.payload.state.num ? "enabled" : "disabled");
         break;
 
+    case VHOST_USER_SET_BACKEND_REQ_FD:
+        /* keep the channel open, the test never sends any request on it */
+        qemu_chr_fe_get_msgfds(chr, &s->backend_fd, 1);
+        break;
+
+    case VHOST_USER_GET_MAX_MEM_SLOTS:
+        msg.flags |= VHOST_USER_REPLY_MASK;
+        msg.size = sizeof(m.payload.u64);
+        msg.payload.u64 = VHOST_MEMORY_MAX_NREGIONS;
+        p = (uint8_t *) &msg;
+        qemu_chr_fe_write_all(chr, p, VHOST_USER_HDR_SIZE + msg.size);
+        break;
+
+    case VHOST_USER_ADD_MEM_REG:
+        /* consume the fd, the region itself is not used */
+        qemu_chr_fe_get_msgfds(chr, &fd, 1);
+        if (fd >= 0) {
+            close(fd);
+        }
+        /* fall through */
+    case VHOST_USER_REM_MEM_REG:
+    case VHOST_USER_IOTLB_MSG:
+        if (s->defer_acks && (msg.flags & VHOST_USER_NEED_REPLY_MASK)) {
+            defer_ack(s, msg.request);
+            msg.flags &= ~VHOST_USER_NEED_REPLY_MASK;
+        }
+        break;
+
     default:
         g_test_message("vhost-user: un-handled message: %d", msg.request);
         break;
     }
 
+    /*
+     * With REPLY_ACK, a request that has no reply of its own still gets
+     * one when need_reply is set.  Replies go out in order, so the held
+     * back ones are sent first.
+     */
+    if ((msg.flags & VHOST_USER_NEED_REPLY_MASK) &&
+        !(msg.flags & VHOST_USER_REPLY_MASK)) {
+        flush_acks(s);
+        reply_ack(s, msg.request);
+    }
+
 out:
     g_mutex_unlock(&s->data_mutex);
 }
@@ -594,6 +708,8 @@ static TestServer *test_server_new(const gchar *name,
     g_cond_init(&server->data_cond);
 
     server->log_fd = -1;
+    server->backend_fd = -1;
+    g_queue_init(&server->acks);
     server->queues = 1;
     server->vu_ops = ops;
 
@@ -663,6 +779,11 @@ static void test_server_free(TestServer *server)
         close(server->log_fd);
     }
 
+    if (server->backend_fd != -1) {
+        close(server->backend_fd);
+    }
+    g_queue_clear(&server->acks);
+
     g_free(server->chr_name);
 
     g_main_loop_unref(server->loop);
@@ -1017,6 +1138,95 @@ static void test_vhost_user_started(void *obj, void *arg, QGuestAllocator *alloc
     wait_for_rings_started(s, 2);
 }
 
+static void *vhost_user_test_setup_reply_ack(GString *cmd_line, void *arg,
+                                             bool pipelined_reply)
+{
+    TestServer *s;
+    bool iommu = false;
+
+    /*
+     * IOTLB updates are only sent behind a vIOMMU.  As long as the guest
+     * leaves DMA remapping disabled, intel-iommu maps everything 1:1 in
+     * 4K pages, so a miss on a ring has several pages to prefetch.
+     */
+    if (g_str_has_prefix(cmd_line->str, "-M pc ")) {
+        g_string_erase(cmd_line, 0, strlen("-M pc "));
+        g_string_prepend(cmd_line, "-M q35 -device intel-iommu,intremap=off ");
+        g_string_append(cmd_line,
+                        " -global virtio-net-pci.disable-legacy=on"
+                        " -global virtio-net-pci.iommu_platform=on");
+        iommu = true;
+    }
+
+    s = vhost_user_test_setup(cmd_line, arg);
+    s->iommu = iommu;
+    s->pipelined_reply = pipelined_reply;
+    s->defer_acks = true;
+
+    return s;
+}
+
+static void *vhost_user_test_setup_pipelined(GString *cmd_line, void *arg)
+{
+    return vhost_user_test_setup_reply_ack(cmd_line, arg, true);
+}
+
+static void *vhost_user_test_setup_sequential(GString *cmd_line, void *arg)
+{
+    return vhost_user_test_setup_reply_ack(cmd_line, arg, false);
+}
+
+static void wait_for_acks(TestServer *s, VhostUserRequest request)
+{
+    gint64 end_time;
+
+    g_mutex_lock(&s->data_mutex);
+    end_time = g_get_monotonic_time() + 5 * G_TIME_SPAN_SECOND;
+    while (!s->acks_count[request] || s->acks_pending[request]) {
+        if (!g_cond_wait_until(&s->data_cond, &s->data_mutex, end_time)) {
+            /* timeout has passed */
+            g_assert_cmpint(s->acks_count[request], >, 0);
+            g_assert_cmpint(s->acks_pending[request], ==, 0);
+            break;
+        }
+    }
+
+    g_mutex_unlock(&s->data_mutex);
+}
+
+static void test_reply_ack(void *obj, void *arg, QGuestAllocator *alloc)
+{
+    TestServer *s = arg;
+
+    wait_for_rings_started(s, 2);
+
+    /* all the regions are sent at once when the device starts */
+    wait_for_acks(s, VHOST_USER_ADD_MEM_REG);
+    g_mutex_lock(&s->data_mutex);
+    if (s->pipelined_reply) {
+        g_assert_cmpint(s->acks_max_pending[VHOST_USER_ADD_MEM_REG], ==,
+                        s->acks_count[VHOST_USER_ADD_MEM_REG]);
+    } else {
+        g_assert_cmpint(s->acks_max_pending[VHOST_USER_ADD_MEM_REG], ==, 1);
+    }
+    g_mutex_unlock(&s->data_mutex);
+
+    if (!s->iommu) {
+        g_test_skip("IOTLB updates need intel-iommu");
+        return;
+    }
+
+    /* the miss on a used ring is followed by updates for the next pages */
+    wait_for_acks(s, VHOST_USER_IOTLB_MSG);
+    g_mutex_lock(&s->data_mutex);
+    if (s->pipelined_reply) {
+        g_assert_cmpint(s->acks_max_pending[VHOST_USER_IOTLB_MSG], >, 1);
+    } else {
+        g_assert_cmpint(s->acks_max_pending[VHOST_USER_IOTLB_MSG], ==, 1);
+    }
+    g_mutex_unlock(&s->data_mutex);
+}
+
 static void *vhost_user_test_setup_multiqueue(GString *cmd_line, void *arg)
 {
     TestServer *s = vhost_user_test_setup(cmd_line, arg);
@@ -1086,6 +1296,37 @@ static struct vhost_user_ops g_vu_net_ops = {
     .get_protocol_features = vu_net_get_protocol_features,
 };
 
+static uint64_t vu_net_iommu_get_features(TestServer *s)
+{
+    return vu_net_get_features(s) | 0x1ULL << VIRTIO_F_IOMMU_PLATFORM;
+}
+
+/* IOMMU support needs REPLY_ACK and BACKEND_REQ */
+static void vu_net_iommu_get_protocol_features(TestServer *s,
+                                               CharFrontend *chr,
+                                               VhostUserMsg *msg)
+{
+    msg->flags |= VHOST_USER_REPLY_MASK;
+    msg->size = sizeof(m.payload.u64);
+    msg->payload.u64 = 1 << VHOST_USER_PROTOCOL_F_REPLY_ACK;
+    msg->payload.u64 |= 1 << VHOST_USER_PROTOCOL_F_BACKEND_REQ;
+    msg->payload.u64 |= 1 << VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS;
+    if (s->pipelined_reply) {
+        msg->payload.u64 |= 1 << VHOST_USER_PROTOCOL_F_PIPELINED_REPLY;
+    }
+    qemu_chr_fe_write_all(chr, (uint8_t *)msg, VHOST_USER_HDR_SIZE + msg->size);
+}
+
+static struct vhost_user_ops g_vu_net_iommu_ops = {
+    .type = VHOST_USER_NET,
+
+    .append_opts = append_vhost_net_opts,
+
+    .get_features = vu_net_iommu_get_features,
+    .set_features = vu_net_set_features,
+    .get_protocol_features = vu_net_iommu_get_protocol_features,
+};
+
 static void register_vhost_user_test(void)
 {
     QOSGraphTestOptions opts = {
@@ -1128,6 +1369,16 @@ static void register_vhost_user_test(void)
     qos_add_test("vhost-user/flags-mismatch", "virtio-net",
                  test_vhost_user_started, &opts);
 
+    opts.arg = &g_vu_net_iommu_ops;
+    opts.before = vhost_user_test_setup_pipelined;
+    qos_add_test("vhost-user/reply-ack/pipelined", "virtio-net",
+                 test_reply_ack, &opts);
+
+    opts.before = vhost_user_test_setup_sequential;
+    qos_add_test("vhost-user/reply-ack/sequential", "virtio-net",
+                 test_reply_ack, &opts);
+
+    opts.arg = &g_vu_net_ops;
     opts.before = vhost_user_test_setup_multiqueue;
     opts.edge.extra_device_opts = "mq=on";
     qos_add_test("vhost-user/multiqueue",
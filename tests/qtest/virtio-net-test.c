@@ -13,8 +13,10 @@
 #include "qemu/module.h"
 #include "qobject/qdict.h"
 #include "hw/virtio/virtio-net.h"
+#include "standard-headers/linux/virtio_pci.h"
 #include "libqos/qgraph.h"
 #include "libqos/virtio-net.h"
+#include "libqos/virtio-pci.h"
 
 #ifndef ETH_P_RARP
 #define ETH_P_RARP 0x8035
@@ -144,6 +146,64 @@ static void rx_stop_cont_test(QVirtioDevice *dev,
     guest_free(alloc, req_addr);
 }
 
+static void expect_queue_stats(QTestState *qts, const char *expected)
+{
+    char *resp = NULL;
+
+    g_test_timer_start();
+    do {
+        g_free(resp);
+        resp = qtest_hmp(qts, "info network");
+        if (strstr(resp, expected)) {
+            break;
+        }
+    } while (g_test_timer_elapsed() < QVIRTIO_NET_TIMEOUT_US / G_USEC_PER_SEC);
+    g_assert_nonnull(strstr(resp, expected));
+    g_free(resp);
+}
+
+static void rx_queue_stats_test(QVirtioDevice *dev,
+                                QGuestAllocator *alloc, QVirtQueue *vq,
+                                int socket)
+{
+    QTestState *qts = global_qtest;
+    uint64_t req_addr;
+    uint32_t free_head;
+    char test[] = "TEST";
+    char buffer[64];
+    int len = htonl(sizeof(test));
+    struct iovec iov[] = {
+        {
+            .iov_base = &len,
+            .iov_len = sizeof(len),
+        }, {
+            .iov_base = test,
+            .iov_len = sizeof(test),
+        },
+    };
+    int ret;
+
+    /* Without receive buffers, the packet waits in the NIC's queue */
+    ret = iov_send(socket, iov, 2, 0, sizeof(len) + sizeof(test));
+    g_assert_cmpint(ret, ==, sizeof(test) + sizeof(len));
+    expect_queue_stats(qts, "queue: depth=1,max-depth=1,queued=1,dropped=0,"
+                       "flushed=0,purged=0");
+
+    req_addr = guest_alloc(alloc, 64);
+
+    free_head = qvirtqueue_add(qts, vq, req_addr, 64, true, false);
+    qvirtqueue_kick(qts, dev, vq, free_head);
+
+    qvirtio_wait_used_elem(qts, dev, vq, free_head, NULL,
+                           QVIRTIO_NET_TIMEOUT_US);
+    memread(req_addr + VNET_HDR_SIZE, buffer, sizeof(test));
+    g_assert_cmpstr(buffer, ==, "TEST");
+    expect_queue_stats(qts, "queue: depth=0,max-depth=1,queued=1,dropped=0,"
+                       "flushed=1,purged=0");
+
+    guest_free(alloc, req_addr);
+}
+
 static void send_recv_test(void *obj, void *data, QGuestAllocator *t_alloc)
 {
     QVirtioNet *net_if = obj;
@@ -166,6 +226,16 @@ static void stop_cont_test(void *obj, void *data, QGuestAllocator *t_alloc)
     rx_stop_cont_test(dev, t_alloc, rx, sv[0]);
 }
 
+static void queue_stats_test(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioNet *net_if = obj;
+    QVirtioDevice *dev = net_if->vdev;
+    QVirtQueue *rx = net_if->queues[0];
+    int *sv = data;
+
+    rx_queue_stats_test(dev, t_alloc, rx, sv[0]);
+}
+
 static void hotplug(void *obj, void *data, QGuestAllocator *t_alloc)
 {
     QVirtioPCIDevice *dev = obj;
@@ -261,6 +331,163 @@ static void announce_self(void *obj, void *data, QGuestAllocator *t_alloc)
     };
 }
 
+static void iothread_vq_mapping_invalid(QTestState *qts, const char *props,
+                                        const char *error)
+{
+    QDict *resp;
+
+    resp = qtest_qmp_assert_failure_ref(qts,
+        "{'execute': 'device_add', 'arguments': {"
+        " 'driver': 'virtio-net-pci', 'id': 'net1', 'netdev': 'hs1',"
+        " 'addr': %s, %s }}", stringify(PCI_SLOT_HP), props);
+    g_assert_nonnull(strstr(qdict_get_str(qdict_get_qdict(resp, "error"),
+                                          "desc"), error));
+    qobject_unref(resp);
+}
+
+static void iothread_vq_mapping_props(void *obj, void *data,
+                                      QGuestAllocator *t_alloc)
+{
+    QVirtioPCIDevice *dev = obj;
+    QTestState *qts = dev->pdev->bus->qts;
+
+    if (dev->pdev->bus->not_hotpluggable) {
+        g_test_skip("pci bus does not support hotplug");
+        return;
+    }
+
+    iothread_vq_mapping_invalid(qts,
+        "'tx': 'timer', 'iothread-vq-mapping': [{'iothread': 'iothread0'}]",
+        "requires tx=bh");
+    iothread_vq_mapping_invalid(qts,
+        "'rss': true, 'iothread-vq-mapping': [{'iothread': 'iothread0'}]",
+        "incompatible with rss");
+    iothread_vq_mapping_invalid(qts,
+        "'ioeventfd': false, "
+        "'iothread-vq-mapping': [{'iothread': 'iothread0'}]",
+        "ioeventfd is required");
+    iothread_vq_mapping_invalid(qts,
+        "'iothread-vq-mapping': [{'iothread': 'nonexistent'}]",
+        "does not exist");
+    /* Without mq, there is a single queue pair */
+    iothread_vq_mapping_invalid(qts,
+        "'iothread-vq-mapping': [{'iothread': 'iothread0', 'vqs': [1]}]",
+        "vq index 1");
+
+    qtest_qmp_device_add(qts, "virtio-net-pci", "net1",
+                         "{'addr': %s, 'netdev': 'hs1',"
+                         " 'iothread-vq-mapping': [{'iothread': 'iothread0'}]}",
+                         stringify(PCI_SLOT_HP));
+}
+
+static void virtqueue_reset(QVirtioPCIDevice *dev, QVirtQueue *vq)
+{
+    dev->vdev.bus->queue_select(&dev->vdev, vq->index);
+    qpci_io_writew(dev->pdev, dev->bar, dev->common_cfg_offset +
+                   offsetof(struct virtio_pci_modern_common_cfg, queue_reset),
+                   1);
+}
+
+/*
+ * Reset the queues of a queue pair served by an IOThread while packets
+ * are in flight, then check that they work again once re-enabled.
+ */
+static void iothread_queue_reset(void *obj, void *data,
+                                 QGuestAllocator *t_alloc)
+{
+    QVirtioPCIDevice *dev1 = obj;
+    QTestState *qts = dev1->pdev->bus->qts;
+    QVirtioPCIDevice *dev;
+    QVirtQueue *vq[2];
+    uint64_t features;
+    uint64_t req_addr;
+    uint32_t free_head;
+    char test[] = "TEST";
+    int len = htonl(sizeof(test));
+    struct iovec iov[] = {
+        { .iov_base = &len, .iov_len = sizeof(len) },
+        { .iov_base = test, .iov_len = sizeof(test) },
+    };
+    int *sv = data;
+    int i, ret;
+
+    if (dev1->pdev->bus->not_hotpluggable) {
+        g_test_skip("pci bus does not support hotplug");
+        return;
+    }
+
+    qtest_qmp_device_add(qts, "virtio-net-pci", "net1",
+                         "{'addr': %s, 'netdev': 'hs1',"
+                         " 'iothread-vq-mapping': [{'iothread': 'iothread0'}]}",
+                         stringify(PCI_SLOT_HP));
+
+    dev = virtio_pci_new(dev1->pdev->bus,
+                         &(QPCIAddress) { .devfn = QPCI_DEVFN(PCI_SLOT_HP, 0) });
+    g_assert_nonnull(dev);
+    qvirtio_pci_device_enable(dev);
+    qvirtio_start_device(&dev->vdev);
+
+    features = qvirtio_get_features(&dev->vdev);
+    if (!(features & (1ull << VIRTIO_F_RING_RESET))) {
+        g_test_skip("device does not support queue reset");
+        goto out;
+    }
+    features &= ~(QVIRTIO_F_BAD_FEATURE |
+                  (1ull << VIRTIO_RING_F_INDIRECT_DESC) |
+                  (1ull << VIRTIO_RING_F_EVENT_IDX) |
+                  (1ull << VIRTIO_NET_F_CTRL_VQ));
+    qvirtio_set_features(&dev->vdev, features);
+    for (i = 0; i < ARRAY_SIZE(vq); i++) {
+        vq[i] = qvirtqueue_setup(&dev->vdev, t_alloc, i);
+    }
+    qvirtio_set_driver_ok(&dev->vdev);
+
+    rx_test(&dev->vdev, t_alloc, vq[0], sv[0]);
+    tx_test(&dev->vdev, t_alloc, vq[1], sv[0]);
+
+    /* Reset both queues while the IOThread processes a tx and a rx packet */
+    req_addr = guest_alloc(t_alloc, 64);
+    free_head = qvirtqueue_add(qts, vq[0], req_addr, 64, true, false);
+    qvirtqueue_kick(qts, &dev->vdev, vq[0], free_head);
+    memwrite(req_addr + VNET_HDR_SIZE, "TEST", 4);
+    free_head = qvirtqueue_add(qts, vq[1], req_addr, 64, false, false);
+    qvirtqueue_kick(qts, &dev->vdev, vq[1], free_head);
+    ret = iov_send(sv[0], iov, 2, 0, sizeof(len) + sizeof(test));
+    g_assert_cmpint(ret, ==, sizeof(test) + sizeof(len));
+
+    for (i = 0; i < ARRAY_SIZE(vq); i++) {
+        virtqueue_reset(dev, vq[i]);
+        qvirtqueue_cleanup(dev->vdev.bus, vq[i], t_alloc);
+    }
+    guest_free(t_alloc, req_addr);
+
+    for (i = 0; i < ARRAY_SIZE(vq); i++) {
+        vq[i] = qvirtqueue_setup(&dev->vdev, t_alloc, i);
+    }
+
+    /*
+     * The packet sent to the guest may have been dropped or may still be
+     * queued, and the one sent by the guest may have made it or not.
+     * Either way the queue pair must work again.
+     */
+    rx_test(&dev->vdev, t_alloc, vq[0], sv[0]);
+    ret = recv(sv[0], &len, sizeof(len), MSG_DONTWAIT);
+    if (ret == sizeof(len)) {
+        char buffer[64];
+
+        len = ntohl(len);
+        g_assert_cmpint(recv(sv[0], buffer, len, 0), ==, len);
+    }
+    tx_test(&dev->vdev, t_alloc, vq[1], sv[0]);
+
+    for (i = 0; i < ARRAY_SIZE(vq); i++) {
+        qvirtqueue_cleanup(dev->vdev.bus, vq[i], t_alloc);
+    }
+out:
+    qvirtio_pci_device_disable(dev);
+    qos_object_destroy((QOSGraphObject *)dev);
+}
+
 static void virtio_net_test_cleanup(void *sockets)
 {
     int *sv = sockets;
@@ -285,6 +512,24 @@ static void *virtio_net_test_setup(GString *cmd_line, void *arg)
     return sv;
 }
 
+static void *virtio_net_test_setup_iothread(GString *cmd_line, void *arg)
+{
+    int ret;
+    int *sv = g_new(int, 2);
+
+    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, sv);
+    g_assert_cmpint(ret, !=, -1);
+
+    /* The device under test is hotplugged on hs1 */
+    g_string_append_printf(cmd_line,
+                           " -netdev hubport,hubid=0,id=hs0"
+                           " -netdev socket,fd=%d,id=hs1"
+                           " -object iothread,id=iothread0 ", sv[1]);
+
+    g_test_queue_destroy(virtio_net_test_cleanup, sv);
+    return sv;
+}
+
 #endif /* _WIN32 */
 
 static void large_tx(void *obj, void *data, QGuestAllocator *t_alloc)
@@ -327,7 +572,14 @@ static void register_virtio_net_test(void)
     qos_add_test("hotplug", "virtio-net-pci", hotplug, &opts);
     qos_add_test("basic", "virtio-net", send_recv_test, &opts);
     qos_add_test("rx_stop_cont", "virtio-net", stop_cont_test, &opts);
+    qos_add_test("queue-stats", "virtio-net", queue_stats_test, &opts);
     qos_add_test("announce-self", "virtio-net", announce_self, &opts);
+
+    opts.before = virtio_net_test_setup_iothread;
+    qos_add_test("iothread-vq-mapping/props", "virtio-net-pci",
+                 iothread_vq_mapping_props, &opts);
+    qos_add_test("iothread-vq-mapping/queue-reset", "virtio-net-pci",
+                 iothread_queue_reset, &opts);
 #endif
 
     /* These tests do not need a loopback backend.  */
@@ -344,6 +344,8 @@ static void *rcu_update_stress_test(void *arg)
 
 static void *rcu_fake_update_stress_test(void *arg)
 {
+    bool expedited = false;
+
     rcu_register_thread();
 
     *(struct rcu_reader_data **)arg = get_ptr_rcu_reader();
@@ -351,7 +353,13 @@ static void *rcu_fake_update_stress_test(void *arg)
         g_usleep(1000);
     }
     while (goflag == GOFLAG_RUN) {
-        synchronize_rcu();
+        /* Mix in expedited grace periods, concurrent with normal ones */
+        if (expedited) {
+            synchronize_rcu_expedited();
+        } else {
+            synchronize_rcu();
+        }
+        expedited = !expedited;
         g_usleep(1000);
     }
 
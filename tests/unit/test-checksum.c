@@ -0,0 +1,105 @@
+/*
+ * Internet checksum and CRC32C tests
+ *
+ * Every accelerated implementation is checked against a plain
+ * byte-at-a-time reference.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/crc32c.h"
+#include "net/checksum.h"
+
+static uint8_t buffer[4096 + 64];
+
+static uint16_t ref_checksum(const uint8_t *buf, int len, int seq)
+{
+    uint64_t sum = 0;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        sum += (uint32_t)buf[i] << ((i + seq) & 1 ? 0 : 8);
+    }
+    return net_checksum_finish(sum);
+}
+
+static uint32_t ref_crc32c(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    int i;
+
+    while (len--) {
+        crc ^= *buf++;
+        for (i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (crc & 1 ? 0x82f63b78 : 0);
+        }
+    }
+    return crc ^ 0xffffffff;
+}
+
+static void fill(unsigned seed)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(buffer); i++) {
+        seed = seed * 1103515245 + 12345;
+        buffer[i] = seed >> 16;
+    }
+}
+
+static void test_net_checksum_1(void)
+{
+    int len, align, seq;
+
+    for (align = 0; align < 64; align += 7) {
+        for (len = 0; len <= 4096; len += len < 300 ? 1 : 61) {
+            for (seq = 0; seq < 2; seq++) {
+                uint32_t sum = net_checksum_add_cont(len, buffer + align, seq);
+
+                g_assert_cmpuint(net_checksum_finish(sum), ==,
+                                 ref_checksum(buffer + align, len, seq));
+            }
+        }
+    }
+}
+
+static void test_net_checksum(void)
+{
+    do {
+        /* A zero sum must stay distinguishable from 0xffff */
+        memset(buffer, 0, sizeof(buffer));
+        g_assert_cmpuint(net_checksum_add(4096, buffer), ==, 0);
+
+        memset(buffer, 0xff, sizeof(buffer));
+        test_net_checksum_1();
+
+        fill(1);
+        test_net_checksum_1();
+    } while (test_net_checksum_next_accel());
+}
+
+static void test_crc32c(void)
+{
+    const uint8_t check[] = "123456789";
+    size_t len, align;
+
+    fill(2);
+    do {
+        g_assert_cmphex(crc32c(0xffffffff, check, 9), ==, 0xe3069283);
+        for (align = 0; align < 16; align++) {
+            for (len = 0; len <= 1024; len++) {
+                g_assert_cmphex(crc32c(0xffffffff, buffer + align, len), ==,
+                                ref_crc32c(0xffffffff, buffer + align, len));
+            }
+        }
+    } while (test_crc32c_next_accel());
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/net/checksum", test_net_checksum);
+    g_test_add_func("/crc32c", test_crc32c);
+
+    return g_test_run();
+}
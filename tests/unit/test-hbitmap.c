@@ -793,6 +793,54 @@ static void test_hbitmap_serialize_zeroes(TestHBitmapData *data,
     }
 }
 
+static void test_hbitmap_serialize_ones(TestHBitmapData *data,
+                                        const void *unused)
+{
+    hbitmap_test_init(data, L2 + 3, 0);
+
+    /* The last word is only partially covered by the bitmap */
+    hbitmap_deserialize_ones(data->hb, 0, data->size, true);
+    hbitmap_test_set(data, 0, data->size);
+    hbitmap_test_check_get(data);
+}
+
+static void test_hbitmap_merge(TestHBitmapData *data, const void *unused)
+{
+    HBitmap *src, *dense;
+    uint64_t i;
+
+    hbitmap_test_init(data, L3 * 2, 0);
+    hbitmap_test_set(data, 0, 1);
+    hbitmap_test_set(data, L2 + 1, L1 * 3);
+    hbitmap_test_set(data, L3 + 7, 1);
+
+    src = hbitmap_alloc(L3 * 2, 0);
+    hbitmap_set(src, 0, 1);
+    hbitmap_set(src, L1 * 5 + 3, 5);
+    hbitmap_set(src, L2, L1 * 4);
+    hbitmap_set(src, L3 * 2 - 1, 1);
+
+    /* A result distinct from both inputs takes the dense path */
+    dense = hbitmap_alloc(L3 * 2, 0);
+    hbitmap_merge(data->hb, src, dense);
+    hbitmap_merge(data->hb, src, data->hb);
+
+    /* Update the shadow bitmap; this also checks the merged count */
+    hbitmap_test_set(data, 0, 1);
+    hbitmap_test_set(data, L1 * 5 + 3, 5);
+    hbitmap_test_set(data, L2, L1 * 4);
+    hbitmap_test_set(data, L3 * 2 - 1, 1);
+    hbitmap_test_check_get(data);
+
+    g_assert_cmpint(hbitmap_count(dense), ==, hbitmap_count(data->hb));
+    for (i = 0; i < data->size; i++) {
+        g_assert_cmpint(hbitmap_get(dense, i), ==, hbitmap_get(data->hb, i));
+    }
+
+    hbitmap_free(dense);
+    hbitmap_free(src);
+}
+
 static void hbitmap_test_add(const char *testpath,
                                    void (*test_func)(TestHBitmapData *data, const void *user_data))
 {
@@ -1063,6 +1111,8 @@ int main(int argc, char **argv)
     hbitmap_test_add("/hbitmap/reset/all", test_hbitmap_reset_all);
     hbitmap_test_add("/hbitmap/granularity", test_hbitmap_granularity);
 
+    hbitmap_test_add("/hbitmap/merge", test_hbitmap_merge);
+
     hbitmap_test_add("/hbitmap/truncate/nop", test_hbitmap_truncate_nop);
     hbitmap_test_add("/hbitmap/truncate/grow/negligible",
                      test_hbitmap_truncate_grow_negligible);
@@ -1093,6 +1143,8 @@ int main(int argc, char **argv)
                      test_hbitmap_serialize_part);
     hbitmap_test_add("/hbitmap/serialize/zeroes",
                      test_hbitmap_serialize_zeroes);
+    hbitmap_test_add("/hbitmap/serialize/ones",
+                     test_hbitmap_serialize_ones);
 
     hbitmap_test_add("/hbitmap/iter/iter_and_reset",
                      test_hbitmap_iter_and_reset);
@@ -734,6 +734,54 @@ static void test_accounting(void)
                                 (64.0 / 13)));
 }
 
+static void test_borrow(void)
+{
+    ThrottleCredit credit = { 0 }, write_credit = { 0 };
+
+    /* 100 ops/s for reads, no bps limit: the bucket holds 10 ops */
+    throttle_config_init(&cfg);
+    cfg.buckets[THROTTLE_OPS_READ].avg = 100;
+
+    throttle_init(&ts);
+    throttle_config(&ts, QEMU_CLOCK_VIRTUAL, &cfg);
+
+    throttle_account(&ts, THROTTLE_READ, 512);
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_OPS_READ].level, 1));
+
+    /* half of the 9 ops left, rounded down */
+    throttle_borrow(&ts, THROTTLE_READ, 0.5, &credit);
+    g_assert(double_cmp(credit.ops, 4));
+    g_assert(isinf(credit.bytes));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_OPS_READ].level, 5));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_OPS_TOTAL].level, 5));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_BPS_READ].level, 512));
+
+    /* spending the credit does not touch the buckets */
+    g_assert(throttle_credit_consume(&credit, 4096));
+    g_assert(throttle_credit_consume(&credit, 4096));
+    g_assert(throttle_credit_consume(&credit, 4096));
+    g_assert(double_cmp(credit.ops, 1));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_OPS_READ].level, 5));
+
+    /* writes have no limit at all */
+    throttle_borrow(&ts, THROTTLE_WRITE, 1, &write_credit);
+    g_assert(isinf(write_credit.ops));
+    g_assert(isinf(write_credit.bytes));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_OPS_TOTAL].level, 5));
+
+    /* giving the rest back restores the level */
+    throttle_repay(&ts, THROTTLE_READ, &credit);
+    g_assert(double_cmp(credit.ops, 0));
+    g_assert(!throttle_credit_consume(&credit, 512));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_OPS_READ].level, 4));
+
+    /* a full bucket has nothing left to lend */
+    ts.cfg.buckets[THROTTLE_OPS_READ].level = 12;
+    throttle_borrow(&ts, THROTTLE_READ, 1, &credit);
+    g_assert(double_cmp(credit.ops, 0));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_OPS_READ].level, 12));
+}
+
 static void test_groups(void)
 {
     ThrottleConfig cfg1, cfg2;
@@ -829,6 +877,7 @@ int main(int argc, char **argv)
                     test_iops_size_is_missing_limit);
     g_test_add_func("/throttle/config_functions",   test_config_functions);
     g_test_add_func("/throttle/accounting",         test_accounting);
+    g_test_add_func("/throttle/borrow",             test_borrow);
     g_test_add_func("/throttle/groups",             test_groups);
     return g_test_run();
 }
@@ -650,9 +650,12 @@ bool aio_poll(AioContext *ctx, bool blocking)
 
     qemu_lockcnt_inc(&ctx->list_lock);
 
-    if (ctx->poll_max_ns) {
+    if (ctx->poll_max_ns || blocking) {
         start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     }
+    if (blocking) {
+        aio_context_idle_begin(ctx, start);
+    }
 
     timeout = blocking ? aio_compute_timeout(ctx) : 0;
     progress = try_poll_mode(ctx, &ready_list, &timeout);
@@ -707,9 +710,22 @@ bool aio_poll(AioContext *ctx, bool blocking)
 
     aio_notify_accept(ctx);
 
-    /* Calculate blocked time for adaptive polling */
-    if (ctx->poll_max_ns) {
-        block_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
+    /*
+     * Calculate blocked time for adaptive polling and for the idle time
+     * statistics.  Only blocking calls count as idle; non-blocking ones come
+     * from callers that have work of their own.
+     */
+    if (ctx->poll_max_ns || blocking) {
+        int64_t elapsed;
+
+        if (blocking) {
+            elapsed = aio_context_idle_end(ctx);
+        } else {
+            elapsed = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
+        }
+        if (ctx->poll_max_ns) {
+            block_ns = elapsed;
+        }
     }
 
     if (ctx->fdmon_ops->dispatch) {
@@ -385,7 +385,13 @@ bool aio_poll(AioContext *ctx, bool blocking)
 
         timeout = blocking && !have_select_revents
             ? qemu_timeout_ns_to_ms(aio_compute_timeout(ctx)) : 0;
-        ret = WaitForMultipleObjects(count, events, FALSE, timeout);
+        if (timeout) {
+            aio_context_idle_begin(ctx, qemu_clock_get_ns(QEMU_CLOCK_REALTIME));
+            ret = WaitForMultipleObjects(count, events, FALSE, timeout);
+            aio_context_idle_end(ctx);
+        } else {
+            ret = WaitForMultipleObjects(count, events, FALSE, 0);
+        }
         if (blocking) {
             assert(first);
             qatomic_store_release(&ctx->notify_me,
@@ -94,7 +94,22 @@ static void aio_bh_enqueue(QEMUBH *bh, unsigned new_flags)
         QSLIST_INSERT_HEAD_ATOMIC(&ctx->bh_list, bh, next);
     }
 
-    aio_notify(ctx);
+    /*
+     * If the bottom half was already pending and scheduled, whoever set the
+     * flags notifies the event loop, which is then guaranteed to dequeue it
+     * and see new_flags.  Coalesce with that notification,
+     * so that producers that keep scheduling a bottom half (or calling
+     * aio_co_schedule()) before the event loop gets to it do not bounce
+     * ctx->notified and write the EventNotifier over and over.
+     *
+     * A pending bottom half that was cancelled may stay in the list without
+     * being dequeued by aio_ctx_check(), so it needs a new notification.
+     */
+    if ((old_flags & (BH_PENDING | BH_SCHEDULED)) !=
+        (BH_PENDING | BH_SCHEDULED)) {
+        aio_notify(ctx);
+    }
+
     if (unlikely(icount_enabled())) {
         /*
          * Workaround for record/replay.
@@ -610,6 +625,8 @@ AioContext *aio_context_new(Error **errp)
 
     ctx->aio_max_batch = 0;
 
+    seqlock_init(&ctx->idle_seqlock);
+
     ctx->thread_pool_min = 0;
     ctx->thread_pool_max = THREAD_POOL_MAX_THREADS_DEFAULT;
 
@@ -739,6 +756,51 @@ void qemu_set_current_aio_context(AioContext *ctx)
     set_my_aiocontext(ctx);
 }
 
+void aio_context_idle_begin(AioContext *ctx, int64_t start)
+{
+    seqlock_write_begin(&ctx->idle_seqlock);
+    qatomic_set_i64(&ctx->idle_since_ns, start);
+    seqlock_write_end(&ctx->idle_seqlock);
+}
+
+/*
+ * The clock is read inside the write section, so that a reader that sees
+ * the wait still in progress has read its own clock before the wait ended.
+ */
+int64_t aio_context_idle_end(AioContext *ctx)
+{
+    int64_t elapsed;
+
+    seqlock_write_begin(&ctx->idle_seqlock);
+    elapsed = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - ctx->idle_since_ns;
+    qatomic_set_i64(&ctx->idle_ns, ctx->idle_ns + elapsed);
+    qatomic_set_i64(&ctx->idle_since_ns, 0);
+    seqlock_write_end(&ctx->idle_seqlock);
+    return elapsed;
+}
+
+/*
+ * The event loop thread updates both fields together, so read them as a
+ * pair.  Otherwise a wait that just ended could be missed or counted twice.
+ */
+int64_t aio_context_get_idle_ns(AioContext *ctx, int64_t *now)
+{
+    int64_t idle_ns, idle_since;
+    unsigned start;
+
+    do {
+        start = seqlock_read_begin(&ctx->idle_seqlock);
+        *now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        idle_ns = qatomic_read_i64(&ctx->idle_ns);
+        idle_since = qatomic_read_i64(&ctx->idle_since_ns);
+    } while (seqlock_read_retry(&ctx->idle_seqlock, start));
+
+    if (idle_since && idle_since < *now) {
+        idle_ns += *now - idle_since;
+    }
+    return idle_ns;
+}
+
 void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
                                         int64_t max, Error **errp)
 {
@@ -37,6 +37,10 @@ typedef struct {
     Coroutine base;
     void *stack;
     size_t stack_size;
+#ifdef CONFIG_DEBUG_STACK_USAGE
+    /* Trampoline frame of the terminated coroutine, kept for reuse */
+    void *stack_live;
+#endif
     sigjmp_buf env;
 } CoroutineSigAltStack;
 
@@ -102,6 +106,9 @@ static void coroutine_bootstrap(CoroutineSigAltStack *self, Coroutine *co)
 
     while (true) {
         co->entry(co->entry_arg);
+#ifdef CONFIG_DEBUG_STACK_USAGE
+        self->stack_live = __builtin_frame_address(0);
+#endif
         qemu_coroutine_switch(co, co->caller, COROUTINE_TERMINATE);
     }
 }
@@ -262,6 +269,15 @@ Coroutine *qemu_coroutine_new(void)
     return &co->base;
 }
 
+#ifdef CONFIG_DEBUG_STACK_USAGE
+size_t qemu_coroutine_stack_usage(Coroutine *co_)
+{
+    CoroutineSigAltStack *co = DO_UPCAST(CoroutineSigAltStack, base, co_);
+
+    return qemu_stack_usage(co->stack, co->stack_size, co->stack_live);
+}
+#endif
+
 void qemu_coroutine_delete(Coroutine *co_)
 {
     CoroutineSigAltStack *co = DO_UPCAST(CoroutineSigAltStack, base, co_);
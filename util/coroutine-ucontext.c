@@ -46,6 +46,10 @@ typedef struct {
     Coroutine base;
     void *stack;
     size_t stack_size;
+#ifdef CONFIG_DEBUG_STACK_USAGE
+    /* Trampoline frame of the terminated coroutine, kept for reuse */
+    void *stack_live;
+#endif
 #ifdef CONFIG_SAFESTACK
     /* Need an unsafe stack for each coroutine */
     void *unsafe_stack;
@@ -173,6 +177,9 @@ static void coroutine_trampoline(int i0, int i1)
 
     while (true) {
         co->entry(co->entry_arg);
+#ifdef CONFIG_DEBUG_STACK_USAGE
+        self->stack_live = __builtin_frame_address(0);
+#endif
         qemu_coroutine_switch(co, co->caller, COROUTINE_TERMINATE);
     }
 }
@@ -278,6 +285,15 @@ static void coroutine_fn terminate_asan(void *opaque)
 }
 #endif
 
+#ifdef CONFIG_DEBUG_STACK_USAGE
+size_t qemu_coroutine_stack_usage(Coroutine *co_)
+{
+    CoroutineUContext *co = DO_UPCAST(CoroutineUContext, base, co_);
+
+    return qemu_stack_usage(co->stack, co->stack_size, co->stack_live);
+}
+#endif
+
 void qemu_coroutine_delete(Coroutine *co_)
 {
     CoroutineUContext *co = DO_UPCAST(CoroutineUContext, base, co_);
@@ -29,6 +29,10 @@ typedef struct {
     Coroutine base;
     void *stack;
     size_t stack_size;
+#ifdef CONFIG_DEBUG_STACK_USAGE
+    /* Trampoline frame of the terminated coroutine, kept for reuse */
+    void *stack_live;
+#endif
 
     void *asyncify_stack;
     size_t asyncify_stack_size;
@@ -48,9 +52,15 @@ size_t leader_asyncify_stack_size = COROUTINE_STACK_SIZE;
 static void coroutine_trampoline(void *co_)
 {
     Coroutine *co = co_;
+#ifdef CONFIG_DEBUG_STACK_USAGE
+    CoroutineEmscripten *self = DO_UPCAST(CoroutineEmscripten, base, co);
+#endif
 
     while (true) {
         co->entry(co->entry_arg);
+#ifdef CONFIG_DEBUG_STACK_USAGE
+        self->stack_live = __builtin_frame_address(0);
+#endif
         qemu_coroutine_switch(co, co->caller, COROUTINE_TERMINATE);
     }
 }
@@ -73,6 +83,15 @@ Coroutine *qemu_coroutine_new(void)
     return &co->base;
 }
 
+#ifdef CONFIG_DEBUG_STACK_USAGE
+size_t qemu_coroutine_stack_usage(Coroutine *co_)
+{
+    CoroutineEmscripten *co = DO_UPCAST(CoroutineEmscripten, base, co_);
+
+    return qemu_stack_usage(co->stack, co->stack_size, co->stack_live);
+}
+#endif
+
 void qemu_coroutine_delete(Coroutine *co_)
 {
     CoroutineEmscripten *co = DO_UPCAST(CoroutineEmscripten, base, co_);
@@ -79,6 +79,14 @@ Coroutine *qemu_coroutine_new(void)
     return &co->base;
 }
 
+#ifdef CONFIG_DEBUG_STACK_USAGE
+size_t qemu_coroutine_stack_usage(Coroutine *co)
+{
+    /* Fiber stacks are allocated by Windows and cannot be measured */
+    return 0;
+}
+#endif
+
 void qemu_coroutine_delete(Coroutine *co_)
 {
     CoroutineWin32 *co = DO_UPCAST(CoroutineWin32, base, co_);
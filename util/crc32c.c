@@ -26,7 +26,11 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/bswap.h"
 #include "qemu/crc32c.h"
+#include "host/cpuinfo.h"
+
+typedef uint32_t (*crc32c_accel_fn)(uint32_t, const uint8_t *, size_t);
 
 /*
  * This is the CRC-32C table
@@ -105,12 +109,22 @@ static const uint32_t crc32c_table[256] = {
 };
 
 
-uint32_t crc32c(uint32_t crc, const uint8_t *data, unsigned int length)
+static uint32_t crc32c_int(uint32_t crc, const uint8_t *data, size_t length)
 {
     while (length--) {
         crc = crc32c_table[(crc ^ *data++) & 0xFFL] ^ (crc >> 8);
     }
-    return crc^0xffffffff;
+    return crc;
+}
+
+#include "host/crc32c.c.inc"
+
+static crc32c_accel_fn crc32c_accel;
+static unsigned crc32c_accel_index;
+
+uint32_t crc32c(uint32_t crc, const uint8_t *data, unsigned int length)
+{
+    return crc32c_accel(crc, data, length) ^ 0xffffffff;
 }
 
 uint32_t iov_crc32c(uint32_t crc, const struct iovec *iov, size_t iov_cnt)
@@ -121,3 +135,18 @@ uint32_t iov_crc32c(uint32_t crc, const struct iovec *iov, size_t iov_cnt)
     }
     return crc ^ 0xffffffff;
 }
+
+bool test_crc32c_next_accel(void)
+{
+    if (crc32c_accel_index != 0) {
+        crc32c_accel = crc32c_accel_table[--crc32c_accel_index];
+        return true;
+    }
+    return false;
+}
+
+static void __attribute__((constructor)) crc32c_init_accel(void)
+{
+    crc32c_accel_index = crc32c_best_accel();
+    crc32c_accel = crc32c_accel_table[crc32c_accel_index];
+}
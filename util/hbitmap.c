@@ -682,6 +682,12 @@ void hbitmap_serialize_part(const HBitmap *hb, uint8_t *buf,
     serialization_chunk(hb, start, count, &cur, &el_count);
     end = cur + el_count;
 
+    if (!HOST_BIG_ENDIAN) {
+        /* The in-memory layout already is the serialized one */
+        memcpy(buf, cur, el_count * sizeof(*cur));
+        return;
+    }
+
     while (cur != end) {
         unsigned long el =
             (BITS_PER_LONG == 32 ? cpu_to_le32(*cur) : cpu_to_le64(*cur));
@@ -705,17 +711,21 @@ void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
     serialization_chunk(hb, start, count, &cur, &el_count);
     end = cur + el_count;
 
-    while (cur != end) {
-        memcpy(cur, buf, sizeof(*cur));
+    if (!HOST_BIG_ENDIAN) {
+        memcpy(cur, buf, el_count * sizeof(*cur));
+    } else {
+        while (cur != end) {
+            memcpy(cur, buf, sizeof(*cur));
 
-        if (BITS_PER_LONG == 32) {
-            le32_to_cpus((uint32_t *)cur);
-        } else {
-            le64_to_cpus((uint64_t *)cur);
-        }
+            if (BITS_PER_LONG == 32) {
+                le32_to_cpus((uint32_t *)cur);
+            } else {
+                le64_to_cpus((uint64_t *)cur);
+            }
 
-        buf += sizeof(unsigned long);
-        cur++;
+            buf += sizeof(unsigned long);
+            cur++;
+        }
     }
     if (finish) {
         hbitmap_deserialize_finish(hb);
@@ -751,6 +761,13 @@ void hbitmap_deserialize_ones(HBitmap *hb, uint64_t start, uint64_t count,
     serialization_chunk(hb, start, count, &first, &el_count);
 
     memset(first, 0xff, el_count * sizeof(unsigned long));
+
+    /* Keep the bits past the end of the bitmap clear */
+    if ((hb->size & (BITS_PER_LONG - 1)) &&
+        first + el_count == hb->levels[HBITMAP_LEVELS - 1] +
+                            hb->sizes[HBITMAP_LEVELS - 1]) {
+        first[el_count - 1] = (1UL << (hb->size & (BITS_PER_LONG - 1))) - 1;
+    }
     if (finish) {
         hbitmap_deserialize_finish(hb);
     }
@@ -892,6 +909,43 @@ static void hbitmap_sparse_merge(HBitmap *dst, const HBitmap *src)
     }
 }
 
+/**
+ * hbitmap_merge_words: performs dst = dst | src
+ * for bitmaps of the same size and granularity.  Only the nonzero words
+ * of src are visited, and the upper levels and the count of dst are
+ * updated incrementally, so the cost is proportional to the population
+ * of src rather than to the size of the bitmaps.
+ */
+static void hbitmap_merge_words(HBitmap *dst, const HBitmap *src)
+{
+    HBitmapIter hbi;
+    unsigned long cur, old;
+    uint64_t pos;
+    size_t el;
+    int lev;
+
+    hbitmap_iter_init(&hbi, src, 0);
+    while ((el = hbitmap_iter_next_word(&hbi, &cur)) != -1) {
+        old = dst->levels[HBITMAP_LEVELS - 1][el];
+        if ((old | cur) == old) {
+            continue;
+        }
+        dst->levels[HBITMAP_LEVELS - 1][el] = old | cur;
+        dst->count += ctpopl(old | cur) - ctpopl(old);
+
+        /* Propagate up while the words were empty; level 0 has a sentinel */
+        pos = el;
+        lev = HBITMAP_LEVELS - 1;
+        while (!old && lev-- > 0) {
+            unsigned long bit = 1UL << (pos & (BITS_PER_LONG - 1));
+
+            pos >>= BITS_PER_LEVEL;
+            old = dst->levels[lev][pos];
+            dst->levels[lev][pos] = old | bit;
+        }
+    }
+}
+
 /**
  * Given HBitmaps A and B, let R := A (BITOR) B.
  * Bitmaps A and B will not be modified,
@@ -901,7 +955,7 @@ static void hbitmap_sparse_merge(HBitmap *dst, const HBitmap *src)
 void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
 {
     int i;
-    uint64_t j;
+    uint64_t j, count;
 
     assert(a->orig_size == result->orig_size);
     assert(b->orig_size == result->orig_size);
@@ -929,19 +983,29 @@ void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
         return;
     }
 
+    assert(a->size == b->size);
+    if (result == a || result == b) {
+        hbitmap_merge_words(result, result == a ? b : a);
+        return;
+    }
+
     /* This merge is O(size), as BITS_PER_LONG and HBITMAP_LEVELS are constant.
-     * It may be possible to improve running times for sparsely populated maps
-     * by using hbitmap_iter_next, but this is suboptimal for dense maps.
+     * The dirty count is recomputed on the fly for the last level.
      */
-    assert(a->size == b->size);
-    for (i = HBITMAP_LEVELS - 1; i >= 0; i--) {
+    count = 0;
+    for (j = 0; j < a->sizes[HBITMAP_LEVELS - 1]; j++) {
+        unsigned long el = a->levels[HBITMAP_LEVELS - 1][j] |
+                           b->levels[HBITMAP_LEVELS - 1][j];
+
+        result->levels[HBITMAP_LEVELS - 1][j] = el;
+        count += ctpopl(el);
+    }
+    for (i = HBITMAP_LEVELS - 2; i >= 0; i--) {
         for (j = 0; j < a->sizes[i]; j++) {
             result->levels[i][j] = a->levels[i][j] | b->levels[i][j];
         }
     }
-
-    /* Recompute the dirty count */
-    result->count = hb_count_between(result, 0, result->size - 1);
+    result->count = count;
 }
 
 char *hbitmap_sha256(const HBitmap *bitmap, Error **errp)
@@ -796,8 +796,11 @@ IntervalTreeNode *interval_tree_iter_first(IntervalTreeRoot *root,
                                            uint64_t start, uint64_t last)
 {
     IntervalTreeNode *node, *leftmost;
+    RBNode *rb;
 
-    if (!root || !root->rb_root.rb_node) {
+    /* Read each pointer only once, for lockless lookups */
+    rb = root ? qatomic_read(&root->rb_root.rb_node) : NULL;
+    if (!rb) {
         return NULL;
     }
 
@@ -814,12 +817,16 @@ IntervalTreeNode *interval_tree_iter_first(IntervalTreeRoot *root,
      * This allows mitigating some of the tree walk overhead for
      * for non-intersecting ranges, maintained and consulted in O(1).
      */
-    node = rb_to_itree(root->rb_root.rb_node);
+    node = rb_to_itree(rb);
     if (node->subtree_last < start) {
         return NULL;
     }
 
-    leftmost = rb_to_itree(root->rb_leftmost);
+    rb = qatomic_read(&root->rb_leftmost);
+    if (!rb) {
+        return NULL;
+    }
+    leftmost = rb_to_itree(rb);
     if (leftmost->start > last) {
         return NULL;
     }
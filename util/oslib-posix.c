@@ -706,6 +706,13 @@ char *qemu_get_pid_name(pid_t pid)
     return name;
 }
 
+#ifdef CONFIG_DEBUG_STACK_USAGE
+/* Fill pattern for unused stack memory */
+#define STACK_CANARY 0xdeadbeaf
+
+/* Bytes below the live frames that qemu_stack_usage() does not refill */
+#define STACK_USAGE_LIVE_MARGIN 4096
+#endif
 
 void *qemu_alloc_stack(size_t *sz)
 {
@@ -750,7 +757,7 @@ void *qemu_alloc_stack(size_t *sz)
 
 #ifdef CONFIG_DEBUG_STACK_USAGE
     for (ptr2 = ptr + pagesz; ptr2 < ptr + *sz; ptr2 += sizeof(uint32_t)) {
-        *(uint32_t *)ptr2 = 0xdeadbeaf;
+        *(uint32_t *)ptr2 = STACK_CANARY;
     }
 #endif
 
@@ -759,26 +766,47 @@ void *qemu_alloc_stack(size_t *sz)
 
 #ifdef CONFIG_DEBUG_STACK_USAGE
 static __thread unsigned int max_stack_usage;
-#endif
 
-void qemu_free_stack(void *stack, size_t sz)
+size_t qemu_stack_usage(void *stack, size_t sz, void *live)
 {
-#ifdef CONFIG_DEBUG_STACK_USAGE
     unsigned int usage;
+    void *high_water;
+    void *limit = stack + sz;
     void *ptr;
 
     for (ptr = stack + qemu_real_host_page_size(); ptr < stack + sz;
          ptr += sizeof(uint32_t)) {
-        if (*(uint32_t *)ptr != 0xdeadbeaf) {
+        if (*(uint32_t *)ptr != STACK_CANARY) {
             break;
         }
     }
-    usage = sz - (uintptr_t) (ptr - stack);
+    high_water = ptr;
+
+    usage = sz - (uintptr_t) (high_water - stack);
     if (usage > max_stack_usage) {
         error_report("thread %d max stack usage increased from %u to %u",
                      qemu_get_thread_id(), max_stack_usage, usage);
         max_stack_usage = usage;
     }
+
+    /*
+     * The frames from @live upwards, and the context switch frame just
+     * below them, are returned to when the stack is reused.  Keep clear.
+     */
+    if (live) {
+        limit = live - STACK_USAGE_LIVE_MARGIN;
+    }
+    for (ptr = high_water; ptr < limit; ptr += sizeof(uint32_t)) {
+        *(uint32_t *)ptr = STACK_CANARY;
+    }
+    return usage;
+}
+#endif
+
+void qemu_free_stack(void *stack, size_t sz)
+{
+#ifdef CONFIG_DEBUG_STACK_USAGE
+    qemu_stack_usage(stack, sz, NULL);
 #endif
 
     munmap(stack, sz);
@@ -19,6 +19,7 @@
 #include "qemu/coroutine_int.h"
 #include "qemu/coroutine-tls.h"
 #include "qemu/cutils.h"
+#include "qemu/error-report.h"
 #include "block/aio.h"
 
 enum {
@@ -232,10 +233,38 @@ Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
     return co;
 }
 
+#ifdef CONFIG_DEBUG_STACK_USAGE
+static QemuMutex stack_usage_lock; /* protects stack_usage */
+static GHashTable *stack_usage;    /* CoroutineEntry * -> maximum usage */
+
+/*
+ * Report the maximum stack usage per entry function so that stack sizes
+ * can be tuned.  This runs on the caller's stack, so that neither the
+ * measurement nor the report itself touch @co's stack.
+ */
+static void coroutine_stack_usage_update(Coroutine *co)
+{
+    size_t usage = qemu_coroutine_stack_usage(co);
+    size_t old;
+
+    QEMU_LOCK_GUARD(&stack_usage_lock);
+    old = GPOINTER_TO_SIZE(g_hash_table_lookup(stack_usage, co->entry));
+    if (usage > old) {
+        error_report("coroutine %p max stack usage increased from %zu to %zu",
+                     co->entry, old, usage);
+        g_hash_table_insert(stack_usage, co->entry, GSIZE_TO_POINTER(usage));
+    }
+}
+#endif
+
 static void coroutine_delete(Coroutine *co)
 {
     co->caller = NULL;
 
+#ifdef CONFIG_DEBUG_STACK_USAGE
+    coroutine_stack_usage_update(co);
+#endif
+
     if (IS_ENABLED(CONFIG_COROUTINE_POOL)) {
         coroutine_pool_put(co);
     } else {
@@ -397,5 +426,9 @@ static unsigned int get_global_pool_hard_max_size(void)
 static void __attribute__((constructor)) qemu_coroutine_init(void)
 {
     qemu_mutex_init(&global_pool_lock);
+#ifdef CONFIG_DEBUG_STACK_USAGE
+    qemu_mutex_init(&stack_usage_lock);
+    stack_usage = g_hash_table_new(NULL, NULL);
+#endif
     global_pool_hard_max_size = get_global_pool_hard_max_size();
 }
@@ -22,8 +22,9 @@
  * - Writes (i.e. insertions/removals) can be concurrent with writes to
  *   different buckets; writes to the same bucket are serialized through a lock.
  * - Optional auto-resizing: the hash table resizes up if the load surpasses
- *   a certain threshold. Resizing is done concurrently with readers; writes
- *   are serialized with the resize operation.
+ *   a certain threshold. Resizing is done concurrently with readers and
+ *   writers; a write only waits for the resize if it hits the bucket that
+ *   is being migrated at that moment.
  *
  * The key structure is the bucket, which is cacheline-sized. Buckets
  * contain a few hash values and pointers; the u32 hash values are stored in
@@ -43,14 +44,19 @@
  * just-removed entry. This makes lookups slightly faster, since the moment an
  * invalid entry is found, the (failed) lookup is over.
  *
- * Resizing is done by taking all bucket spinlocks (so that no other writers can
- * race with us) and then copying all entries into a new hash map. Then, the
- * ht->map pointer is set, and the old map is freed once no RCU readers can see
- * it anymore.
+ * Resizing is done incrementally, one head bucket at a time: the resizer
+ * takes the bucket's spinlock, copies its entries into the new map and marks
+ * the bucket as migrated by bumping the old map's n_migrated. Once all
+ * buckets are migrated, the ht->map pointer is set, and the old map is freed
+ * once no RCU readers can see it anymore. Resets that change the size of the
+ * table take all bucket spinlocks instead, and mark every bucket as migrated
+ * at once.
  *
- * Writers check for concurrent resizes by comparing ht->map before and after
- * acquiring their bucket lock. If they don't match, a resize has occurred
- * while the bucket spinlock was being acquired.
+ * Readers and writers that find their bucket migrated follow the old map's
+ * pointer to the new map and retry there; readers check this within the
+ * bucket's seqlock read section, writers after acquiring the bucket lock.
+ * Migrated buckets are never written to again, so this also catches writers
+ * that raced with the final switch of ht->map.
  *
  * Related Work:
  * - Idea of cacheline-sized buckets with full hashes taken from:
@@ -176,6 +182,9 @@ struct qht_tsan_lock {
  * @n_added_buckets: number of added (i.e. "non-head") buckets
  * @n_added_buckets_threshold: threshold to trigger an upward resize once the
  *                             number of added buckets surpasses it.
+ * @new: map that this map's entries are being migrated to, or NULL.
+ * @n_migrated: number of head buckets, starting from the first one, that
+ *              have been migrated to @new.
  * @tsan_bucket_locks: Array of striped locks to be used only under TSAN.
  *
  * Buckets are tracked in what we call a "map", i.e. this structure.
@@ -186,6 +195,8 @@ struct qht_map {
     size_t n_buckets;
     size_t n_added_buckets;
     size_t n_added_buckets_threshold;
+    struct qht_map *new;
+    size_t n_migrated;
 #ifdef CONFIG_TSAN
     struct qht_tsan_lock tsan_bucket_locks[QHT_TSAN_BUCKET_LOCKS];
 #endif
@@ -194,8 +205,7 @@ struct qht_map {
 /* trigger a resize when n_added_buckets > n_buckets / div */
 #define QHT_NR_ADDED_BUCKETS_THRESHOLD_DIV 8
 
-static void qht_do_resize_reset(struct qht *ht, struct qht_map *new,
-                                bool reset);
+static void qht_do_resize(struct qht *ht, struct qht_map *new);
 static void qht_grow_maybe(struct qht *ht);
 
 #ifdef QHT_DEBUG
@@ -332,17 +342,20 @@ static void qht_map_unlock_buckets(struct qht_map *map)
 }
 
 /*
- * Call with at least a bucket lock held.
- * @map should be the value read before acquiring the lock (or locks).
+ * Call with @head's lock held, or within its seqlock read section.
+ * Once migrated, a head bucket stays so; @map->new is then valid.
  */
-static inline bool qht_map_is_stale__locked(const struct qht *ht,
-                                            const struct qht_map *map)
+static inline bool qht_bucket_is_migrated(const struct qht_map *map,
+                                          const struct qht_bucket *head)
 {
-    return map != ht->map;
+    /* Pairs with qatomic_store_release() in qht_map_migrate() */
+    return (size_t)(head - map->buckets) <
+           qatomic_load_acquire(&map->n_migrated);
 }
 
 /*
- * Grab all bucket locks, and set @pmap after making sure the map isn't stale.
+ * Grab all bucket locks, and set @pmap after making sure that no resize
+ * is in progress.
  *
  * Pairs with qht_map_unlock_buckets(), hence the pass-by-reference.
  *
@@ -353,15 +366,10 @@ void qht_map_lock_buckets__no_stale(struct qht *ht, struct qht_map **pmap)
 {
     struct qht_map *map;
 
-    map = qatomic_rcu_read(&ht->map);
-    qht_map_lock_buckets(map);
-    if (likely(!qht_map_is_stale__locked(ht, map))) {
-        *pmap = map;
-        return;
-    }
-    qht_map_unlock_buckets(map);
-
-    /* we raced with a resize; acquire ht->lock to see the updated ht->map */
+    /*
+     * A resize holds ht->lock until all buckets are migrated, and a new
+     * one cannot start while we hold all bucket locks of ht->map.
+     */
     qht_lock(ht);
     map = ht->map;
     qht_map_lock_buckets(map);
@@ -370,12 +378,10 @@ void qht_map_lock_buckets__no_stale(struct qht *ht, struct qht_map **pmap)
 }
 
 /*
- * Get a head bucket and lock it, making sure its parent map is not stale.
- * @pmap is filled with a pointer to the bucket's parent map.
+ * Get a head bucket and lock it, making sure it has not been migrated to
+ * a new map.  @pmap is filled with a pointer to the bucket's parent map.
  *
  * Unlock with qht_bucket_unlock.
- *
- * Note: callers cannot have ht->lock held.
  */
 static inline
 struct qht_bucket *qht_bucket_lock__no_stale(struct qht *ht, uint32_t hash,
@@ -385,23 +391,18 @@ struct qht_bucket *qht_bucket_lock__no_stale(struct qht *ht, uint32_t hash,
     struct qht_map *map;
 
     map = qatomic_rcu_read(&ht->map);
-    b = qht_map_to_bucket(map, hash);
+    for (;;) {
+        b = qht_map_to_bucket(map, hash);
+        qht_bucket_lock(map, b);
+        if (likely(!qht_bucket_is_migrated(map, b))) {
+            *pmap = map;
+            return b;
+        }
+        qht_bucket_unlock(map, b);
 
-    qht_bucket_lock(map, b);
-    if (likely(!qht_map_is_stale__locked(ht, map))) {
-        *pmap = map;
-        return b;
+        /* we raced with a resize; retry in the map it is migrating to */
+        map = qatomic_rcu_read(&map->new);
     }
-    qht_bucket_unlock(map, b);
-
-    /* we raced with a resize; acquire ht->lock to see the updated ht->map */
-    qht_lock(ht);
-    map = ht->map;
-    b = qht_map_to_bucket(map, hash);
-    qht_bucket_lock(map, b);
-    qht_unlock(ht);
-    *pmap = map;
-    return b;
 }
 
 static inline bool qht_map_needs_resize(const struct qht_map *map)
@@ -445,6 +446,8 @@ static struct qht_map *qht_map_create(size_t n_buckets)
     map->n_buckets = n_buckets;
 
     map->n_added_buckets = 0;
+    map->new = NULL;
+    map->n_migrated = 0;
     map->n_added_buckets_threshold = n_buckets /
         QHT_NR_ADDED_BUCKETS_THRESHOLD_DIV;
 
@@ -522,14 +525,31 @@ void qht_reset(struct qht *ht)
     qht_map_unlock_buckets(map);
 }
 
-static inline void qht_do_resize(struct qht *ht, struct qht_map *new)
+/*
+ * Atomically reset the table, switching to @new if it is not NULL.
+ * Call with ht->lock held.
+ */
+static void qht_do_resize_and_reset(struct qht *ht, struct qht_map *new)
 {
-    qht_do_resize_reset(ht, new, false);
-}
+    struct qht_map *old = ht->map;
 
-static inline void qht_do_resize_and_reset(struct qht *ht, struct qht_map *new)
-{
-    qht_do_resize_reset(ht, new, true);
+    qht_map_lock_buckets(old);
+    qht_map_reset__all_locked(old);
+
+    if (new == NULL) {
+        qht_map_unlock_buckets(old);
+        return;
+    }
+
+    g_assert(new->n_buckets != old->n_buckets);
+
+    /* writers waiting for the old bucket locks will retry in @new */
+    qatomic_rcu_set(&old->new, new);
+    qatomic_store_release(&old->n_migrated, old->n_buckets);
+
+    qatomic_rcu_set(&ht->map, new);
+    qht_map_unlock_buckets(old);
+    call_rcu(old, qht_map_destroy, rcu);
 }
 
 bool qht_reset_size(struct qht *ht, size_t n_elems)
@@ -579,17 +599,25 @@ void *qht_do_lookup(const struct qht_bucket *head, qht_lookup_func_t func,
 }
 
 static __attribute__((noinline))
-void *qht_lookup__slowpath(const struct qht_bucket *b, qht_lookup_func_t func,
+void *qht_lookup__slowpath(const struct qht_map *map,
+                           const struct qht_bucket *b, qht_lookup_func_t func,
                            const void *userp, uint32_t hash)
 {
     unsigned int version;
     void *ret;
 
-    do {
+    for (;;) {
         version = seqlock_read_begin(&b->sequence);
+        if (unlikely(qht_bucket_is_migrated(map, b))) {
+            map = qatomic_rcu_read(&map->new);
+            b = qht_map_to_bucket(map, hash);
+            continue;
+        }
         ret = qht_do_lookup(b, func, userp, hash);
-    } while (seqlock_read_retry(&b->sequence, version));
-    return ret;
+        if (!seqlock_read_retry(&b->sequence, version)) {
+            return ret;
+        }
+    }
 }
 
 void *qht_lookup_custom(const struct qht *ht, const void *userp, uint32_t hash,
@@ -604,15 +632,17 @@ void *qht_lookup_custom(const struct qht *ht, const void *userp, uint32_t hash,
     b = qht_map_to_bucket(map, hash);
 
     version = seqlock_read_begin(&b->sequence);
-    ret = qht_do_lookup(b, func, userp, hash);
-    if (likely(!seqlock_read_retry(&b->sequence, version))) {
-        return ret;
+    if (likely(!qht_bucket_is_migrated(map, b))) {
+        ret = qht_do_lookup(b, func, userp, hash);
+        if (likely(!seqlock_read_retry(&b->sequence, version))) {
+            return ret;
+        }
     }
     /*
      * Removing the do/while from the fastpath gives a 4% perf. increase when
      * running a 100%-lookup microbenchmark.
      */
-    return qht_lookup__slowpath(b, func, userp, hash);
+    return qht_lookup__slowpath(map, b, func, userp, hash);
 }
 
 void *qht_lookup(const struct qht *ht, const void *userp, uint32_t hash)
@@ -871,8 +901,7 @@ do_qht_iter(struct qht *ht, const struct qht_iter *iter, void *userp)
 {
     struct qht_map *map;
 
-    map = qatomic_rcu_read(&ht->map);
-    qht_map_lock_buckets(map);
+    qht_map_lock_buckets__no_stale(ht, &map);
     qht_map_iter__all_locked(map, iter, userp);
     qht_map_unlock_buckets(map);
 }
@@ -897,55 +926,58 @@ void qht_iter_remove(struct qht *ht, qht_iter_bool_func_t func, void *userp)
     do_qht_iter(ht, &iter, userp);
 }
 
-struct qht_map_copy_data {
-    struct qht *ht;
-    struct qht_map *new;
-};
-
-static void qht_map_copy(void *p, uint32_t hash, void *userp)
+/* call with @head's lock held */
+static void qht_bucket_migrate__locked(struct qht *ht, struct qht_map *new,
+                                       struct qht_bucket *head)
 {
-    struct qht_map_copy_data *data = userp;
-    struct qht *ht = data->ht;
-    struct qht_map *new = data->new;
-    struct qht_bucket *b = qht_map_to_bucket(new, hash);
+    struct qht_bucket *b = head;
+    int i;
 
-    /* no need to acquire b->lock because no thread has seen this map yet */
-    qht_insert__locked(ht, new, b, p, hash, NULL);
+    do {
+        for (i = 0; i < QHT_BUCKET_ENTRIES; i++) {
+            struct qht_bucket *to;
+
+            if (b->pointers[i] == NULL) {
+                return;
+            }
+            to = qht_map_to_bucket(new, b->hashes[i]);
+            qht_bucket_lock(new, to);
+            qht_insert__locked(ht, new, to, b->pointers[i], b->hashes[i],
+                               NULL);
+            qht_bucket_debug__locked(to);
+            qht_bucket_unlock(new, to);
+        }
+        b = b->next;
+    } while (b);
 }
 
 /*
- * Atomically perform a resize and/or reset.
+ * Move all entries to @new, one head bucket at a time, then switch to it.
+ * Lookups and writes proceed concurrently; only those that hit the bucket
+ * being migrated wait for it.
  * Call with ht->lock held.
  */
-static void qht_do_resize_reset(struct qht *ht, struct qht_map *new, bool reset)
+static void qht_do_resize(struct qht *ht, struct qht_map *new)
 {
-    struct qht_map *old;
-    const struct qht_iter iter = {
-        .f.retvoid = qht_map_copy,
-        .type = QHT_ITER_VOID,
-    };
-    struct qht_map_copy_data data;
-
-    old = ht->map;
-    qht_map_lock_buckets(old);
-
-    if (reset) {
-        qht_map_reset__all_locked(old);
-    }
-
-    if (new == NULL) {
-        qht_map_unlock_buckets(old);
-        return;
-    }
+    struct qht_map *old = ht->map;
+    size_t i;
 
     g_assert(new->n_buckets != old->n_buckets);
-    data.ht = ht;
-    data.new = new;
-    qht_map_iter__all_locked(old, &iter, &data);
-    qht_map_debug__all_locked(new);
+    qatomic_rcu_set(&old->new, new);
+
+    for (i = 0; i < old->n_buckets; i++) {
+        struct qht_bucket *head = &old->buckets[i];
+
+        qht_bucket_lock(old, head);
+        /* make lookups that raced with the migration retry in @new */
+        seqlock_write_begin(&head->sequence);
+        qht_bucket_migrate__locked(ht, new, head);
+        qatomic_store_release(&old->n_migrated, i + 1);
+        seqlock_write_end(&head->sequence);
+        qht_bucket_unlock(old, head);
+    }
 
     qatomic_rcu_set(&ht->map, new);
-    qht_map_unlock_buckets(old);
     call_rcu(old, qht_map_destroy, rcu);
 }
 
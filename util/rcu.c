@@ -32,6 +32,8 @@
 #include "qemu/thread.h"
 #include "qemu/main-loop.h"
 #include "qemu/lockable.h"
+#include "qemu/timer.h"
+#include "trace.h"
 #if defined(CONFIG_MALLOC_TRIM)
 #include <malloc.h>
 #endif
@@ -46,11 +48,19 @@
 
 #define RCU_CALL_MIN_SIZE        30
 
+/* Polling interval and maximum polling time before a grace period is forced */
+#define RCU_POLL_INTERVAL_MS     10
+#define RCU_POLL_TIMEOUT_NS      (50 * SCALE_MS)
+
 unsigned long rcu_gp_ctr = RCU_GP_LOCKED;
 
 QemuEvent rcu_gp_event;
-static int in_drain_call_rcu;
+static int rcu_expedite;
 static int rcu_call_count;
+
+/* Cuts the polling in wait_for_readers() short */
+static QemuSemaphore rcu_force_sem;
+
 static QemuMutex rcu_registry_lock;
 static QemuMutex rcu_sync_lock;
 
@@ -80,23 +90,35 @@ static void wait_for_readers(void)
 {
     ThreadList qsreaders = QLIST_HEAD_INITIALIZER(qsreaders);
     struct rcu_reader_data *index, *tmp;
-    int sleeps = 0;
+    int64_t start = get_clock();
     bool forced = false;
 
+    /*
+     * Posts left over from earlier grace periods would make the polling
+     * below return immediately.  Their reasons, if still valid, are checked
+     * again in the first iteration anyway.
+     */
+    while (qemu_sem_timedwait(&rcu_force_sem, 0) == 0) {
+        /* nothing */
+    }
+
     for (;;) {
         /*
          * Force the grace period to end and wait for it if any of the
          * following heuristical conditions are satisfied:
          * - A decent number of callbacks piled up.
          * - It timed out.
-         * - It is in a drain_call_rcu() call.
+         * - It is in a drain_call_rcu() or synchronize_rcu_expedited() call.
          *
          * Otherwise, periodically poll the grace period, hoping it ends
-         * promptly.
+         * promptly.  The first and the last condition also wake up the
+         * poller through rcu_force_sem, so that they take effect without
+         * waiting for the end of the polling interval.
          */
         if (!forced &&
             (qatomic_read(&rcu_call_count) >= RCU_CALL_MIN_SIZE ||
-             sleeps >= 5 || qatomic_read(&in_drain_call_rcu))) {
+             get_clock() - start >= RCU_POLL_TIMEOUT_NS ||
+             qatomic_read(&rcu_expedite))) {
             forced = true;
 
             QLIST_FOREACH(index, &registry, node) {
@@ -160,8 +182,7 @@ static void wait_for_readers(void)
              */
             qemu_event_reset(&rcu_gp_event);
         } else {
-            g_usleep(10000);
-            sleeps++;
+            qemu_sem_timedwait(&rcu_force_sem, RCU_POLL_INTERVAL_MS);
         }
 
         qemu_mutex_lock(&rcu_registry_lock);
@@ -169,6 +190,8 @@ static void wait_for_readers(void)
 
     /* put back the reader list in the registry */
     QLIST_SWAP(&registry, &qsreaders, node);
+
+    trace_rcu_grace_period(forced, get_clock() - start);
 }
 
 void synchronize_rcu(void)
@@ -203,6 +226,18 @@ void synchronize_rcu(void)
     }
 }
 
+void synchronize_rcu_expedited(void)
+{
+    /*
+     * Also force the grace period that the call_rcu thread may be polling
+     * for, since it holds rcu_sync_lock until that one ends.
+     */
+    qatomic_inc(&rcu_expedite);
+    qemu_sem_post(&rcu_force_sem);
+    synchronize_rcu();
+    qatomic_dec(&rcu_expedite);
+}
+
 /* Multi-producer, single-consumer queue based on urcu/static/wfqueue.h
  * from liburcu.  Note that head is only used by the consumer.
  */
@@ -306,6 +341,7 @@ static void *call_rcu_thread(void *opaque)
 
         synchronize_rcu();
         qatomic_sub(&rcu_call_count, n);
+        trace_call_rcu_batch(n);
         bql_lock();
         while (n > 0) {
             node = try_dequeue();
@@ -332,7 +368,10 @@ void call_rcu1(struct rcu_head *node, void (*func)(struct rcu_head *node))
 {
     node->func = func;
     enqueue(node);
-    qatomic_inc(&rcu_call_count);
+    if (qatomic_fetch_inc(&rcu_call_count) == RCU_CALL_MIN_SIZE - 1) {
+        /* Enough callbacks piled up, stop polling for the grace period */
+        qemu_sem_post(&rcu_force_sem);
+    }
     qemu_event_set(&rcu_call_ready_event);
 }
 
@@ -382,10 +421,11 @@ void drain_call_rcu(void)
      * assumed.
      */
 
-    qatomic_inc(&in_drain_call_rcu);
+    qatomic_inc(&rcu_expedite);
     call_rcu1(&rcu_drain.rcu, drain_rcu_callback);
+    qemu_sem_post(&rcu_force_sem);
     qemu_event_wait(&rcu_drain.drain_complete_event);
-    qatomic_dec(&in_drain_call_rcu);
+    qatomic_dec(&rcu_expedite);
 
     if (locked) {
         bql_lock();
@@ -429,6 +469,7 @@ static void rcu_init_complete(void)
     qemu_mutex_init(&rcu_registry_lock);
     qemu_mutex_init(&rcu_sync_lock);
     qemu_event_init(&rcu_gp_event, true);
+    qemu_sem_init(&rcu_force_sem, 0);
 
     qemu_event_init(&rcu_call_ready_event, false);
 
@@ -23,6 +23,7 @@
  */
 
 #include "qemu/osdep.h"
+#include <math.h>
 #include "qapi/error.h"
 #include "qemu/throttle.h"
 #include "qemu/timer.h"
@@ -87,6 +88,29 @@ static int64_t throttle_do_compute_wait(double limit, double extra)
     return wait;
 }
 
+/* compute how many units a leaky bucket can hold before it throttles
+ *
+ * @bkt:               the leaky bucket we operate on
+ * @bucket_size:       I/O before throttling to bkt->avg
+ * @burst_bucket_size: I/O before throttling to bkt->max
+ */
+static void throttle_bucket_size(LeakyBucket *bkt, double *bucket_size,
+                                 double *burst_bucket_size)
+{
+    if (!bkt->max) {
+        /* If bkt->max is 0 we still want to allow short bursts of I/O
+         * from the guest, otherwise every other request will be throttled
+         * and performance will suffer considerably. */
+        *bucket_size = (double) bkt->avg / 10;
+        *burst_bucket_size = 0;
+    } else {
+        /* If we have a burst limit then we have to wait until all I/O
+         * at burst rate has finished before throttling to bkt->avg */
+        *bucket_size = bkt->max * bkt->burst_length;
+        *burst_bucket_size = (double) bkt->max / 10;
+    }
+}
+
 /* This function compute the wait time in ns that a leaky bucket should trigger
  *
  * @bkt: the leaky bucket we operate on
@@ -102,18 +126,7 @@ int64_t throttle_compute_wait(LeakyBucket *bkt)
         return 0;
     }
 
-    if (!bkt->max) {
-        /* If bkt->max is 0 we still want to allow short bursts of I/O
-         * from the guest, otherwise every other request will be throttled
-         * and performance will suffer considerably. */
-        bucket_size = (double) bkt->avg / 10;
-        burst_bucket_size = 0;
-    } else {
-        /* If we have a burst limit then we have to wait until all I/O
-         * at burst rate has finished before throttling to bkt->avg */
-        bucket_size = bkt->max * bkt->burst_length;
-        burst_bucket_size = (double) bkt->max / 10;
-    }
+    throttle_bucket_size(bkt, &bucket_size, &burst_bucket_size);
 
     /* If the main bucket is full then we have to wait */
     extra = bkt->level - bucket_size;
@@ -462,46 +475,174 @@ bool throttle_schedule_timer(ThrottleState *ts,
     return true;
 }
 
-/* do the accounting for this operation
+static const BucketType bucket_types_size[THROTTLE_MAX][2] = {
+    { THROTTLE_BPS_TOTAL, THROTTLE_BPS_READ },
+    { THROTTLE_BPS_TOTAL, THROTTLE_BPS_WRITE }
+};
+static const BucketType bucket_types_units[THROTTLE_MAX][2] = {
+    { THROTTLE_OPS_TOTAL, THROTTLE_OPS_READ },
+    { THROTTLE_OPS_TOTAL, THROTTLE_OPS_WRITE }
+};
+
+/* compute the number of operations that an I/O of a given size counts for
+ *
+ * @op_size: the size of an operation in bytes, or 0
+ * @size:    the size of the I/O
+ * @ret:     the number of operations
+ */
+static double throttle_units(uint64_t op_size, uint64_t size)
+{
+    /* if op_size is defined and smaller than size we compute unit count */
+    if (op_size && size > op_size) {
+        return (double) size / op_size;
+    }
+    return 1.0;
+}
+
+/* add (or remove, if negative) bytes and operations to the buckets of a
+ * direction.  Infinite amounts come from directions without a limit and
+ * are not added.
  *
  * @direction: throttle direction
- * @size:     the size of the operation
+ * @size:      the number of bytes
+ * @units:     the number of operations
  */
-void throttle_account(ThrottleState *ts, ThrottleDirection direction,
-                      uint64_t size)
+static void throttle_do_account(ThrottleState *ts, ThrottleDirection direction,
+                                double size, double units)
 {
-    static const BucketType bucket_types_size[THROTTLE_MAX][2] = {
-        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_READ },
-        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_WRITE }
-    };
-    static const BucketType bucket_types_units[THROTTLE_MAX][2] = {
-        { THROTTLE_OPS_TOTAL, THROTTLE_OPS_READ },
-        { THROTTLE_OPS_TOTAL, THROTTLE_OPS_WRITE }
-    };
-    double units = 1.0;
     unsigned i;
 
-    assert(direction < THROTTLE_MAX);
-    /* if cfg.op_size is defined and smaller than size we compute unit count */
-    if (ts->cfg.op_size && size > ts->cfg.op_size) {
-        units = (double) size / ts->cfg.op_size;
+    if (isinf(size)) {
+        size = 0;
+    }
+    if (isinf(units)) {
+        units = 0;
     }
 
     for (i = 0; i < ARRAY_SIZE(bucket_types_size[THROTTLE_READ]); i++) {
         LeakyBucket *bkt;
 
         bkt = &ts->cfg.buckets[bucket_types_size[direction][i]];
-        bkt->level += size;
+        bkt->level = MAX(bkt->level + size, 0);
         if (bkt->burst_length > 1) {
-            bkt->burst_level += size;
+            bkt->burst_level = MAX(bkt->burst_level + size, 0);
         }
 
         bkt = &ts->cfg.buckets[bucket_types_units[direction][i]];
-        bkt->level += units;
+        bkt->level = MAX(bkt->level + units, 0);
+        if (bkt->burst_length > 1) {
+            bkt->burst_level = MAX(bkt->burst_level + units, 0);
+        }
+    }
+}
+
+/* do the accounting for this operation
+ *
+ * @direction: throttle direction
+ * @size:     the size of the operation
+ */
+void throttle_account(ThrottleState *ts, ThrottleDirection direction,
+                      uint64_t size)
+{
+    assert(direction < THROTTLE_MAX);
+    throttle_do_account(ts, direction, size,
+                        throttle_units(ts->cfg.op_size, size));
+}
+
+/* compute how many units a set of buckets can still take before
+ * throttle_compute_wait() reports a wait for any of them
+ *
+ * @types: the buckets to check
+ * @ret:   the number of units, or INFINITY if none of them has a limit
+ */
+static double throttle_compute_headroom(ThrottleState *ts,
+                                        const BucketType types[2])
+{
+    double headroom = INFINITY;
+    unsigned i;
+
+    for (i = 0; i < 2; i++) {
+        LeakyBucket *bkt = &ts->cfg.buckets[types[i]];
+        double bucket_size, burst_bucket_size;
+
+        if (!bkt->avg) {
+            continue;
+        }
+
+        throttle_bucket_size(bkt, &bucket_size, &burst_bucket_size);
+        headroom = MIN(headroom, bucket_size - bkt->level);
         if (bkt->burst_length > 1) {
-            bkt->burst_level += units;
+            headroom = MIN(headroom, burst_bucket_size - bkt->burst_level);
         }
     }
+
+    return MAX(headroom, 0);
+}
+
+/* account a share of the capacity that is left in the buckets of a
+ * direction and hand it out as credit, so that the caller can then run
+ * I/O with throttle_credit_consume() without touching the ThrottleState.
+ *
+ * The bucket levels are taken as of the last leak, so this is meant to
+ * be called right after throttle_schedule_timer() returned false.
+ *
+ * @direction: throttle direction
+ * @share:     the fraction of the remaining capacity to borrow
+ * @credit:    the credit to top up
+ */
+void throttle_borrow(ThrottleState *ts, ThrottleDirection direction,
+                     double share, ThrottleCredit *credit)
+{
+    double size, units;
+
+    assert(direction < THROTTLE_MAX);
+    assert(share > 0 && share <= 1);
+
+    /* Only lend whole units so that repaying restores the exact levels */
+    size = floor(throttle_compute_headroom(ts, bucket_types_size[direction]) *
+                 share);
+    units = floor(throttle_compute_headroom(ts, bucket_types_units[direction]) *
+                  share);
+
+    throttle_do_account(ts, direction, size, units);
+
+    credit->bytes += size;
+    credit->ops += units;
+    credit->op_size = ts->cfg.op_size;
+}
+
+/* give the unused part of a credit back to the buckets it was borrowed
+ * from and clear it
+ *
+ * @direction: throttle direction
+ * @credit:    the credit to return
+ */
+void throttle_repay(ThrottleState *ts, ThrottleDirection direction,
+                    ThrottleCredit *credit)
+{
+    assert(direction < THROTTLE_MAX);
+    throttle_do_account(ts, direction, -credit->bytes, -credit->ops);
+    credit->bytes = 0;
+    credit->ops = 0;
+}
+
+/* spend part of a credit on an I/O operation
+ *
+ * @size: the size of the operation
+ * @ret:  true if the credit covered the operation, false if it was left
+ *        untouched because it is too small
+ */
+bool throttle_credit_consume(ThrottleCredit *credit, uint64_t size)
+{
+    double units = throttle_units(credit->op_size, size);
+
+    if (credit->bytes < size || credit->ops < units) {
+        return false;
+    }
+
+    credit->bytes -= size;
+    credit->ops -= units;
+    return true;
 }
 
 /* return a ThrottleConfig based on the options in a ThrottleLimits